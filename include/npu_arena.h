@@ -0,0 +1,57 @@
+#ifndef NPU_ARENA_H
+#define NPU_ARENA_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Static placement of buffers whose lifetimes are known up front, such as
+ * the intermediate activations of a layer sequence, inside one DMA arena.
+ * Two blocks may share bytes only if their [first, last] step ranges don't
+ * overlap.
+ *
+ * Blocks are placed largest first, each at the lowest aligned offset that
+ * clears every already placed block it is live alongside. Large tensors
+ * then set the shape of the arena and the small ones fill the gaps they
+ * leave, which is close to the peak of the live set for chains.
+ */
+
+typedef struct {
+  size_t  size;
+  int     first;     // step that writes it, steps before the graph are < 0
+  int     last;      // last step that reads it
+  size_t  offset;    // filled in by npu_arena_plan()
+} npu_arena_block_t;
+
+typedef struct {
+  size_t  peak;      // arena size needed
+  size_t  naive;     // every block in its own aligned buffer
+  size_t  live;      // most bytes live at one step, the lower bound
+} npu_arena_stats_t;
+
+// align must be a power of two, offsets and sizes are rounded to it
+int npu_arena_plan(npu_arena_block_t *blocks, int count, size_t align, npu_arena_stats_t *stats);
+void npu_arena_report(const npu_arena_block_t *blocks, int count, const npu_arena_stats_t *stats, FILE *fp);
+
+#endif // NPU_ARENA_H
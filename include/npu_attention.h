@@ -0,0 +1,84 @@
+#ifndef NPU_ATTENTION_H
+#define NPU_ATTENTION_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "npu_context.h"
+#include "npu_pool.h"
+#include "npu_gemm.h"
+
+/*
+ * Single head scaled dot product attention, O = softmax(scale * Q K^T) V
+ * with Q Lq x d, K and V Lk x d and O Lq x d, all row-major. fp16 in, fp32
+ * out, heads are separate calls.
+ *
+ * Q K^T and P V run on the NPU through npu_matmul(), the softmax runs on the
+ * cpu in between. With causal set query i sees keys up to i + Lk - Lq, so
+ * new queries sit at the end of the sequence as in decode.
+ *
+ * Lk is padded to NPU_ATTN_LK_ALIGN with zero keys and values, a growing
+ * sequence then reuses one plan per bucket instead of one per length.
+ */
+
+#define NPU_ATTN_LK_ALIGN 128
+
+int npu_attention(npu_context_t *ctx, const _Float16 *Q, const _Float16 *K, const _Float16 *V, float *O,
+  int Lq, int Lk, int d, float scale, int causal);
+
+/*
+ * Row softmax of scale * S into fp16 P. Row i covers columns below
+ * visible + i (capped at cols), the rest of the row up to cols is zeroed.
+ * S is overwritten.
+ */
+void npu_softmax_fp16(float *S, int lds, int rows, int cols, float scale, int visible, _Float16 *P, int ldp);
+
+/*
+ * One head's K and V kept in the NPU weight layout, so attention reads them
+ * in place and a new token costs O(d) to add rather than a repack of the
+ * whole context. K is capacity kernels of d channels and V is d kernels of
+ * capacity channels, capacity rounded up to NPU_ATTN_LK_ALIGN. The views
+ * describe any prefix as an npu_tensor_t for npu_matmul_tensor().
+ */
+typedef struct {
+  npu_context_t  *ctx;
+  int            d;
+  int            capacity;
+  int            len;
+  npu_buf_t      k;
+  npu_buf_t      v;
+} npu_kv_cache_t;
+
+int npu_kv_cache_init(npu_context_t *ctx, npu_kv_cache_t *kv, int d, int capacity);
+void npu_kv_cache_destroy(npu_kv_cache_t *kv);
+void npu_kv_cache_reset(npu_kv_cache_t *kv);
+// tokens rows of d, -ENOSPC past capacity
+int npu_kv_cache_append(npu_kv_cache_t *kv, const _Float16 *k, const _Float16 *v, int tokens);
+void npu_kv_cache_k_view(const npu_kv_cache_t *kv, int len, npu_tensor_t *t);
+void npu_kv_cache_v_view(const npu_kv_cache_t *kv, int len, npu_tensor_t *t);
+
+// npu_attention() over the cache's len tokens
+int npu_attention_kv(npu_context_t *ctx, const _Float16 *Q, const npu_kv_cache_t *kv, float *O, int Lq, float scale,
+  int causal);
+
+#endif // NPU_ATTENTION_H
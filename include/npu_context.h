@@ -0,0 +1,87 @@
+#ifndef NPU_CONTEXT_H
+#define NPU_CONTEXT_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "npu_pool.h"
+
+/*
+ * Shared handle on the NPU. Nothing touches the device until it is needed,
+ * the fd is opened on first use and the capabilities are read once and then
+ * served from the cache. The context owns a buffer pool and a plan cache,
+ * all of it may be used from any thread. The pool is cacheable, whoever
+ * writes or reads its buffers on the cpu syncs them with npu_pool_sync_*().
+ */
+
+#define NPU_CORES        3    // RK3588, the driver has no query for it
+#define NPU_PLAN_BUCKETS 64
+#define NPU_PLAN_MAX     128  // default bound on cached plans
+
+typedef struct {
+  uint32_t  hw_version;
+  uint32_t  drv_version;
+  uint32_t  iommu_enabled;
+  uint32_t  sram_size;     // bytes of on-chip SRAM, 0 if none
+  uint32_t  cores;
+} npu_caps_t;
+
+struct npu_plan_entry;
+
+typedef struct {
+  int                    fd;
+  int                    caps_valid;
+  npu_caps_t             caps;
+  int                    pool_valid;
+  npu_pool_t             pool;
+  struct npu_plan_entry  *plans[NPU_PLAN_BUCKETS];
+  uint32_t               plan_count;
+  uint32_t               plan_max;
+  uint64_t               plan_clock;
+  pthread_mutex_t        lock;
+} npu_context_t;
+
+void npu_context_init(npu_context_t *ctx);
+void npu_context_destroy(npu_context_t *ctx);
+
+int npu_context_fd(npu_context_t *ctx);
+const npu_caps_t *npu_context_caps(npu_context_t *ctx);
+npu_pool_t *npu_context_pool(npu_context_t *ctx);
+
+/*
+ * Plans are keyed by the bytes of key. Adding a key that is already there
+ * frees the new plan and returns the cached one, so two threads racing to
+ * build the same plan both end up with the same pointer.
+ *
+ * Both find and add hold the plan for the caller until it is released.
+ * Past plan_max plans the least recently used ones nobody holds are freed.
+ * Dropping frees the plans whose key matches, a plan still held is freed
+ * on its last release instead. Whatever is left goes with the context.
+ */
+void *npu_context_find_plan(npu_context_t *ctx, const void *key, size_t key_size);
+void *npu_context_add_plan(npu_context_t *ctx, const void *key, size_t key_size, void *plan, void (*free_plan)(void *plan));
+void npu_context_release_plan(npu_context_t *ctx, const void *key, size_t key_size, void *plan);
+void npu_context_drop_plans(npu_context_t *ctx, int (*match)(const void *key, size_t key_size, void *arg), void *arg);
+
+#endif // NPU_CONTEXT_H
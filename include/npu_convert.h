@@ -0,0 +1,64 @@
+#ifndef NPU_CONVERT_H
+#define NPU_CONVERT_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * fp32 <-> fp16 conversion, round to nearest even. Uses NEON on aarch64,
+ * F16C on x86 builds compiled with it (-mf16c -mavx, there is no runtime
+ * check), otherwise a portable bit exact fallback.
+ */
+void npu_fp32_to_fp16(const float *src, _Float16 *dst, size_t n);
+void npu_fp16_to_fp32(const _Float16 *src, float *dst, size_t n);
+
+/*
+ * Feature (input) packing from a row-major M x K matrix with row stride lda.
+ * The packed tensor has 'height' rows (>= M) and K rounded up to 32 channels,
+ * i.e. feature_data(roundup(K,32), height, 1, C2, ...) with C2 = 8 for fp16
+ * and 16 for int8. Padding is zero filled.
+ */
+void npu_pack_feature_fp32(const float *src, int lda, int M, int K, int height, _Float16 *dst);
+void npu_pack_feature_fp16(const _Float16 *src, int lda, int M, int K, int height, _Float16 *dst);
+void npu_pack_feature_int8(const int8_t *src, int lda, int M, int K, int height, int8_t *dst);
+
+/*
+ * Output unpacking into a row-major M x N matrix with row stride ldc. The
+ * NPU output has 'height' rows and N channels, C2 = 4 for fp32/int32 and
+ * 8 for fp16 output.
+ */
+void npu_unpack_output_fp32(const float *src, int height, int M, int N, float *dst, int ldc);
+void npu_unpack_output_fp32_fp16(const float *src, int height, int M, int N, _Float16 *dst, int ldc);
+void npu_unpack_output_fp16(const _Float16 *src, int height, int M, int N, _Float16 *dst, int ldc);
+void npu_unpack_output_fp16_fp32(const _Float16 *src, int height, int M, int N, float *dst, int ldc);
+void npu_unpack_output_int32(const int32_t *src, int height, int M, int N, int32_t *dst, int ldc);
+
+/*
+ * Weight packing from a row-major N x K matrix (one row per kernel) with row
+ * stride ldb, same layout and size as pack_weight_fp16() / pack_weight_int8()
+ * but every byte of dst is written once, no clear first.
+ */
+void npu_pack_weight_fp16(const _Float16 *src, int ldb, int N, int K, _Float16 *dst);
+void npu_pack_weight_int8(const int8_t *src, int ldb, int N, int K, int8_t *dst);
+
+#endif // NPU_CONVERT_H
@@ -0,0 +1,68 @@
+#ifndef NPU_DVFS_H
+#define NPU_DVFS_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+
+/*
+ * Clock, voltage and DRAM bandwidth QoS settings applied together as named
+ * profiles. Only the fields named in valid are written, 0 is a real
+ * setting (the lowest bus priority). Voltage is normally left to the
+ * driver's OPP table, only set it for a custom profile on a board where
+ * the safe range is known.
+ */
+
+#define NPU_DVFS_FREQ          (1 << 0)
+#define NPU_DVFS_VOLT          (1 << 1)
+#define NPU_DVFS_BW_PRIORITY   (1 << 2)
+#define NPU_DVFS_BW_EXPECT     (1 << 3)
+#define NPU_DVFS_BW_TW         (1 << 4)
+#define NPU_DVFS_BW            (NPU_DVFS_BW_PRIORITY | NPU_DVFS_BW_EXPECT | NPU_DVFS_BW_TW)
+#define NPU_DVFS_ALL           (NPU_DVFS_FREQ | NPU_DVFS_VOLT | NPU_DVFS_BW)
+
+enum {
+  npu_dvfs_max_throughput = 0,  // top clock, high bandwidth expectation
+  npu_dvfs_latency,             // top clock, highest bus priority, short QoS window
+  npu_dvfs_power_save,          // lowest clock, background bus priority
+  npu_dvfs_profiles
+};
+
+typedef struct {
+  uint32_t  valid;         // NPU_DVFS_* fields to apply
+  uint32_t  freq;          // Hz
+  uint32_t  volt;          // uV
+  uint32_t  bw_priority;
+  uint32_t  bw_expect;
+  uint32_t  bw_tw;         // bandwidth QoS time window
+} npu_dvfs_state_t;
+
+#define NPU_FREQ_MAX 1000000000
+#define NPU_FREQ_MIN 300000000
+
+int npu_dvfs_get(int fd, npu_dvfs_state_t *state);
+int npu_dvfs_set(int fd, const npu_dvfs_state_t *state);
+int npu_dvfs_apply(int fd, int profile);
+const npu_dvfs_state_t *npu_dvfs_profile(int profile);
+const char *npu_dvfs_profile_name(int profile);
+int npu_dvfs_profile_from_name(const char *name);
+
+#endif // NPU_DVFS_H
@@ -0,0 +1,52 @@
+#ifndef NPU_EMU_H
+#define NPU_EMU_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+
+#include "npu_interface.h"
+
+/*
+ * In-process functional model of the rknpu driver and the matmul datapath,
+ * for machines without an NPU. BOs are memfd backed with made up 32 bit dma
+ * addresses. A submit decodes each task's regcmd and runs the CNA / CORE /
+ * DPU matmul it describes on the cpu, reading and writing the emulated BOs
+ * in the same layouts the hardware uses. Jobs finish before the submit
+ * returns, out-fences are already signalled.
+ *
+ * Only what gen_matmul_task() programs is modelled: 1x1 direct convolution
+ * (matmul) with fp16 or int8 input and fp32, fp16 or int32 output, and the
+ * DPU BS stage ReLU.
+ */
+
+typedef struct {
+  uint64_t  submits;
+  uint64_t  tasks;
+  uint64_t  macs;
+  uint32_t  live_bos;
+  uint64_t  live_bytes;
+} npu_emu_stats_t;
+
+const npu_backend_t *npu_backend_emu(void);
+void npu_emu_get_stats(npu_emu_stats_t *stats);
+
+#endif // NPU_EMU_H
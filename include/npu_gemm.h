@@ -0,0 +1,120 @@
+#ifndef NPU_GEMM_H
+#define NPU_GEMM_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "npu_context.h"
+#include "npu_weights.h"
+
+/*
+ * Row-major matmul on top of the context, C = A * B^T with A M x K, B N x K
+ * (one row per output column, as weights are usually stored) and C M x N,
+ * all densely packed. Padding to the NPU's 4 row / 32 channel / 16 or 32
+ * kernel granules, packing and unpacking are done here.
+ *
+ * The first call for a shape builds a plan, cached in the context: pool
+ * buffers for the packed operands and one task program per core. Shapes
+ * that don't fit the CBUF in one task are split into M and N tiles, and the
+ * tiles are spread over the cores. K is never split, a K whose single row
+ * doesn't fit a CBUF bank (16384 fp16 / 32768 int8) is rejected.
+ */
+
+#define NPU_GEMM_M_TILE_MAX  384   // tallest tile the matmul tests cover
+#define NPU_GEMM_N_TILE_MAX  4096
+#define NPU_GEMM_N_TILE_MIN  64    // narrower isn't worth another core
+#define NPU_TENSOR_MAX_PARTS 4
+
+enum {
+  npu_dtype_fp16 = 0,    // fp16 A and B, fp32 C
+  npu_dtype_fp16_fp16,   // fp16 A, B and C
+  npu_dtype_int8,        // int8 A and B, int32 C
+};
+
+typedef struct {
+  int       m_tile;         // rows per task, a multiple of 4 or 1
+  int       n_tile;         // kernels per task, a multiple of 16 (32 for int8)
+  int       m_tiles;
+  int       n_tiles;
+  int       cores;          // cores used, each runs a contiguous run of tiles
+  int       data_banks;     // CBUF split the generator programs for the tile
+  int       weight_banks;
+  uint64_t  feature_bytes;  // predicted DRAM traffic, A is read per N tile
+  uint64_t  weight_bytes;   // and B per M tile
+  uint64_t  output_bytes;
+  uint64_t  dram_bytes;
+} npu_matmul_tiling_t;
+
+// The M/N tiling with the least predicted traffic that keeps as many cores busy as the heuristic
+int npu_matmul_tiling(int dtype, int M, int K, int N, int cores, npu_matmul_tiling_t *t);
+// Tallest M tile with the rest of the CBUF to weights, N split to spread over the cores
+int npu_matmul_tiling_heuristic(int dtype, int M, int K, int N, int cores, npu_matmul_tiling_t *t);
+
+// Calls for the same shape are serialised, different shapes run in parallel
+int npu_matmul(npu_context_t *ctx, const void *A, const void *B, void *C, int M, int K, int N, int dtype);
+
+/*
+ * Resident B, packed and uploaded once into the context pool. Plans built
+ * on a tensor point the tasks straight at it, so a call only packs A and
+ * unpacks C. fp16 tensors serve both fp16 dtypes. Plans are keyed on the
+ * tensor's address and dropped when it is freed, a tensor must not be freed
+ * while a call is using it.
+ * A view (e.g. a prefix of a KV cache) is a copy of the struct describing
+ * part of another tensor's buffer, it isn't freed.
+ */
+typedef struct {
+  npu_context_t  *ctx;
+  int            precision;  // precision_float16 or precision_int8
+  int            n;          // columns of C, all parts and their padding
+  int            k;
+  int            k_stride;   // packed channels per kernel, roundup(k, 32) unless a view
+  npu_buf_t      buf;
+  int            parts;
+  int            part_n[NPU_TENSOR_MAX_PARTS];
+  int            part_offset[NPU_TENSOR_MAX_PARTS];  // first column in C
+} npu_tensor_t;
+
+// A projection's columns inside a fused C
+typedef struct {
+  void  *data;
+  int   n;
+  int   ld;   // row stride in elements
+} npu_view_t;
+
+int npu_tensor_upload(npu_context_t *ctx, const void *B, int N, int K, int precision, npu_tensor_t *t);
+int npu_tensor_load(npu_context_t *ctx, const npu_weights_file_t *f, const npu_weights_entry_t *e, npu_tensor_t *t);
+void npu_tensor_free(npu_tensor_t *t);
+
+/*
+ * Several B sharing K concatenated along N (Q, K and V, or gate and up) so
+ * one wide matmul reads A once and runs as one job. C is M x t->n, views
+ * gives each part's columns of it.
+ */
+int npu_tensor_upload_fused(npu_context_t *ctx, const void *const *B, const int *N, int parts, int K, int precision,
+  npu_tensor_t *t);
+void npu_tensor_views(const npu_tensor_t *t, void *C, int dtype, npu_view_t *views);
+int npu_matmul_tensor(npu_context_t *ctx, const void *A, const npu_tensor_t *B, void *C, int M, int dtype);
+// Drops the cached plans pointing into buf, for owners of a buffer matmuls were run on
+void npu_matmul_forget(npu_context_t *ctx, const npu_buf_t *buf);
+
+#endif // NPU_GEMM_H
@@ -0,0 +1,120 @@
+#ifndef NPU_GRAPH_H
+#define NPU_GRAPH_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "npu_arena.h"
+#include "npu_context.h"
+#include "npu_pool.h"
+#include "npu_program.h"
+
+/*
+ * A small graph of fp16 ops that is compiled once into a single task
+ * program, so a whole block runs from one submit with no cpu work between
+ * ops. Activations are M x N row-major on the host side, stored on the NPU
+ * in the feature layout so one op's output is the next op's input as is.
+ *
+ * Only ops that lower onto gen_matmul_task() exist: matmul against a
+ * constant N x K weight, and relu, which has to follow a matmul and is
+ * fused into it as the DPU BS stage ReLU.
+ *
+ * Builders return a tensor id or a negative error, an error passed in as a
+ * tensor is passed on so a chain can be checked once at the end.
+ */
+
+#define NPU_GRAPH_MAX_TENSORS 64
+#define NPU_GRAPH_MAX_NODES   32
+#define NPU_GRAPH_ALIGN       64
+
+enum {
+  npu_op_matmul = 0,
+  npu_op_relu,
+  npu_op_fused,    // folded into the node before it
+};
+
+enum {
+  npu_tensor_activation = 0,
+  npu_tensor_weight,
+};
+
+typedef struct {
+  int             kind;
+  int             rows;       // M, or N for a weight
+  int             cols;       // channels, or K for a weight
+  int             height;     // rows as stored, padded to 4
+  int             channels;   // cols as stored, padded to 32
+  const _Float16  *data;      // weight source, read by compile
+  int             producer;   // node, -1 for inputs and weights
+  int             consumers;
+  int             input;      // index among the inputs, or -1
+  int             output;     // index among the outputs, or -1
+  int             first;      // live from node first to node last
+  int             last;
+  size_t          offset;     // into the arena (or the weights BO)
+  size_t          size;
+} npu_graph_tensor_t;
+
+typedef struct {
+  int  op;
+  int  in[2];
+  int  out;
+  int  relu;
+} npu_graph_node_t;
+
+typedef struct {
+  npu_context_t       *ctx;
+  int                 tensor_count;
+  int                 node_count;
+  int                 input_count;
+  int                 output_count;
+  npu_graph_tensor_t  tensors[NPU_GRAPH_MAX_TENSORS];
+  npu_graph_node_t    nodes[NPU_GRAPH_MAX_NODES];
+  int                 inputs[NPU_GRAPH_MAX_TENSORS];
+  int                 outputs[NPU_GRAPH_MAX_TENSORS];
+
+  int                 compiled;
+  npu_buf_t           arena;          // every activation
+  npu_buf_t           weights;
+  npu_program_t       prog;
+  npu_arena_stats_t   arena_stats;    // activation placement
+  size_t              weights_size;
+} npu_graph_t;
+
+void npu_graph_init(npu_graph_t *g, npu_context_t *ctx);
+void npu_graph_destroy(npu_graph_t *g);
+
+int npu_graph_input(npu_graph_t *g, int rows, int cols);
+// data is N x K row-major and must stay valid until npu_graph_compile()
+int npu_graph_weight(npu_graph_t *g, const _Float16 *data, int n, int k);
+int npu_graph_matmul(npu_graph_t *g, int a, int b);
+int npu_graph_relu(npu_graph_t *g, int x);
+int npu_graph_output(npu_graph_t *g, int t);
+
+int npu_graph_compile(npu_graph_t *g);
+// inputs and outputs are float rows x cols, in the order they were declared
+int npu_graph_run(npu_graph_t *g, const float *const *inputs, float *const *outputs);
+void npu_graph_report(const npu_graph_t *g, FILE *fp);
+
+#endif // NPU_GRAPH_H
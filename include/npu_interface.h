@@ -1,13 +1,105 @@
 #ifndef NPU_INTERFACE_H
 #define NPU_INTERFACE_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#define NPU_CACHE_LINE 64
+#define NPU_PAGE_SIZE  4096
+
+// Largest buffer npu_bo_alloc_hot() will try to place in SRAM
+#define NPU_SRAM_HOT_MAX (256 << 10)
+
+// npu_bo_alloc() uses IOMMU mapped pages from this size up, not CMA
+#define NPU_LARGE_BO_MIN (1 << 20)
+
+// Not a driver flag, the caller has seen RKNPU_GET_IOMMU_EN on so npu_bo_alloc() may place large BOs behind it
+#define NPU_BO_IOMMU     (1u << 31)
+
+#define NPU_MEM_FLAG_BITS 9
+
+typedef struct {
+  void      *map;
+  size_t    size;
+  uint64_t  dma_addr;
+  uint64_t  obj_addr;
+  uint32_t  handle;
+  uint32_t  flags;
+  size_t    sram_size;  // bytes backed by on-chip SRAM
+  int       imported;   // wraps a dma-buf from npu_bo_import()
+} npu_bo_t;
+
+typedef struct {
+  uint32_t  total;            // SRAM size reported by the driver
+  uint32_t  free;
+  uint64_t  bytes_in_sram;    // held by live BOs from npu_bo_alloc_hot()
+  uint64_t  sram_allocs;
+  uint64_t  fallback_allocs;  // hot allocations that ended up in DRAM
+} npu_sram_usage_t;
+
+// Live npu_bo_alloc*() memory, imports and raw mem_allocate() are not counted
+typedef struct {
+  uint64_t  bytes;
+  uint64_t  peak_bytes;
+  uint64_t  bos;
+  uint64_t  contiguous_bytes;             // no RKNPU_MEM_NON_CONTIGUOUS
+  uint64_t  flag_bytes[NPU_MEM_FLAG_BITS];  // by RKNPU_MEM_* bit
+  uint64_t  flag_bos[NPU_MEM_FLAG_BITS];
+} npu_mem_usage_t;
+
+typedef int (*npu_ioctl_fn)(int fd, unsigned long request, void *arg);
+
+/*
+ * Device backend, everything that talks to the driver goes through one of
+ * these. Mappings returned by mmap are released with munmap() whatever the
+ * backend.
+ */
+typedef struct {
+  const char  *name;
+  int         (*open)(void);
+  int         (*close)(int fd);
+  int         (*ioctl)(int fd, unsigned long request, void *arg);
+  void        *(*mmap)(int fd, size_t size, uint64_t offset);
+} npu_backend_t;
+
 void* mem_allocate(int fd, size_t size, uint64_t *dma_addr, uint64_t *obj, uint32_t flags, uint32_t *handle);
 void mem_destroy(int fd, uint32_t handle, uint64_t obj_addr);
 
+int npu_bo_alloc(int fd, size_t size, uint32_t flags, npu_bo_t *bo);
+void npu_bo_free(int fd, npu_bo_t *bo);
+void npu_set_large_bo_min(size_t bytes);
+void npu_get_mem_usage(npu_mem_usage_t *usage);
+const char *npu_mem_flag_name(int bit);
+
+/*
+ * dma-buf sharing through DRM PRIME. An imported buffer is mapped and NPU
+ * addressable like any other BO and is released with npu_bo_free(), the
+ * dma-buf itself stays with its exporter. size 0 takes the dma-buf size.
+ * Importing the same dma-buf twice gives the same GEM handle, only free one.
+ */
+int npu_bo_import(int fd, int dmabuf_fd, size_t size, npu_bo_t *bo);
+int npu_bo_export(int fd, const npu_bo_t *bo, int *dmabuf_fd);
+
+int npu_bo_alloc_hot(int fd, size_t size, uint32_t flags, npu_bo_t *bo);
+void npu_set_sram_hot_max(size_t bytes);
+int npu_get_sram_size(int fd, uint32_t *total, uint32_t *free_size);
+int npu_get_sram_usage(int fd, npu_sram_usage_t *usage);
+
+int npu_sync_to_device(int fd, uint64_t obj_addr, size_t offset, size_t size);
+int npu_sync_from_device(int fd, uint64_t obj_addr, size_t offset, size_t size);
+int npu_bo_sync_to_device(int fd, npu_bo_t *bo, size_t offset, size_t size);
+int npu_bo_sync_from_device(int fd, npu_bo_t *bo, size_t offset, size_t size);
+
 int npu_open();
 int npu_close(int fd);
 int npu_reset(int fd);
 
+int npu_ioctl(int fd, unsigned long request, void *arg);
+void npu_set_ioctl_hook(npu_ioctl_fn fn);
+
+// Defaults to the rknpu driver, or the emulator when RKNPU_BACKEND=emu
+const npu_backend_t *npu_backend_drm(void);
+const npu_backend_t *npu_get_backend(void);
+void npu_set_backend(const npu_backend_t *backend);
+
 #endif // NPU_INTERFACE_H
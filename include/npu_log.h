@@ -0,0 +1,47 @@
+#ifndef NPU_LOG_H
+#define NPU_LOG_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Diagnostics are silent unless a level is set with npu_set_log_level() or
+ * the RKNPU_LOG environment variable (error, info, debug or 0-3).
+ */
+
+enum {
+  NPU_LOG_NONE = 0,
+  NPU_LOG_ERROR,
+  NPU_LOG_INFO,
+  NPU_LOG_DEBUG,
+};
+
+extern int npu_log_level;
+
+#define npu_log(level, ...) \
+  do { \
+    if ((level) <= npu_log_level) \
+      npu_log_printf(__VA_ARGS__); \
+  } while (0)
+
+void npu_log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void npu_set_log_level(int level);
+
+#endif // NPU_LOG_H
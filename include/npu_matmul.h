@@ -21,6 +21,12 @@
  *
  */
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "npu_cna.h"
+#include "npu_dpu.h"
+
 typedef struct {
   uint16_t  m;
   uint16_t  k;
@@ -35,10 +41,26 @@ typedef struct {
   uint8_t   fp32tofp16;
 } matmul_params_t;
 
+// Output stages params doesn't carry, NULL or all zero is a plain matmul
+typedef struct {
+  uint8_t   relu;        // max(0, x) on the output
+} matmul_options_t;
+
 int gen_matmul_fp16(matmul_params_t *params);
 int gen_matmul_int8(matmul_params_t *params);
+int gen_matmul_fp16_ex(matmul_params_t *params, const matmul_options_t *opts);
+int gen_matmul_int8_ex(matmul_params_t *params, const matmul_options_t *opts);
+// Just the descriptors gen_matmul_* would program, for inspection and modelling
+int gen_matmul_fp16_desc(matmul_params_t *params, npu_cna_desc *cna, npu_core_desc *core, npu_dpu_desc *dpu);
+int gen_matmul_int8_desc(matmul_params_t *params, npu_cna_desc *cna, npu_core_desc *core, npu_dpu_desc *dpu);
+void gen_matmul_task(uint64_t *ops, npu_cna_desc *cna_desc, npu_core_desc *core_desc, npu_dpu_desc *dpu_desc);
 int feature_data(int C, int H, int W, int C2, int c, int h, int w);
 int weight_fp16(int C, int k, int c);
 int weight_int8(int C, int k, int c);
 
+size_t weight_size_fp16(int N, int K);
+size_t weight_size_int8(int N, int K);
+void pack_weight_fp16(int N, int K, const _Float16 *src, _Float16 *dst);
+void pack_weight_int8(int N, int K, const int8_t *src, int8_t *dst);
+
 #endif // NPU_MATMUL_H
@@ -0,0 +1,74 @@
+#ifndef NPU_PERF_H
+#define NPU_PERF_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+
+#include "npu_cna.h"
+#include "npu_dpu.h"
+
+/*
+ * First order cost model for a single CNA / CORE / DPU task. The MAC array
+ * consumes one atom per cycle, 16 kernels x 32 channels for fp16 and
+ * 32 x 32 for int8, partial atoms cost a full cycle. Feature data and
+ * weights are read from DRAM once (the generators only emit tasks whose
+ * feature data fits the CBUF), the DPU writes the output once. The task
+ * takes the longer of compute and memory time plus a fixed overhead.
+ */
+
+typedef struct {
+  uint32_t  fp16_kernels;     // kernels per atom
+  uint32_t  int8_kernels;
+  uint32_t  atom_channels;    // channels per atom
+  double    freq_mhz;
+  double    dram_gbps;        // achievable DRAM bandwidth, GB/s
+  double    task_overhead_us; // submit / PC fetch cost per task
+  uint32_t  cbuf_banks;
+  uint32_t  cbuf_bank_size;
+} npu_perf_hw_t;
+
+enum { npu_perf_compute_bound = 0, npu_perf_memory_bound = 1 };
+
+typedef struct {
+  uint64_t  macs;             // M * N * K
+  uint64_t  mac_cycles;       // atoms issued
+  double    mac_utilisation;  // macs / (mac_cycles * atom size)
+  uint64_t  feature_bytes;
+  uint64_t  weight_bytes;
+  uint64_t  output_bytes;
+  uint64_t  dram_bytes;
+  double    compute_us;
+  double    memory_us;
+  double    time_us;
+  double    intensity;        // MACs per DRAM byte
+  int       bound;
+  uint32_t  data_banks;
+  uint32_t  weight_banks;
+  double    cbuf_utilisation; // bytes resident / CBUF size
+} npu_perf_t;
+
+void npu_perf_default_hw(npu_perf_hw_t *hw);
+int npu_perf_estimate(const npu_perf_hw_t *hw, const npu_cna_desc *cna, const npu_dpu_desc *dpu, npu_perf_t *perf);
+// precision is precision_float16 or precision_int8, fp16_out only applies to fp16
+int npu_perf_matmul(const npu_perf_hw_t *hw, int precision, int M, int K, int N, int fp16_out, npu_perf_t *perf);
+
+#endif // NPU_PERF_H
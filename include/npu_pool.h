@@ -0,0 +1,103 @@
+#ifndef NPU_POOL_H
+#define NPU_POOL_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "npu_interface.h"
+
+/*
+ * Sub-allocator over large BOs. Requests are rounded up to a power of two
+ * size class (64 bytes .. 2MB) and carved out of NPU_POOL_CHUNK_SIZE BOs,
+ * freed ranges go on per class free lists. Anything bigger than the largest
+ * class gets a dedicated BO.
+ *
+ * BOs come from a backend so the pool can be driven without /dev/dri.
+ */
+
+#define NPU_POOL_MIN_SHIFT   6
+#define NPU_POOL_CLASSES     16
+#define NPU_POOL_MIN_ALIGN   64
+#define NPU_POOL_CHUNK_SIZE  (4 << 20)
+
+typedef struct {
+  int   (*alloc)(void *ctx, size_t size, uint32_t flags, npu_bo_t *bo);
+  void  (*free)(void *ctx, npu_bo_t *bo);
+  int   (*sync)(void *ctx, npu_bo_t *bo, size_t offset, size_t size, int to_device);  // optional
+  void  *ctx;
+} npu_pool_backend_t;
+
+struct npu_pool_chunk;
+struct npu_pool_block;
+
+typedef struct {
+  void      *map;        // cpu address
+  uint64_t  dma_addr;    // npu address
+  uint64_t  obj_addr;    // owning BO, needed for cache sync
+  size_t    offset;      // offset into the owning BO
+  size_t    size;        // usable size, >= requested
+  size_t    requested;
+  int       size_class;  // -1 for a dedicated BO
+  struct npu_pool_chunk *chunk;
+} npu_buf_t;
+
+typedef struct {
+  uint64_t  bytes_reserved;   // BO bytes held by the pool
+  uint64_t  bytes_in_use;     // size class bytes handed out
+  uint64_t  bytes_requested;  // bytes asked for by live buffers
+  uint64_t  peak_in_use;
+  uint32_t  chunks;
+  uint32_t  dedicated;
+  uint64_t  allocs;
+  uint64_t  frees;
+  uint64_t  free_list_hits;
+  uint64_t  backend_allocs;
+  uint64_t  class_live[NPU_POOL_CLASSES];
+} npu_pool_stats_t;
+
+typedef struct {
+  npu_pool_backend_t     backend;
+  uint32_t               flags;
+  size_t                 chunk_size;
+  struct npu_pool_chunk  *chunks;
+  struct npu_pool_chunk  *current;
+  size_t                 current_used;
+  struct npu_pool_block  *free_lists[NPU_POOL_CLASSES];
+  npu_pool_stats_t       stats;
+  pthread_mutex_t        lock;
+} npu_pool_t;
+
+int npu_pool_init(npu_pool_t *pool, const npu_pool_backend_t *backend, uint32_t flags, size_t chunk_size);
+int npu_pool_init_drm(npu_pool_t *pool, int fd, uint32_t flags);
+void npu_pool_destroy(npu_pool_t *pool);
+
+int npu_pool_alloc(npu_pool_t *pool, size_t size, size_t align, npu_buf_t *buf);
+void npu_pool_free(npu_pool_t *pool, npu_buf_t *buf);
+void npu_pool_get_stats(npu_pool_t *pool, npu_pool_stats_t *stats);
+
+// Cache maintenance on a range of buf, nothing to do unless the pool is RKNPU_MEM_CACHEABLE
+int npu_pool_sync_to_device(npu_pool_t *pool, const npu_buf_t *buf, size_t offset, size_t size);
+int npu_pool_sync_from_device(npu_pool_t *pool, const npu_buf_t *buf, size_t offset, size_t size);
+
+#endif // NPU_POOL_H
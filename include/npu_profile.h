@@ -0,0 +1,49 @@
+#ifndef NPU_PROFILE_H
+#define NPU_PROFILE_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+
+#include "npu_submit.h"
+
+/*
+ * Per job DRAM traffic from the NPU's read / write amount counters. The
+ * counters are device wide, a job profiled while others run on the same
+ * NPU includes their traffic too.
+ */
+
+typedef struct {
+  uint64_t  data_read;    // feature data bytes read
+  uint64_t  weight_read;  // weight bytes read
+  uint64_t  data_write;   // output bytes written
+  uint64_t  total_rw;
+  double    wall_us;
+  double    read_gbps;    // achieved, (data_read + weight_read) / wall time
+  double    write_gbps;
+} npu_profile_t;
+
+int npu_profile_clear(int fd);
+int npu_profile_read(int fd, npu_profile_t *prof);
+// Clears the counters, runs the job to completion and reads them back
+int npu_submit_profiled(int fd, const npu_job_t *job, npu_profile_t *prof);
+
+#endif // NPU_PROFILE_H
@@ -0,0 +1,94 @@
+#ifndef NPU_PROGRAM_H
+#define NPU_PROGRAM_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_matmul.h"
+#include "npu_submit.h"
+
+/*
+ * Builds several tasks into one regcmd buffer and one struct rknpu_task
+ * array so they run from a single RKNPU_SUBMIT.
+ *
+ * Each task is its register writes followed by RKNPU_PC_DATA_EXTRA_AMOUNT
+ * ops added here: PC_BASE_ADDRESS and PC_REGISTER_AMOUNTS point the PC at
+ * the next task (zero for the last), then OP_40 and the block enable. Task
+ * blocks start on NPU_PROGRAM_ALIGN boundaries. Addresses are only known
+ * once the regcmd BO exists, npu_program_layout() fills them in.
+ */
+
+#define NPU_PROGRAM_ALIGN          64
+// The PC fetches register commands in pairs on rk3588
+#define NPU_PC_DATA_AMOUNT_SCALE   2
+
+typedef struct {
+  uint64_t           *regcmd;
+  size_t             regcmd_count;     // ops, including padding
+  size_t             regcmd_capacity;
+  struct rknpu_task  *tasks;
+  uint32_t           task_count;
+  uint32_t           task_capacity;
+  npu_bo_t           regcmd_bo;
+  npu_bo_t           tasks_bo;
+} npu_program_t;
+
+typedef struct {
+  uint16_t  op;
+  uint32_t  value;
+  uint16_t  reg;
+} npu_regop_t;
+
+void npu_program_init(npu_program_t *p);
+void npu_program_free(int fd, npu_program_t *p);
+void npu_program_reset(npu_program_t *p);
+
+// ops holds amount register writes, the PC tail is appended here
+int npu_program_add_task(npu_program_t *p, const uint64_t *ops, uint32_t amount, uint32_t enable_mask, uint32_t int_mask);
+int npu_program_add_matmul_fp16(npu_program_t *p, matmul_params_t *params);
+int npu_program_add_matmul_int8(npu_program_t *p, matmul_params_t *params);
+int npu_program_add_matmul_fp16_ex(npu_program_t *p, matmul_params_t *params, const matmul_options_t *opts);
+int npu_program_add_matmul_int8_ex(npu_program_t *p, matmul_params_t *params, const matmul_options_t *opts);
+
+size_t npu_program_regcmd_size(const npu_program_t *p);
+size_t npu_program_tasks_size(const npu_program_t *p);
+// Writes the chained regcmd and task array for a regcmd buffer at regcmd_dma
+int npu_program_layout(npu_program_t *p, uint64_t regcmd_dma, uint64_t *regcmd, struct rknpu_task *tasks);
+// Allocates the BOs (reused if big enough) and lays the program out in them
+int npu_program_finalize(int fd, npu_program_t *p);
+
+void npu_program_job(const npu_program_t *p, int core, npu_job_t *job);
+int npu_program_submit(int fd, const npu_program_t *p, int core);
+
+// Host side decoding, verify walks the PC chain the way the hardware would
+void npu_regop_decode(uint64_t op, npu_regop_t *out);
+uint32_t npu_pc_register_amount(uint32_t amount);
+int npu_program_verify(const uint64_t *regcmd, uint64_t regcmd_dma, size_t regcmd_size,
+  const struct rknpu_task *tasks, uint32_t task_count);
+void npu_program_dump(FILE *fp, const uint64_t *regcmd, uint64_t regcmd_dma,
+  const struct rknpu_task *tasks, uint32_t task_count);
+
+#endif // NPU_PROGRAM_H
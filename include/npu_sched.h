@@ -0,0 +1,106 @@
+#ifndef NPU_SCHED_H
+#define NPU_SCHED_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "npu_submit.h"
+
+/*
+ * Spreads independent jobs over the NPU cores. Each core has a queue and a
+ * worker thread that submits one job at a time. A job goes to the core it
+ * asks for, or the shortest queue, and a core with nothing to do takes the
+ * oldest unpinned job from the longest other queue.
+ *
+ * Jobs run through a backend so the policy can be exercised without the NPU,
+ * npu_sched_init_sim() just sleeps for each task's sim_us.
+ */
+
+#define NPU_SCHED_MAX_CORES 3
+
+// npu_sched_init flags
+#define NPU_SCHED_NO_STEAL  (1 << 0)
+
+typedef struct npu_sched_task {
+  npu_job_t   job;       // core_mask and subcore_task are filled in per core
+  int         core;      // preferred core, -1 for any
+  int         pinned;    // never move to another core
+  uint32_t    sim_us;    // run time in simulated mode
+  void        (*done)(struct npu_sched_task *task);
+  void        *user;
+  // Set on completion
+  int         ran_on;
+  int         status;
+  int         stolen;
+  struct npu_sched_task *next;
+} npu_sched_task_t;
+
+typedef struct {
+  int   (*run)(void *ctx, int core, npu_sched_task_t *task);
+  void  *ctx;
+} npu_sched_backend_t;
+
+typedef struct {
+  uint64_t  submitted;
+  uint64_t  completed;
+  uint64_t  elapsed_ns;                         // since init
+  uint32_t  queue_depth[NPU_SCHED_MAX_CORES];   // waiting, not running
+  uint32_t  peak_depth[NPU_SCHED_MAX_CORES];
+  uint64_t  jobs[NPU_SCHED_MAX_CORES];
+  uint64_t  stolen[NPU_SCHED_MAX_CORES];        // jobs this core took from others
+  uint64_t  busy_ns[NPU_SCHED_MAX_CORES];
+  double    utilisation[NPU_SCHED_MAX_CORES];   // busy_ns / elapsed_ns
+} npu_sched_stats_t;
+
+struct npu_sched_core {
+  npu_sched_task_t  *head;
+  npu_sched_task_t  *tail;
+  uint32_t          depth;
+  int               running;
+  pthread_t         thread;
+};
+
+typedef struct {
+  npu_sched_backend_t    backend;
+  int                    num_cores;
+  uint32_t               flags;
+  int                    stop;
+  uint64_t               start_ns;
+  struct npu_sched_core  cores[NPU_SCHED_MAX_CORES];
+  npu_sched_stats_t      stats;
+  pthread_mutex_t        lock;
+  pthread_cond_t         work;
+  pthread_cond_t         idle;
+} npu_sched_t;
+
+int npu_sched_init(npu_sched_t *s, const npu_sched_backend_t *backend, int num_cores, uint32_t flags);
+int npu_sched_init_drm(npu_sched_t *s, int fd, int num_cores, uint32_t flags);
+int npu_sched_init_sim(npu_sched_t *s, int num_cores, uint32_t flags);
+void npu_sched_destroy(npu_sched_t *s);
+
+// task must stay valid until its done callback has run
+int npu_sched_submit(npu_sched_t *s, npu_sched_task_t *task);
+void npu_sched_wait_idle(npu_sched_t *s);
+void npu_sched_get_stats(npu_sched_t *s, npu_sched_stats_t *stats);
+
+#endif // NPU_SCHED_H
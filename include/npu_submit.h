@@ -0,0 +1,81 @@
+#ifndef NPU_SUBMIT_H
+#define NPU_SUBMIT_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+
+#include "rknpu-ioctl.h"
+
+#define NPU_SUBMIT_TIMEOUT 6000  // ms, what the tests have always used
+
+typedef struct {
+  uint64_t  task_obj_addr;  // BO holding the struct rknpu_task array
+  uint32_t  task_start;
+  uint32_t  task_number;
+  uint32_t  core_mask;      // 0 means core 0
+  int32_t   priority;
+  uint32_t  timeout;        // ms per attempt, 0 means npu_set_submit_timeout()
+  uint32_t  flags;          // extra RKNPU_JOB_* flags e.g. RKNPU_JOB_PINGPONG
+  // Only needed for multi core jobs, left zero the range above is put in
+  // the slot of the first core in core_mask
+  struct rknpu_subcore_task subcore_task[5];
+  uint32_t  retries;        // resubmits allowed after a timeout or fault
+  // Optional cpu map of the task array, the int_status of the last task
+  // of each range is then checked against its int_mask
+  struct rknpu_task *tasks;
+} npu_job_t;
+
+typedef struct {
+  uint64_t  submits;    // blocking attempts, retries included
+  uint64_t  timeouts;
+  uint64_t  faults;     // completed with an unexpected int_status
+  uint64_t  resets;
+  uint64_t  retries;
+  uint64_t  failures;   // jobs that ran out of retries
+} npu_submit_stats_t;
+
+/*
+ * Blocking submit. A job that times out or faults leaves the NPU in an
+ * unknown state, so the device is reset with npu_reset() and the job is
+ * resubmitted up to job->retries times. Returns -ETIMEDOUT or -EIO once the
+ * retries are used up, other errors are returned straight away.
+ */
+int npu_submit(int fd, const npu_job_t *job);
+void npu_set_submit_timeout(uint32_t timeout_ms);
+void npu_get_submit_stats(npu_submit_stats_t *stats);
+void npu_clear_submit_stats(void);
+int npu_int_status_ok(uint32_t int_status, uint32_t int_mask);
+
+/*
+ * Returns as soon as the job is queued, *out_fence receives a sync_file fd
+ * that signals on completion. in_fence (or -1) makes the job wait for
+ * another fence first. Every BO the job uses must stay alive until the
+ * fence signals. There is no retry, a fence that does not signal in time
+ * should be followed by npu_reset().
+ */
+int npu_submit_async(int fd, const npu_job_t *job, int in_fence, int *out_fence);
+
+int npu_fence_wait(int fence_fd, int timeout_ms);
+int npu_fence_poll(int fence_fd);
+void npu_fence_close(int fence_fd);
+
+#endif // NPU_SUBMIT_H
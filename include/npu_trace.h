@@ -0,0 +1,75 @@
+#ifndef NPU_TRACE_H
+#define NPU_TRACE_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Timestamped spans recorded into a per-thread ring buffer and written out
+ * as Chrome trace JSON (chrome://tracing, Perfetto). Recording takes no
+ * locks, each thread only writes its own ring and the oldest events are
+ * overwritten once it is full.
+ *
+ * Off by default, npu_trace_enable() or RKNPU_TRACE=<file> turns it on, the
+ * latter also writes the file at exit. Building with -Dtrace=false compiles
+ * the trace points out. Dump while the traced threads are quiescent, a ring
+ * being written during a dump may yield a torn event.
+ */
+
+#define NPU_TRACE_RING_SIZE  4096   // events per thread, power of two
+
+enum {
+  npu_trace_alloc = 0,
+  npu_trace_pack,
+  npu_trace_regcmd,
+  npu_trace_submit,
+  npu_trace_wait,
+  npu_trace_unpack,
+  npu_trace_events
+};
+
+extern int npu_trace_on;
+
+void npu_trace_enable(int enable);
+uint64_t npu_trace_now(void);
+void npu_trace_record(int event, uint64_t start_ns, uint64_t arg);
+uint32_t npu_trace_count(void);
+void npu_trace_clear(void);
+int npu_trace_write(FILE *fp);
+int npu_trace_dump(const char *path);
+const char *npu_trace_event_name(int event);
+
+#ifdef NPU_NO_TRACE
+#define NPU_TRACE_BEGIN()              0
+#define NPU_TRACE_END(event, start, arg) do { (void)(start); } while (0)
+#else
+// Returns 0 when tracing is off so the end point is a single branch
+#define NPU_TRACE_BEGIN()  (npu_trace_on ? npu_trace_now() : 0)
+#define NPU_TRACE_END(event, start, arg) \
+  do { \
+    if (start) \
+      npu_trace_record((event), (start), (arg)); \
+  } while (0)
+#endif
+
+#endif // NPU_TRACE_H
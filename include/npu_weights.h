@@ -0,0 +1,95 @@
+#ifndef NPU_WEIGHTS_H
+#define NPU_WEIGHTS_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "npu_interface.h"
+
+/*
+ * Pre-packed weight file (.rknw), all fields little endian :
+ *
+ *   header     npu_weights_header_t
+ *   payloads   each one starts on a NPU_WEIGHTS_ALIGN boundary and holds the
+ *              tensor already in weight_fp16() / weight_int8() layout
+ *   table      tensor_count x npu_weights_entry_t at table_offset
+ *
+ * Payloads are page aligned so the file can be mmapped and handed to the NPU
+ * without repacking.
+ */
+
+#define NPU_WEIGHTS_MAGIC    0x574e4b52  // "RKNW"
+#define NPU_WEIGHTS_VERSION  1
+#define NPU_WEIGHTS_ALIGN    4096
+#define NPU_WEIGHTS_NAME_LEN 64
+
+enum { npu_layout_weight_fp16 = 1,
+       npu_layout_weight_int8 = 2};
+
+typedef struct {
+  uint32_t  magic;
+  uint32_t  version;
+  uint32_t  tensor_count;
+  uint32_t  alignment;
+  uint64_t  table_offset;
+  uint64_t  file_size;
+} npu_weights_header_t;
+
+typedef struct {
+  char      name[NPU_WEIGHTS_NAME_LEN];
+  uint32_t  precision;  // precision_float16 or precision_int8
+  uint32_t  layout;     // npu_layout_weight_*
+  uint32_t  n;          // kernels (rows of the row-major source)
+  uint32_t  k;          // channels
+  uint64_t  offset;     // payload offset from start of file
+  uint64_t  size;       // payload size in bytes
+} npu_weights_entry_t;
+
+typedef struct {
+  FILE                 *fp;
+  uint64_t             pos;
+  uint32_t             count;
+  uint32_t             capacity;
+  npu_weights_entry_t  *entries;
+} npu_weights_writer_t;
+
+typedef struct {
+  int                        fd;
+  void                       *map;
+  size_t                     size;
+  const npu_weights_header_t *header;
+  const npu_weights_entry_t  *entries;
+} npu_weights_file_t;
+
+int npu_weights_writer_open(npu_weights_writer_t *w, const char *path);
+int npu_weights_writer_add(npu_weights_writer_t *w, const char *name, int precision, int N, int K, const void *src);
+int npu_weights_writer_close(npu_weights_writer_t *w);
+
+int npu_weights_open(npu_weights_file_t *f, const char *path);
+void npu_weights_close(npu_weights_file_t *f);
+const npu_weights_entry_t *npu_weights_find(const npu_weights_file_t *f, const char *name);
+const void *npu_weights_payload(const npu_weights_file_t *f, const npu_weights_entry_t *e);
+int npu_weights_upload(int fd, const npu_weights_file_t *f, const npu_weights_entry_t *e, npu_bo_t *bo);
+
+#endif // NPU_WEIGHTS_H
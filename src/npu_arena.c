@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "npu_arena.h"
+
+static size_t align_up(size_t v, size_t a) {
+  return (v + a - 1) & ~(a - 1);
+}
+
+static int overlaps(const npu_arena_block_t *a, const npu_arena_block_t *b) {
+  return (a->first <= b->last) && (b->first <= a->last);
+}
+
+// Largest first, ties by first use
+static int before(const npu_arena_block_t *a, const npu_arena_block_t *b) {
+  if (a->size != b->size)
+    return a->size > b->size;
+  return a->first < b->first;
+}
+
+int npu_arena_plan(npu_arena_block_t *blocks, int count, size_t align, npu_arena_stats_t *stats) {
+
+  int *order, *placed;
+
+  memset(stats, 0, sizeof(*stats));
+  if ((count < 0) || (align == 0) || ((align & (align - 1)) != 0))
+    return -EINVAL;
+  if (count == 0)
+    return 0;
+
+  order = malloc(count * sizeof(int));
+  placed = malloc(count * sizeof(int));
+  if ((order == NULL) || (placed == NULL)) {
+    free(order);
+    free(placed);
+    return -ENOMEM;
+  }
+
+  // Graphs are tens of blocks, insertion sorts are plenty
+  for (int i = 0; i < count; i++) {
+    int j = i;
+    for (; (j > 0) && before(&blocks[i], &blocks[order[j - 1]]); j--)
+      order[j] = order[j - 1];
+    order[j] = i;
+  }
+
+  for (int i = 0; i < count; i++) {
+    npu_arena_block_t *b = &blocks[order[i]];
+    size_t size = align_up(b->size, align), offset = 0;
+    int n = 0;
+
+    // Walk the conflicting blocks in address order and take the first gap
+    for (int j = 0; j < i; j++) {
+      const npu_arena_block_t *o = &blocks[order[j]];
+      int k = n;
+      if (!overlaps(b, o))
+        continue;
+      n++;
+      for (; (k > 0) && (blocks[placed[k - 1]].offset > o->offset); k--)
+        placed[k] = placed[k - 1];
+      placed[k] = order[j];
+    }
+    for (int j = 0; j < n; j++) {
+      const npu_arena_block_t *o = &blocks[placed[j]];
+      if (offset + size <= o->offset)
+        break;
+      if (o->offset + o->size > offset)
+        offset = align_up(o->offset + o->size, align);
+    }
+
+    b->offset = offset;
+    stats->naive += size;
+    if (offset + size > stats->peak)
+      stats->peak = offset + size;
+  }
+
+  // The bytes live at each step, only steps where a block starts can peak
+  for (int i = 0; i < count; i++) {
+    size_t live = 0;
+    for (int j = 0; j < count; j++) {
+      if ((blocks[j].first <= blocks[i].first) && (blocks[i].first <= blocks[j].last))
+        live += align_up(blocks[j].size, align);
+    }
+    if (live > stats->live)
+      stats->live = live;
+  }
+
+  free(order);
+  free(placed);
+  return 0;
+}
+
+void npu_arena_report(const npu_arena_block_t *blocks, int count, const npu_arena_stats_t *stats, FILE *fp) {
+
+  fprintf(fp, "arena: %d buffers, peak %zu bytes, naive %zu bytes", count, stats->peak, stats->naive);
+  if (stats->naive > 0)
+    fprintf(fp, " (%.1f%% saved)", 100.0 * (stats->naive - stats->peak) / stats->naive);
+  fprintf(fp, ", live set %zu bytes\n", stats->live);
+  for (int i = 0; i < count; i++)
+    fprintf(fp, "  %3d steps %3d..%-3d offset %10zu size %10zu\n", i, blocks[i].first, blocks[i].last,
+      blocks[i].offset, blocks[i].size);
+}
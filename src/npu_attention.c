@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "npu_convert.h"
+#include "npu_gemm.h"
+#include "npu_log.h"
+#include "npu_hw.h"
+#include "npu_matmul.h"
+#include "npu_attention.h"
+
+/*
+ * The DPU has a LUT stage that could take the exp, but how it is programmed
+ * isn't known, so this stays on the cpu. The loops are kept simple enough
+ * for the compiler to vectorise.
+ */
+void npu_softmax_fp16(float *S, int lds, int rows, int cols, float scale, int visible, _Float16 *P, int ldp) {
+
+  for (int i = 0; i < rows; i++) {
+    float *s = S + (size_t)i * lds;
+    _Float16 *p = P + (size_t)i * ldp;
+    int n = visible + i;
+    float max = -INFINITY, sum = 0, inv;
+
+    if (n > cols)
+      n = cols;
+    if (n < 0)
+      n = 0;
+
+    for (int j = 0; j < n; j++) {
+      s[j] *= scale;
+      max = (s[j] > max) ? s[j] : max;
+    }
+    for (int j = 0; j < n; j++) {
+      s[j] = expf(s[j] - max);
+      sum += s[j];
+    }
+    inv = (n > 0) ? 1.0f / sum : 0;
+    for (int j = 0; j < n; j++)
+      s[j] *= inv;
+
+    npu_fp32_to_fp16(s, p, n);
+    memset(p + n, 0, (cols - n) * sizeof(_Float16));
+  }
+}
+
+// P for Lk real keys out of lk, the padding keys get zero weight
+static void softmax_padded(float *s, _Float16 *p, int Lq, int Lk, int lk, float scale, int causal) {
+
+  npu_softmax_fp16(s, lk, Lq, Lk, scale, causal ? Lk - Lq + 1 : Lk, p, lk);
+  for (int i = 0; i < Lq; i++)
+    memset(p + (size_t)i * lk + Lk, 0, (lk - Lk) * sizeof(_Float16));
+}
+
+static int bucket(int Lk) {
+  return ((Lk + NPU_ATTN_LK_ALIGN - 1) / NPU_ATTN_LK_ALIGN) * NPU_ATTN_LK_ALIGN;
+}
+
+int npu_attention(npu_context_t *ctx, const _Float16 *Q, const _Float16 *K, const _Float16 *V, float *O,
+  int Lq, int Lk, int d, float scale, int causal) {
+
+  int lk = bucket(Lk);
+  float *s = NULL;
+  _Float16 *p = NULL, *kp = NULL, *vt = NULL;
+  int ret = -ENOMEM;
+
+  if ((Lq <= 0) || (Lk <= 0) || (d <= 0))
+    return -EINVAL;
+
+  s = malloc((size_t)Lq * lk * sizeof(float));
+  p = malloc((size_t)Lq * lk * sizeof(_Float16));
+  vt = malloc((size_t)d * lk * sizeof(_Float16));
+  if (lk != Lk)
+    kp = malloc((size_t)lk * d * sizeof(_Float16));
+  if ((s == NULL) || (p == NULL) || (vt == NULL) || ((lk != Lk) && (kp == NULL)))
+    goto out;
+
+  // K is B as it stands, only the padding keys need adding
+  if (kp != NULL) {
+    memcpy(kp, K, (size_t)Lk * d * sizeof(_Float16));
+    memset(kp + (size_t)Lk * d, 0, (size_t)(lk - Lk) * d * sizeof(_Float16));
+  }
+  // P V wants V^T as B
+  for (int i = 0; i < d; i++) {
+    for (int j = 0; j < Lk; j++)
+      vt[(size_t)i * lk + j] = V[(size_t)j * d + i];
+    memset(vt + (size_t)i * lk + Lk, 0, (lk - Lk) * sizeof(_Float16));
+  }
+
+  ret = npu_matmul(ctx, Q, (kp != NULL) ? kp : K, s, Lq, d, lk, npu_dtype_fp16);
+  if (ret < 0)
+    goto out;
+  softmax_padded(s, p, Lq, Lk, lk, scale, causal);
+  ret = npu_matmul(ctx, p, vt, O, Lq, lk, d, npu_dtype_fp16);
+
+out:
+  if (ret < 0)
+    npu_log(NPU_LOG_ERROR, "attention %dx%dx%d failed %d\n", Lq, Lk, d, ret);
+  free(s);
+  free(p);
+  free(kp);
+  free(vt);
+  return ret;
+}
+
+int npu_kv_cache_init(npu_context_t *ctx, npu_kv_cache_t *kv, int d, int capacity) {
+
+  npu_pool_t *pool = npu_context_pool(ctx);
+
+  memset(kv, 0, sizeof(*kv));
+  if ((d <= 0) || (capacity <= 0))
+    return -EINVAL;
+  if (pool == NULL)
+    return -ENOMEM;
+
+  kv->ctx = ctx;
+  kv->d = d;
+  kv->capacity = bucket(capacity);
+  if (npu_pool_alloc(pool, weight_size_fp16(kv->capacity, d), NPU_POOL_MIN_ALIGN, &kv->k) < 0) {
+    memset(kv, 0, sizeof(*kv));
+    return -ENOMEM;
+  }
+  if (npu_pool_alloc(pool, weight_size_fp16(d, kv->capacity), NPU_POOL_MIN_ALIGN, &kv->v) < 0) {
+    npu_pool_free(pool, &kv->k);
+    memset(kv, 0, sizeof(*kv));
+    return -ENOMEM;
+  }
+  // Keys and values past len are read, they must be finite
+  memset(kv->k.map, 0, kv->k.requested);
+  memset(kv->v.map, 0, kv->v.requested);
+  if ((npu_pool_sync_to_device(pool, &kv->k, 0, kv->k.requested) < 0) ||
+      (npu_pool_sync_to_device(pool, &kv->v, 0, kv->v.requested) < 0)) {
+    npu_kv_cache_destroy(kv);
+    return -EIO;
+  }
+  return 0;
+}
+
+void npu_kv_cache_destroy(npu_kv_cache_t *kv) {
+
+  if (kv->ctx != NULL) {
+    npu_matmul_forget(kv->ctx, &kv->k);
+    npu_matmul_forget(kv->ctx, &kv->v);
+    npu_pool_free(npu_context_pool(kv->ctx), &kv->k);
+    npu_pool_free(npu_context_pool(kv->ctx), &kv->v);
+  }
+  memset(kv, 0, sizeof(*kv));
+}
+
+void npu_kv_cache_reset(npu_kv_cache_t *kv) {
+  kv->len = 0;
+}
+
+/*
+ * A token is kernel len of K, its channels land in 32 wide runs. In V it is
+ * channel len of every kernel, one element each. Either way O(d).
+ */
+int npu_kv_cache_append(npu_kv_cache_t *kv, const _Float16 *k, const _Float16 *v, int tokens) {
+
+  npu_pool_t *pool = npu_context_pool(kv->ctx);
+  int d = kv->d, dp = ((d + 31) / 32) * 32, first = kv->len;
+  _Float16 *kmap = kv->k.map, *vmap = kv->v.map;
+  size_t group = (size_t)dp * 16 * sizeof(_Float16);
+
+  if ((tokens < 0) || (kv->len + tokens > kv->capacity))
+    return -ENOSPC;
+  if (tokens == 0)
+    return 0;
+
+  for (int i = 0; i < tokens; i++, kv->len++) {
+    int t = kv->len;
+    for (int c = 0; c < d; c += 32)
+      memcpy(kmap + weight_fp16(dp, t + 1, c + 1), k + (size_t)i * d + c, ((d - c < 32) ? d - c : 32) * sizeof(_Float16));
+    for (int n = 0; n < d; n++)
+      vmap[weight_fp16(kv->capacity, n + 1, t + 1)] = v[(size_t)i * d + n];
+  }
+  // New keys are whole kernel groups of K, a token's values are spread over all of V
+  if ((npu_pool_sync_to_device(pool, &kv->k, (first / 16) * group, ((kv->len + 15) / 16 - first / 16) * group) < 0) ||
+      (npu_pool_sync_to_device(pool, &kv->v, 0, kv->v.requested) < 0))
+    return -EIO;
+  return 0;
+}
+
+void npu_kv_cache_k_view(const npu_kv_cache_t *kv, int len, npu_tensor_t *t) {
+
+  memset(t, 0, sizeof(*t));
+  t->ctx = kv->ctx;
+  t->precision = precision_float16;
+  t->n = len;
+  t->k = kv->d;
+  t->k_stride = ((kv->d + 31) / 32) * 32;
+  t->buf = kv->k;
+  t->parts = 1;
+  t->part_n[0] = len;
+}
+
+// Channels stay spaced for the full capacity whatever len is
+void npu_kv_cache_v_view(const npu_kv_cache_t *kv, int len, npu_tensor_t *t) {
+
+  memset(t, 0, sizeof(*t));
+  t->ctx = kv->ctx;
+  t->precision = precision_float16;
+  t->n = kv->d;
+  t->k = len;
+  t->k_stride = kv->capacity;
+  t->buf = kv->v;
+  t->parts = 1;
+  t->part_n[0] = kv->d;
+}
+
+int npu_attention_kv(npu_context_t *ctx, const _Float16 *Q, const npu_kv_cache_t *kv, float *O, int Lq, float scale,
+  int causal) {
+
+  int Lk = kv->len, lk = bucket(kv->len);
+  npu_tensor_t keys, values;
+  float *s = NULL;
+  _Float16 *p = NULL;
+  int ret = -ENOMEM;
+
+  if ((Lq <= 0) || (Lk <= 0) || (kv->ctx != ctx))
+    return -EINVAL;
+
+  s = malloc((size_t)Lq * lk * sizeof(float));
+  p = malloc((size_t)Lq * lk * sizeof(_Float16));
+  if ((s == NULL) || (p == NULL))
+    goto out;
+
+  npu_kv_cache_k_view(kv, lk, &keys);
+  npu_kv_cache_v_view(kv, lk, &values);
+  ret = npu_matmul_tensor(ctx, Q, &keys, s, Lq, npu_dtype_fp16);
+  if (ret < 0)
+    goto out;
+  softmax_padded(s, p, Lq, Lk, lk, scale, causal);
+  ret = npu_matmul_tensor(ctx, p, &values, O, Lq, npu_dtype_fp16);
+
+out:
+  if (ret < 0)
+    npu_log(NPU_LOG_ERROR, "cached attention %dx%dx%d failed %d\n", Lq, Lk, kv->d, ret);
+  free(s);
+  free(p);
+  return ret;
+}
@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_log.h"
+#include "npu_pool.h"
+#include "npu_context.h"
+
+struct npu_plan_entry {
+  uint64_t               hash;
+  size_t                 key_size;
+  void                   *plan;
+  void                   (*free_plan)(void *plan);
+  uint32_t               refs;      // callers between find/add and release
+  int                    stale;     // dropped while in use, freed on the last release
+  uint64_t               last_use;
+  struct npu_plan_entry  *next;
+  uint8_t                key[];
+};
+
+// FNV-1a
+static uint64_t hash_key(const void *key, size_t key_size) {
+
+  const uint8_t *p = key;
+  uint64_t hash = 0xcbf29ce484222325ull;
+
+  for (size_t i = 0; i < key_size; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+static void free_entry(struct npu_plan_entry *e) {
+
+  if (e->free_plan != NULL)
+    e->free_plan(e->plan);
+  free(e);
+}
+
+void npu_context_init(npu_context_t *ctx) {
+
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->fd = -1;
+  ctx->plan_max = NPU_PLAN_MAX;
+  pthread_mutex_init(&ctx->lock, NULL);
+}
+
+void npu_context_destroy(npu_context_t *ctx) {
+
+  for (int b = 0; b < NPU_PLAN_BUCKETS; b++) {
+    while (ctx->plans[b] != NULL) {
+      struct npu_plan_entry *e = ctx->plans[b];
+      ctx->plans[b] = e->next;
+      free_entry(e);
+    }
+  }
+  if (ctx->pool_valid)
+    npu_pool_destroy(&ctx->pool);
+  if (ctx->fd >= 0)
+    npu_close(ctx->fd);
+  pthread_mutex_destroy(&ctx->lock);
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->fd = -1;
+}
+
+static int open_locked(npu_context_t *ctx) {
+  if (ctx->fd < 0)
+    ctx->fd = npu_open();
+  return ctx->fd;
+}
+
+int npu_context_fd(npu_context_t *ctx) {
+
+  int fd;
+
+  pthread_mutex_lock(&ctx->lock);
+  fd = open_locked(ctx);
+  pthread_mutex_unlock(&ctx->lock);
+  return fd;
+}
+
+// A query the driver doesn't support leaves the field at 0
+static uint32_t query(int fd, uint32_t flags) {
+
+  struct rknpu_action act = {
+    .flags = flags,
+  };
+
+  if (npu_ioctl(fd, DRM_IOCTL_RKNPU_ACTION, &act) < 0) {
+    npu_log(NPU_LOG_INFO, "RKNPU_ACTION %u not supported\n", flags);
+    return 0;
+  }
+  return act.value;
+}
+
+static const npu_caps_t *caps_locked(npu_context_t *ctx) {
+
+  const npu_caps_t *caps = NULL;
+  int fd;
+
+  if (ctx->caps_valid) {
+    caps = &ctx->caps;
+  } else if ((fd = open_locked(ctx)) >= 0) {
+    ctx->caps.hw_version = query(fd, RKNPU_GET_HW_VERSION);
+    ctx->caps.drv_version = query(fd, RKNPU_GET_DRV_VERSION);
+    ctx->caps.iommu_enabled = query(fd, RKNPU_GET_IOMMU_EN);
+    ctx->caps.sram_size = query(fd, RKNPU_GET_TOTAL_SRAM_SIZE);
+    ctx->caps.cores = NPU_CORES;
+    ctx->caps_valid = 1;
+    caps = &ctx->caps;
+    npu_log(NPU_LOG_INFO, "npu hw 0x%x drv 0x%x iommu %u sram %u\n", ctx->caps.hw_version,
+      ctx->caps.drv_version, ctx->caps.iommu_enabled, ctx->caps.sram_size);
+  }
+  return caps;
+}
+
+const npu_caps_t *npu_context_caps(npu_context_t *ctx) {
+
+  const npu_caps_t *caps;
+
+  pthread_mutex_lock(&ctx->lock);
+  caps = caps_locked(ctx);
+  pthread_mutex_unlock(&ctx->lock);
+  return caps;
+}
+
+npu_pool_t *npu_context_pool(npu_context_t *ctx) {
+
+  npu_pool_t *pool = NULL;
+  const npu_caps_t *caps;
+
+  pthread_mutex_lock(&ctx->lock);
+  if (ctx->pool_valid) {
+    pool = &ctx->pool;
+  } else if (((caps = caps_locked(ctx)) != NULL) &&
+             (npu_pool_init_drm(&ctx->pool, ctx->fd, RKNPU_MEM_CACHEABLE | (caps->iommu_enabled ? NPU_BO_IOMMU : 0)) == 0)) {
+    ctx->pool_valid = 1;
+    pool = &ctx->pool;
+  }
+  pthread_mutex_unlock(&ctx->lock);
+  return pool;
+}
+
+static void unlink_locked(npu_context_t *ctx, struct npu_plan_entry *e) {
+
+  struct npu_plan_entry **p = &ctx->plans[e->hash % NPU_PLAN_BUCKETS];
+
+  while (*p != e)
+    p = &(*p)->next;
+  *p = e->next;
+  ctx->plan_count--;
+}
+
+static struct npu_plan_entry *find_locked(npu_context_t *ctx, uint64_t hash, const void *key, size_t key_size) {
+
+  for (struct npu_plan_entry *e = ctx->plans[hash % NPU_PLAN_BUCKETS]; e != NULL; e = e->next) {
+    if ((e->hash == hash) && (e->key_size == key_size) && !e->stale && (memcmp(e->key, key, key_size) == 0))
+      return e;
+  }
+  return NULL;
+}
+
+// Unlinks least recently used plans nobody holds until the cache is back under plan_max,
+// they are chained on victims to be freed outside the lock
+static struct npu_plan_entry *evict_locked(npu_context_t *ctx) {
+
+  struct npu_plan_entry *victims = NULL;
+
+  while (ctx->plan_count > ctx->plan_max) {
+    struct npu_plan_entry *lru = NULL;
+    for (int b = 0; b < NPU_PLAN_BUCKETS; b++) {
+      for (struct npu_plan_entry *e = ctx->plans[b]; e != NULL; e = e->next) {
+        if ((e->refs == 0) && ((lru == NULL) || (e->last_use < lru->last_use)))
+          lru = e;
+      }
+    }
+    if (lru == NULL)
+      break;
+    unlink_locked(ctx, lru);
+    lru->next = victims;
+    victims = lru;
+  }
+  return victims;
+}
+
+static void free_victims(struct npu_plan_entry *victims) {
+
+  while (victims != NULL) {
+    struct npu_plan_entry *e = victims;
+    victims = e->next;
+    free_entry(e);
+  }
+}
+
+void *npu_context_find_plan(npu_context_t *ctx, const void *key, size_t key_size) {
+
+  uint64_t hash = hash_key(key, key_size);
+  struct npu_plan_entry *e;
+
+  pthread_mutex_lock(&ctx->lock);
+  e = find_locked(ctx, hash, key, key_size);
+  if (e != NULL) {
+    e->refs++;
+    e->last_use = ++ctx->plan_clock;
+  }
+  pthread_mutex_unlock(&ctx->lock);
+  return (e != NULL) ? e->plan : NULL;
+}
+
+void *npu_context_add_plan(npu_context_t *ctx, const void *key, size_t key_size, void *plan, void (*free_plan)(void *plan)) {
+
+  uint64_t hash = hash_key(key, key_size);
+  struct npu_plan_entry *e, *victims;
+
+  pthread_mutex_lock(&ctx->lock);
+  e = find_locked(ctx, hash, key, key_size);
+  if (e != NULL) {
+    e->refs++;
+    e->last_use = ++ctx->plan_clock;
+    pthread_mutex_unlock(&ctx->lock);
+    if (free_plan != NULL)
+      free_plan(plan);
+    return e->plan;
+  }
+
+  e = malloc(sizeof(*e) + key_size);
+  if (e == NULL) {
+    pthread_mutex_unlock(&ctx->lock);
+    if (free_plan != NULL)
+      free_plan(plan);
+    return NULL;
+  }
+  e->hash = hash;
+  e->key_size = key_size;
+  e->plan = plan;
+  e->free_plan = free_plan;
+  e->refs = 1;
+  e->stale = 0;
+  e->last_use = ++ctx->plan_clock;
+  memcpy(e->key, key, key_size);
+  e->next = ctx->plans[hash % NPU_PLAN_BUCKETS];
+  ctx->plans[hash % NPU_PLAN_BUCKETS] = e;
+  ctx->plan_count++;
+  victims = evict_locked(ctx);
+  pthread_mutex_unlock(&ctx->lock);
+  free_victims(victims);
+  return plan;
+}
+
+void npu_context_release_plan(npu_context_t *ctx, const void *key, size_t key_size, void *plan) {
+
+  uint64_t hash = hash_key(key, key_size);
+  struct npu_plan_entry *e, *victims = NULL;
+
+  pthread_mutex_lock(&ctx->lock);
+  for (e = ctx->plans[hash % NPU_PLAN_BUCKETS]; e != NULL; e = e->next) {
+    if (e->plan == plan)
+      break;
+  }
+  if ((e != NULL) && (e->refs > 0) && (--e->refs == 0)) {
+    if (e->stale) {
+      unlink_locked(ctx, e);
+      e->next = NULL;
+      victims = e;
+    } else {
+      victims = evict_locked(ctx);
+    }
+  }
+  pthread_mutex_unlock(&ctx->lock);
+  free_victims(victims);
+}
+
+void npu_context_drop_plans(npu_context_t *ctx, int (*match)(const void *key, size_t key_size, void *arg), void *arg) {
+
+  struct npu_plan_entry *victims = NULL;
+
+  pthread_mutex_lock(&ctx->lock);
+  for (int b = 0; b < NPU_PLAN_BUCKETS; b++) {
+    struct npu_plan_entry **p = &ctx->plans[b];
+    while (*p != NULL) {
+      struct npu_plan_entry *e = *p;
+      if (!match(e->key, e->key_size, arg)) {
+        p = &e->next;
+      } else if (e->refs > 0) {
+        e->stale = 1;
+        p = &e->next;
+      } else {
+        *p = e->next;
+        ctx->plan_count--;
+        e->next = victims;
+        victims = e;
+      }
+    }
+  }
+  pthread_mutex_unlock(&ctx->lock);
+  free_victims(victims);
+}
@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define NPU_CVT_NEON
+#elif defined(__F16C__) && defined(__AVX__)
+#include <immintrin.h>
+#define NPU_CVT_F16C
+#endif
+
+#include "npu_convert.h"
+#include "npu_trace.h"
+
+/*
+ * Portable bit exact conversions, used for tails and when no vector unit
+ * is available.
+ */
+static inline uint16_t fp32_to_fp16_bits(float f) {
+
+  uint32_t x, absx, sign;
+
+  memcpy(&x, &f, sizeof(x));
+  sign = (x >> 16) & 0x8000;
+  absx = x & 0x7fffffff;
+
+  if (absx >= 0x7f800000) {
+    // inf stays inf, nan stays quiet nan keeping the top payload bits
+    return sign | 0x7c00 | ((absx > 0x7f800000) ? (0x200 | ((absx >> 13) & 0x3ff)) : 0);
+  }
+  if (absx >= 0x477ff000) {
+    // >= 65520 rounds up to inf
+    return sign | 0x7c00;
+  }
+  if (absx < 0x38800000) {
+    // fp16 subnormal range, anything below 2^-25 rounds to zero
+    uint32_t shift, mant, r, rem, half;
+    if (absx <= 0x33000000)
+      return sign;
+    shift = 126 - (absx >> 23);
+    mant = (absx & 0x7fffff) | 0x800000;
+    r = mant >> shift;
+    rem = mant & ((1u << shift) - 1);
+    half = 1u << (shift - 1);
+    if ((rem > half) || ((rem == half) && (r & 1)))
+      r++;
+    return sign | r;
+  }
+  // rebias the exponent (127 -> 15) and round the 13 dropped bits to even
+  absx -= 112u << 23;
+  return sign | ((absx + 0xfff + ((absx >> 13) & 1)) >> 13);
+}
+
+static inline float fp16_bits_to_fp32(uint16_t h) {
+
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  uint32_t x;
+  float f;
+
+  if (exp == 0x1f) {
+    x = sign | 0x7f800000 | (mant << 13);
+  } else if (exp != 0) {
+    x = sign | ((exp + 112) << 23) | (mant << 13);
+  } else if (mant == 0) {
+    x = sign;
+  } else {
+    // subnormal, normalise the mantissa
+    exp = 113;
+    while ((mant & 0x400) == 0) {
+      mant <<= 1;
+      exp--;
+    }
+    x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+  }
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+static inline _Float16 cvt1_f32_f16(float f) {
+
+  uint16_t bits = fp32_to_fp16_bits(f);
+  _Float16 h;
+  memcpy(&h, &bits, sizeof(h));
+  return h;
+}
+
+static inline float cvt1_f16_f32(_Float16 h) {
+
+  uint16_t bits;
+  memcpy(&bits, &h, sizeof(bits));
+  return fp16_bits_to_fp32(bits);
+}
+
+static inline void cvt8_f32_f16(const float *s, _Float16 *d) {
+#if defined(NPU_CVT_NEON)
+  vst1q_f16((float16_t *)d, vcombine_f16(vcvt_f16_f32(vld1q_f32(s)), vcvt_f16_f32(vld1q_f32(s + 4))));
+#elif defined(NPU_CVT_F16C)
+  _mm_storeu_si128((__m128i *)d, _mm256_cvtps_ph(_mm256_loadu_ps(s), _MM_FROUND_TO_NEAREST_INT));
+#else
+  for (int i = 0; i < 8; i++)
+    d[i] = cvt1_f32_f16(s[i]);
+#endif
+}
+
+static inline void cvt4_f32_f16(const float *s, _Float16 *d) {
+#if defined(NPU_CVT_NEON)
+  vst1_f16((float16_t *)d, vcvt_f16_f32(vld1q_f32(s)));
+#elif defined(NPU_CVT_F16C)
+  _mm_storel_epi64((__m128i *)d, _mm_cvtps_ph(_mm_loadu_ps(s), _MM_FROUND_TO_NEAREST_INT));
+#else
+  for (int i = 0; i < 4; i++)
+    d[i] = cvt1_f32_f16(s[i]);
+#endif
+}
+
+static inline void cvt8_f16_f32(const _Float16 *s, float *d) {
+#if defined(NPU_CVT_NEON)
+  float16x8_t h = vld1q_f16((const float16_t *)s);
+  vst1q_f32(d, vcvt_f32_f16(vget_low_f16(h)));
+  vst1q_f32(d + 4, vcvt_high_f32_f16(h));
+#elif defined(NPU_CVT_F16C)
+  _mm256_storeu_ps(d, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)s)));
+#else
+  for (int i = 0; i < 8; i++)
+    d[i] = cvt1_f16_f32(s[i]);
+#endif
+}
+
+void npu_fp32_to_fp16(const float *src, _Float16 *dst, size_t n) {
+
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8)
+    cvt8_f32_f16(src + i, dst + i);
+  for (; i < n; i++)
+    dst[i] = cvt1_f32_f16(src[i]);
+}
+
+void npu_fp16_to_fp32(const _Float16 *src, float *dst, size_t n) {
+
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8)
+    cvt8_f16_f32(src + i, dst + i);
+  for (; i < n; i++)
+    dst[i] = cvt1_f16_f32(src[i]);
+}
+
+/*
+ * Packing walks plane by plane so writes into the (usually uncached) BO are
+ * sequential, the strided reads hit cached host memory.
+ */
+void npu_pack_feature_fp32(const float *src, int lda, int M, int K, int height, _Float16 *dst) {
+
+  uint64_t trace = NPU_TRACE_BEGIN();
+  int planes = ((K + 31) / 32) * 4;
+
+  for (int p = 0; p < planes; p++) {
+    _Float16 *d = dst + (size_t)p * height * 8;
+    int c = p * 8;
+
+    if (c + 8 <= K) {
+      for (int m = 0; m < M; m++)
+        cvt8_f32_f16(src + (size_t)m * lda + c, d + m * 8);
+    } else {
+      for (int m = 0; m < M; m++) {
+        for (int j = 0; j < 8; j++)
+          d[m * 8 + j] = (c + j < K) ? cvt1_f32_f16(src[(size_t)m * lda + c + j]) : 0;
+      }
+    }
+    memset(d + M * 8, 0, (size_t)(height - M) * 8 * sizeof(_Float16));
+  }
+  NPU_TRACE_END(npu_trace_pack, trace, (uint64_t)M * K);
+}
+
+void npu_pack_feature_fp16(const _Float16 *src, int lda, int M, int K, int height, _Float16 *dst) {
+
+  uint64_t trace = NPU_TRACE_BEGIN();
+  int planes = ((K + 31) / 32) * 4;
+
+  for (int p = 0; p < planes; p++) {
+    _Float16 *d = dst + (size_t)p * height * 8;
+    int c = p * 8;
+
+    if (c + 8 <= K) {
+      for (int m = 0; m < M; m++)
+        memcpy(d + m * 8, src + (size_t)m * lda + c, 8 * sizeof(_Float16));
+    } else {
+      for (int m = 0; m < M; m++) {
+        for (int j = 0; j < 8; j++)
+          d[m * 8 + j] = (c + j < K) ? src[(size_t)m * lda + c + j] : 0;
+      }
+    }
+    memset(d + M * 8, 0, (size_t)(height - M) * 8 * sizeof(_Float16));
+  }
+  NPU_TRACE_END(npu_trace_pack, trace, (uint64_t)M * K);
+}
+
+void npu_pack_feature_int8(const int8_t *src, int lda, int M, int K, int height, int8_t *dst) {
+
+  uint64_t trace = NPU_TRACE_BEGIN();
+  int planes = ((K + 31) / 32) * 2;
+
+  for (int p = 0; p < planes; p++) {
+    int8_t *d = dst + (size_t)p * height * 16;
+    int c = p * 16;
+
+    if (c + 16 <= K) {
+      for (int m = 0; m < M; m++)
+        memcpy(d + m * 16, src + (size_t)m * lda + c, 16);
+    } else {
+      for (int m = 0; m < M; m++) {
+        for (int j = 0; j < 16; j++)
+          d[m * 16 + j] = (c + j < K) ? src[(size_t)m * lda + c + j] : 0;
+      }
+    }
+    memset(d + M * 16, 0, (size_t)(height - M) * 16);
+  }
+  NPU_TRACE_END(npu_trace_pack, trace, (uint64_t)M * K);
+}
+
+void npu_unpack_output_fp32(const float *src, int height, int M, int N, float *dst, int ldc) {
+
+  uint64_t trace = NPU_TRACE_BEGIN();
+
+  for (int c = 0; c < N; c += 4) {
+    const float *s = src + (size_t)(c / 4) * height * 4;
+    int count = (N - c < 4) ? N - c : 4;
+    for (int m = 0; m < M; m++)
+      memcpy(dst + (size_t)m * ldc + c, s + m * 4, count * sizeof(float));
+  }
+  NPU_TRACE_END(npu_trace_unpack, trace, (uint64_t)M * N);
+}
+
+void npu_unpack_output_fp32_fp16(const float *src, int height, int M, int N, _Float16 *dst, int ldc) {
+
+  uint64_t trace = NPU_TRACE_BEGIN();
+
+  for (int c = 0; c < N; c += 4) {
+    const float *s = src + (size_t)(c / 4) * height * 4;
+    if (c + 4 <= N) {
+      for (int m = 0; m < M; m++)
+        cvt4_f32_f16(s + m * 4, dst + (size_t)m * ldc + c);
+    } else {
+      for (int m = 0; m < M; m++) {
+        for (int j = 0; j < N - c; j++)
+          dst[(size_t)m * ldc + c + j] = cvt1_f32_f16(s[m * 4 + j]);
+      }
+    }
+  }
+  NPU_TRACE_END(npu_trace_unpack, trace, (uint64_t)M * N);
+}
+
+void npu_unpack_output_fp16(const _Float16 *src, int height, int M, int N, _Float16 *dst, int ldc) {
+
+  uint64_t trace = NPU_TRACE_BEGIN();
+
+  for (int c = 0; c < N; c += 8) {
+    const _Float16 *s = src + (size_t)(c / 8) * height * 8;
+    int count = (N - c < 8) ? N - c : 8;
+    for (int m = 0; m < M; m++)
+      memcpy(dst + (size_t)m * ldc + c, s + m * 8, count * sizeof(_Float16));
+  }
+  NPU_TRACE_END(npu_trace_unpack, trace, (uint64_t)M * N);
+}
+
+void npu_unpack_output_fp16_fp32(const _Float16 *src, int height, int M, int N, float *dst, int ldc) {
+
+  uint64_t trace = NPU_TRACE_BEGIN();
+
+  for (int c = 0; c < N; c += 8) {
+    const _Float16 *s = src + (size_t)(c / 8) * height * 8;
+    if (c + 8 <= N) {
+      for (int m = 0; m < M; m++)
+        cvt8_f16_f32(s + m * 8, dst + (size_t)m * ldc + c);
+    } else {
+      for (int m = 0; m < M; m++) {
+        for (int j = 0; j < N - c; j++)
+          dst[(size_t)m * ldc + c + j] = cvt1_f16_f32(s[m * 8 + j]);
+      }
+    }
+  }
+  NPU_TRACE_END(npu_trace_unpack, trace, (uint64_t)M * N);
+}
+
+void npu_unpack_output_int32(const int32_t *src, int height, int M, int N, int32_t *dst, int ldc) {
+
+  uint64_t trace = NPU_TRACE_BEGIN();
+
+  for (int c = 0; c < N; c += 4) {
+    const int32_t *s = src + (size_t)(c / 4) * height * 4;
+    int count = (N - c < 4) ? N - c : 4;
+    for (int m = 0; m < M; m++)
+      memcpy(dst + (size_t)m * ldc + c, s + m * 4, count * sizeof(int32_t));
+  }
+  NPU_TRACE_END(npu_trace_unpack, trace, (uint64_t)M * N);
+}
+
+/*
+ * Weights are written in destination order, kernel group by channel block by
+ * kernel, so each step is one 32 channel run copied from a source row.
+ */
+static void pack_weight(const uint8_t *src, size_t ldb, int N, int K, int group, size_t esize, uint8_t *dst) {
+
+  int np = ((N + group - 1) / group) * group;
+  int kp = ((K + 31) / 32) * 32;
+  size_t run = 32 * esize;
+
+  for (int kg = 0; kg < np; kg += group) {
+    for (int c = 0; c < kp; c += 32) {
+      int count = (K - c < 32) ? K - c : 32;
+      for (int n = kg; n < kg + group; n++, dst += run) {
+        if (n >= N) {
+          memset(dst, 0, run);
+          continue;
+        }
+        memcpy(dst, src + ((size_t)n * ldb + c) * esize, count * esize);
+        if (count < 32)
+          memset(dst + count * esize, 0, (32 - count) * esize);
+      }
+    }
+  }
+}
+
+void npu_pack_weight_fp16(const _Float16 *src, int ldb, int N, int K, _Float16 *dst) {
+
+  uint64_t trace = NPU_TRACE_BEGIN();
+
+  pack_weight((const uint8_t *)src, ldb, N, K, 16, sizeof(_Float16), (uint8_t *)dst);
+  NPU_TRACE_END(npu_trace_pack, trace, (uint64_t)N * K);
+}
+
+void npu_pack_weight_int8(const int8_t *src, int ldb, int N, int K, int8_t *dst) {
+
+  uint64_t trace = NPU_TRACE_BEGIN();
+
+  pack_weight((const uint8_t *)src, ldb, N, K, 32, sizeof(int8_t), (uint8_t *)dst);
+  NPU_TRACE_END(npu_trace_pack, trace, (uint64_t)N * K);
+}
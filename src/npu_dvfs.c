@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_log.h"
+#include "npu_dvfs.h"
+
+static const npu_dvfs_state_t profiles[npu_dvfs_profiles] = {
+  [npu_dvfs_max_throughput] = { .valid = NPU_DVFS_FREQ | NPU_DVFS_BW,
+                                .freq = NPU_FREQ_MAX, .bw_priority = 2, .bw_expect = 4, .bw_tw = 64 },
+  [npu_dvfs_latency]        = { .valid = NPU_DVFS_FREQ | NPU_DVFS_BW,
+                                .freq = NPU_FREQ_MAX, .bw_priority = 3, .bw_expect = 4, .bw_tw = 8 },
+  [npu_dvfs_power_save]     = { .valid = NPU_DVFS_FREQ | NPU_DVFS_BW,
+                                .freq = NPU_FREQ_MIN, .bw_priority = 0, .bw_expect = 1, .bw_tw = 64 },
+};
+
+static const char *profile_names[npu_dvfs_profiles] = {
+  [npu_dvfs_max_throughput] = "max-throughput",
+  [npu_dvfs_latency]        = "latency",
+  [npu_dvfs_power_save]     = "power-save",
+};
+
+static int action(int fd, uint32_t flags, uint32_t *value) {
+
+  struct rknpu_action act = {
+    .flags = flags,
+    .value = *value,
+  };
+  int ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_ACTION, &act);
+  if (ret < 0) {
+    npu_log(NPU_LOG_ERROR, "RKNPU_ACTION %u failed %d\n", flags, ret);
+    return ret;
+  }
+  *value = act.value;
+  return 0;
+}
+
+static int set(int fd, const npu_dvfs_state_t *state, uint32_t field, uint32_t flags, uint32_t value) {
+  if ((state->valid & field) == 0)
+    return 0;
+  return action(fd, flags, &value);
+}
+
+int npu_dvfs_get(int fd, npu_dvfs_state_t *state) {
+
+  memset(state, 0, sizeof(*state));
+  state->valid = NPU_DVFS_ALL;
+  if ((action(fd, RKNPU_GET_FREQ, &state->freq) < 0) ||
+      (action(fd, RKNPU_GET_VOLT, &state->volt) < 0) ||
+      (action(fd, RKNPU_GET_BW_PRIORITY, &state->bw_priority) < 0) ||
+      (action(fd, RKNPU_GET_BW_EXPECT, &state->bw_expect) < 0) ||
+      (action(fd, RKNPU_GET_BW_TW, &state->bw_tw) < 0))
+    return -1;
+  return 0;
+}
+
+/*
+ * Voltage goes up before the clock and comes down after it, so the core is
+ * never clocked above what the voltage supports.
+ */
+int npu_dvfs_set(int fd, const npu_dvfs_state_t *state) {
+
+  uint32_t freq = 0;
+  int raise;
+
+  if ((state->valid & NPU_DVFS_VOLT) && (action(fd, RKNPU_GET_FREQ, &freq) < 0))
+    return -1;
+  raise = !(state->valid & NPU_DVFS_FREQ) || (state->freq > freq);
+
+  if (raise && (set(fd, state, NPU_DVFS_VOLT, RKNPU_SET_VOLT, state->volt) < 0))
+    return -1;
+  if (set(fd, state, NPU_DVFS_FREQ, RKNPU_SET_FREQ, state->freq) < 0)
+    return -1;
+  if (!raise && (set(fd, state, NPU_DVFS_VOLT, RKNPU_SET_VOLT, state->volt) < 0))
+    return -1;
+
+  if ((set(fd, state, NPU_DVFS_BW_PRIORITY, RKNPU_SET_BW_PRIORITY, state->bw_priority) < 0) ||
+      (set(fd, state, NPU_DVFS_BW_EXPECT, RKNPU_SET_BW_EXPECT, state->bw_expect) < 0) ||
+      (set(fd, state, NPU_DVFS_BW_TW, RKNPU_SET_BW_TW, state->bw_tw) < 0))
+    return -1;
+  return 0;
+}
+
+int npu_dvfs_apply(int fd, int profile) {
+
+  const npu_dvfs_state_t *state = npu_dvfs_profile(profile);
+
+  if (state == NULL)
+    return -1;
+  return npu_dvfs_set(fd, state);
+}
+
+const npu_dvfs_state_t *npu_dvfs_profile(int profile) {
+  if ((profile < 0) || (profile >= npu_dvfs_profiles))
+    return NULL;
+  return &profiles[profile];
+}
+
+const char *npu_dvfs_profile_name(int profile) {
+  if ((profile < 0) || (profile >= npu_dvfs_profiles))
+    return NULL;
+  return profile_names[profile];
+}
+
+int npu_dvfs_profile_from_name(const char *name) {
+
+  for (int i = 0; i < npu_dvfs_profiles; i++) {
+    if (strcmp(name, profile_names[i]) == 0)
+      return i;
+  }
+  return -1;
+}
@@ -0,0 +1,629 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_hw.h"
+#include "npu_interface.h"
+#include "npu_matmul.h"
+#include "npu_convert.h"
+#include "npu_log.h"
+#include "npu_emu.h"
+
+#define EMU_DMA_BASE     0x10000000ull
+#define EMU_DMA_LIMIT    0x100000000ull
+#define EMU_OBJ_BASE     0xffffff8000000000ull
+#define EMU_SRAM_SIZE    0
+#define EMU_HW_VERSION   0x46495e00
+#define EMU_DRV_VERSION  ((0 << 16) | (9 << 8) | 0)
+
+typedef struct {
+  uint32_t  handle;
+  uint32_t  flags;
+  int       memfd;     // memfd, or our dup of an imported dma-buf
+  ino_t     ino;       // identifies the buffer behind a PRIME fd
+  size_t    size;
+  uint64_t  dma_addr;
+  uint64_t  obj_addr;
+  uint8_t   *map;      // the emulator's own view
+} emu_bo_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static emu_bo_t *bos = NULL;
+static uint32_t bo_count = 0;
+static uint32_t bo_capacity = 0;
+static uint32_t next_handle = 1;
+static uint64_t next_dma = EMU_DMA_BASE;
+static npu_emu_stats_t stats;
+// What RKNPU_GET_*_AMOUNT report, cleared by RKNPU_ACT_CLR_TOTAL_RW_AMOUNT
+static uint32_t dt_rd_amount, wt_rd_amount, dt_wr_amount;
+
+// Register file for the task being decoded, indexed by register offset
+static uint32_t regs[0x10000 / 4];
+
+#define REG(r) regs[(r) / 4]
+
+static int fail(int err) {
+  errno = err;
+  return -1;
+}
+
+static emu_bo_t *find_handle(uint32_t handle) {
+  for (uint32_t i = 0; i < bo_count; i++) {
+    if (bos[i].handle == handle)
+      return &bos[i];
+  }
+  return NULL;
+}
+
+static emu_bo_t *find_obj(uint64_t obj_addr) {
+  for (uint32_t i = 0; i < bo_count; i++) {
+    if (bos[i].obj_addr == obj_addr)
+      return &bos[i];
+  }
+  return NULL;
+}
+
+// cpu pointer for [dma, dma + size) if it lies inside one BO
+static void *dma_ptr(uint64_t dma, size_t size) {
+  for (uint32_t i = 0; i < bo_count; i++) {
+    if ((dma >= bos[i].dma_addr) && (dma - bos[i].dma_addr <= bos[i].size) &&
+        (size <= bos[i].size - (dma - bos[i].dma_addr)))
+      return bos[i].map + (dma - bos[i].dma_addr);
+  }
+  return NULL;
+}
+
+// Takes ownership of fd
+static emu_bo_t *add_bo(int fd, size_t size, uint32_t flags) {
+
+  size_t span = (size + NPU_PAGE_SIZE - 1) & ~((size_t)NPU_PAGE_SIZE - 1);
+  struct stat st;
+  emu_bo_t *bo;
+
+  // Guard page between BOs so overruns don't land in a neighbour
+  if ((next_dma + span + NPU_PAGE_SIZE > EMU_DMA_LIMIT) || (fstat(fd, &st) < 0)) {
+    close(fd);
+    fail(ENOMEM);
+    return NULL;
+  }
+
+  if (bo_count == bo_capacity) {
+    uint32_t capacity = bo_capacity ? bo_capacity * 2 : 64;
+    emu_bo_t *grown = realloc(bos, capacity * sizeof(*grown));
+    if (grown == NULL) {
+      close(fd);
+      fail(ENOMEM);
+      return NULL;
+    }
+    bos = grown;
+    bo_capacity = capacity;
+  }
+
+  bo = &bos[bo_count];
+  memset(bo, 0, sizeof(*bo));
+  bo->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (bo->map == MAP_FAILED) {
+    close(fd);
+    fail(ENOMEM);
+    return NULL;
+  }
+
+  bo->memfd = fd;
+  bo->ino = st.st_ino;
+  bo->handle = next_handle++;
+  bo->flags = flags;
+  bo->size = size;
+  bo->dma_addr = next_dma;
+  bo->obj_addr = EMU_OBJ_BASE + (uint64_t)bo->handle * NPU_PAGE_SIZE;
+  next_dma += span + NPU_PAGE_SIZE;
+  bo_count++;
+
+  stats.live_bos++;
+  stats.live_bytes += size;
+  return bo;
+}
+
+static int emu_mem_create(struct rknpu_mem_create *args) {
+
+  size_t size = (args->size + NPU_PAGE_SIZE - 1) & ~((size_t)NPU_PAGE_SIZE - 1);
+  emu_bo_t *bo;
+  int memfd;
+
+  // Like the driver, an existing handle (e.g. an import) just reports its object
+  if (args->handle != 0) {
+    bo = find_handle(args->handle);
+    if (bo == NULL)
+      return fail(EINVAL);
+  } else {
+    if (args->size == 0)
+      return fail(EINVAL);
+    memfd = memfd_create("rknpu-emu", MFD_CLOEXEC);
+    if (memfd < 0)
+      return -1;
+    if (ftruncate(memfd, size) < 0) {
+      close(memfd);
+      return -1;
+    }
+    bo = add_bo(memfd, size, args->flags);
+    if (bo == NULL)
+      return -1;
+  }
+
+  args->handle = bo->handle;
+  args->size = bo->size;
+  args->dma_addr = bo->dma_addr;
+  args->obj_addr = bo->obj_addr;
+  args->sram_size = EMU_SRAM_SIZE;
+  return 0;
+}
+
+// Importing one of our own BOs gives back its handle, as DRM does
+static int emu_prime_fd_to_handle(struct drm_prime_handle *args) {
+
+  struct stat st;
+  emu_bo_t *bo;
+  int fd;
+
+  if (fstat(args->fd, &st) < 0)
+    return fail(EBADF);
+  for (uint32_t i = 0; i < bo_count; i++) {
+    if (bos[i].ino == st.st_ino) {
+      args->handle = bos[i].handle;
+      return 0;
+    }
+  }
+  if (st.st_size <= 0)
+    return fail(EINVAL);
+
+  fd = fcntl(args->fd, F_DUPFD_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  bo = add_bo(fd, st.st_size, 0);
+  if (bo == NULL)
+    return -1;
+  args->handle = bo->handle;
+  return 0;
+}
+
+static int emu_prime_handle_to_fd(struct drm_prime_handle *args) {
+
+  emu_bo_t *bo = find_handle(args->handle);
+
+  if (bo == NULL)
+    return fail(ENOENT);
+  args->fd = fcntl(bo->memfd, F_DUPFD_CLOEXEC, 0);
+  return (args->fd < 0) ? -1 : 0;
+}
+
+static int emu_mem_map(struct rknpu_mem_map *args) {
+
+  if (find_handle(args->handle) == NULL)
+    return fail(EINVAL);
+  // Fake mmap offset, only meaningful to emu_mmap
+  args->offset = (uint64_t)args->handle * NPU_PAGE_SIZE;
+  return 0;
+}
+
+static int destroy_handle(uint32_t handle) {
+
+  emu_bo_t *bo = find_handle(handle);
+
+  if (bo == NULL)
+    return fail(EINVAL);
+  // Existing user mappings keep the memfd pages alive
+  munmap(bo->map, bo->size);
+  close(bo->memfd);
+  stats.live_bos--;
+  stats.live_bytes -= bo->size;
+  *bo = bos[--bo_count];
+  return 0;
+}
+
+static int emu_mem_destroy(struct rknpu_mem_destroy *args) {
+  return destroy_handle(args->handle);
+}
+
+static int action(struct rknpu_action *args) {
+
+  switch (args->flags) {
+    case RKNPU_ACT_RESET:
+    case RKNPU_POWER_ON:
+    case RKNPU_POWER_OFF:
+      return 0;
+    case RKNPU_GET_TOTAL_SRAM_SIZE:
+    case RKNPU_GET_FREE_SRAM_SIZE:
+      args->value = EMU_SRAM_SIZE;
+      return 0;
+    case RKNPU_GET_IOMMU_EN:
+      args->value = 1;
+      return 0;
+    case RKNPU_GET_HW_VERSION:
+      args->value = EMU_HW_VERSION;
+      return 0;
+    case RKNPU_GET_DRV_VERSION:
+      args->value = EMU_DRV_VERSION;
+      return 0;
+    case RKNPU_ACT_CLR_TOTAL_RW_AMOUNT:
+      dt_rd_amount = wt_rd_amount = dt_wr_amount = 0;
+      return 0;
+    case RKNPU_GET_DT_RD_AMOUNT:
+      args->value = dt_rd_amount;
+      return 0;
+    case RKNPU_GET_WT_RD_AMOUNT:
+      args->value = wt_rd_amount;
+      return 0;
+    case RKNPU_GET_DT_WR_AMOUNT:
+      args->value = dt_wr_amount;
+      return 0;
+    case RKNPU_GET_TOTAL_RW_AMOUNT:
+      args->value = dt_rd_amount + wt_rd_amount + dt_wr_amount;
+      return 0;
+  }
+  return fail(EINVAL);
+}
+
+/*
+ * Inputs are unpacked to row-major so the inner loop is a plain dot product.
+ * fp16 accumulates in fp32 like the CORE, int8 in int32.
+ */
+static int matmul_fp16(const _Float16 *in, const _Float16 *w, void *out, uint32_t out_precision,
+  int M, int K, int N, int out_height, int relu) {
+
+  int kp = ((K + 31) / 32) * 32;
+  float *a = malloc((size_t)M * K * sizeof(float));
+  float *b = malloc((size_t)N * K * sizeof(float));
+
+  if ((a == NULL) || (b == NULL)) {
+    free(a);
+    free(b);
+    return -1;
+  }
+  for (int m = 1; m <= M; m++) {
+    for (int k = 1; k <= K; k++)
+      a[(size_t)(m - 1) * K + (k - 1)] = in[feature_data(K, M, 1, 8, k, m, 1)];
+  }
+  for (int n = 1; n <= N; n++) {
+    for (int k = 1; k <= K; k++)
+      b[(size_t)(n - 1) * K + (k - 1)] = w[weight_fp16(kp, n, k)];
+  }
+
+  for (int m = 0; m < M; m++) {
+    const float *ra = a + (size_t)m * K;
+    for (int n = 0; n < N; n++) {
+      const float *rb = b + (size_t)n * K;
+      float acc[8] = { 0 };
+      float sum = 0;
+      int k = 0;
+      for (; k + 8 <= K; k += 8) {
+        for (int j = 0; j < 8; j++)
+          acc[j] += ra[k + j] * rb[k + j];
+      }
+      for (; k < K; k++)
+        sum += ra[k] * rb[k];
+      sum += ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+      if (relu && (sum < 0))
+        sum = 0;
+
+      if (out_precision == precision_float32) {
+        ((float *)out)[feature_data(N, out_height, 1, 4, n + 1, m + 1, 1)] = sum;
+      } else {
+        npu_fp32_to_fp16(&sum, &((_Float16 *)out)[feature_data(N, out_height, 1, 8, n + 1, m + 1, 1)], 1);
+      }
+    }
+  }
+  free(a);
+  free(b);
+  return 0;
+}
+
+static int matmul_int8(const int8_t *in, const int8_t *w, int32_t *out, int M, int K, int N, int out_height, int relu) {
+
+  int kp = ((K + 31) / 32) * 32;
+  int16_t *a = malloc((size_t)M * K * sizeof(int16_t));
+  int16_t *b = malloc((size_t)N * K * sizeof(int16_t));
+
+  if ((a == NULL) || (b == NULL)) {
+    free(a);
+    free(b);
+    return -1;
+  }
+  for (int m = 1; m <= M; m++) {
+    for (int k = 1; k <= K; k++)
+      a[(size_t)(m - 1) * K + (k - 1)] = in[feature_data(K, M, 1, 16, k, m, 1)];
+  }
+  for (int n = 1; n <= N; n++) {
+    for (int k = 1; k <= K; k++)
+      b[(size_t)(n - 1) * K + (k - 1)] = w[weight_int8(kp, n, k)];
+  }
+
+  for (int m = 0; m < M; m++) {
+    const int16_t *ra = a + (size_t)m * K;
+    for (int n = 0; n < N; n++) {
+      const int16_t *rb = b + (size_t)n * K;
+      int32_t sum = 0;
+      for (int k = 0; k < K; k++)
+        sum += ra[k] * rb[k];
+      if (relu && (sum < 0))
+        sum = 0;
+      out[feature_data(N, out_height, 1, 4, n + 1, m + 1, 1)] = sum;
+    }
+  }
+  free(a);
+  free(b);
+  return 0;
+}
+
+/*
+ * 1x1 direct convolution over a W=1 feature map, i.e. an M x K by K x N
+ * matmul, M = datain height, K = channels, N = kernels. Input is read with
+ * the same feature_data() / weight_*() layouts the tests pack with.
+ */
+static int run_matmul(void) {
+
+  uint32_t in_precision = (REG(CNA_CONV_CON1) >> 4) & 0x7;
+  uint32_t out_precision = (REG(DPU_DATA_FORMAT) >> 29) & 0x7;
+  int M = REG(CNA_DATA_SIZE0) & 0x7ff;
+  int K = REG(CNA_DATA_SIZE1) & 0xffff;
+  int N = REG(CNA_WEIGHT_SIZE2) & 0x3fff;
+  int out_height = (REG(DPU_DST_SURF_STRIDE) >> 4) & 0xfffffff;
+  // BS enabled with its ReLU on, the BS ALU / MUL aren't modelled
+  int relu = ((REG(DPU_BS_CFG) & 0x41) == 0);
+  int in_c2, out_c2, in_size, out_size;
+  size_t in_bytes, w_bytes, out_bytes;
+  void *in, *w, *out;
+  int ret;
+
+  if ((M == 0) || (K == 0) || (N == 0) || (out_height < M))
+    return fail(EINVAL);
+
+  if (in_precision == precision_float16) {
+    in_c2 = 8;
+    in_size = 2;
+    w_bytes = weight_size_fp16(N, K);
+  } else if (in_precision == precision_int8) {
+    in_c2 = 16;
+    in_size = 1;
+    w_bytes = weight_size_int8(N, K);
+  } else {
+    return fail(EINVAL);
+  }
+
+  if ((out_precision == precision_float32) || (out_precision == precision_int32)) {
+    out_c2 = 4;
+    out_size = 4;
+  } else if (out_precision == precision_float16) {
+    out_c2 = 8;
+    out_size = 2;
+  } else {
+    return fail(EINVAL);
+  }
+
+  if ((in_size == 1) != (out_precision == precision_int32))
+    return fail(EINVAL);
+
+  in_bytes = (size_t)((K + in_c2 - 1) / in_c2) * M * in_c2 * in_size;
+  out_bytes = (size_t)((N + out_c2 - 1) / out_c2) * out_height * out_c2 * out_size;
+  in = dma_ptr(REG(CNA_FEATURE_DATA_ADDR), in_bytes);
+  w = dma_ptr(REG(CNA_DCOMP_ADDR0), w_bytes);
+  out = dma_ptr(REG(DPU_DST_BASE_ADD), out_bytes);
+  if ((in == NULL) || (w == NULL) || (out == NULL)) {
+    npu_log(NPU_LOG_ERROR, "npu emu: task reads or writes outside a BO\n");
+    return fail(EFAULT);
+  }
+
+  if (in_size == 2) {
+    ret = matmul_fp16(in, w, out, out_precision, M, K, N, out_height, relu);
+  } else {
+    ret = matmul_int8(in, w, out, M, K, N, out_height, relu);
+  }
+  if (ret < 0)
+    return fail(ENOMEM);
+
+  stats.macs += (uint64_t)M * N * K;
+  // Each input is fetched once and the output written once
+  dt_rd_amount += in_bytes;
+  wt_rd_amount += w_bytes;
+  dt_wr_amount += out_bytes;
+  return 0;
+}
+
+static int run_task(struct rknpu_task *task) {
+
+  const uint64_t *ops = dma_ptr(task->regcmd_addr, (size_t)task->regcfg_amount * sizeof(uint64_t));
+
+  if (ops == NULL)
+    return fail(EFAULT);
+
+  memset(regs, 0, sizeof(regs));
+  for (uint32_t i = 0; i < task->regcfg_amount; i++) {
+    uint16_t op = (ops[i] >> 48) & 0xffff;
+    if (op & PC_OP_01)
+      REG(ops[i] & 0xffff) = (ops[i] >> 16) & 0xffffffff;
+  }
+
+  // Only the CNA -> CORE -> DPU path is modelled
+  if ((task->enable_mask & (PC_ENABLE_CNA | PC_ENABLE_DPU)) != (PC_ENABLE_CNA | PC_ENABLE_DPU))
+    return fail(EINVAL);
+  if (run_matmul() < 0)
+    return -1;
+
+  task->int_status = task->int_mask;
+  stats.tasks++;
+  return 0;
+}
+
+static int run_range(struct rknpu_task *tasks, size_t count, uint32_t start, uint32_t number) {
+
+  if (((uint64_t)start + number) > count)
+    return fail(EINVAL);
+  for (uint32_t i = 0; i < number; i++) {
+    if (run_task(&tasks[start + i]) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+static int submit(struct rknpu_submit *args) {
+
+  emu_bo_t *task_bo;
+  struct rknpu_task *tasks;
+  size_t count;
+  int ret = 0;
+
+  if ((args->flags & RKNPU_JOB_FENCE_IN) && (args->fence_fd >= 0)) {
+    struct pollfd pfd = { .fd = args->fence_fd, .events = POLLIN };
+    while ((poll(&pfd, 1, -1) < 0) && (errno == EINTR))
+      ;
+  }
+
+  pthread_mutex_lock(&lock);
+  task_bo = find_obj(args->task_obj_addr);
+  if (task_bo == NULL) {
+    pthread_mutex_unlock(&lock);
+    return fail(EINVAL);
+  }
+  tasks = (struct rknpu_task *)task_bo->map;
+  count = task_bo->size / sizeof(*tasks);
+
+  // Multi core jobs take their ranges from subcore_task
+  if (__builtin_popcount(args->core_mask) > 1) {
+    for (int i = 0; (i < 5) && (ret == 0); i++) {
+      if (args->subcore_task[i].task_number > 0)
+        ret = run_range(tasks, count, args->subcore_task[i].task_start, args->subcore_task[i].task_number);
+    }
+  } else {
+    ret = run_range(tasks, count, args->task_start, args->task_number);
+  }
+  stats.submits++;
+  pthread_mutex_unlock(&lock);
+
+  if (ret < 0)
+    return ret;
+
+  if ((args->flags & RKNPU_JOB_NONBLOCK) && (args->flags & RKNPU_JOB_FENCE_OUT)) {
+    args->fence_fd = eventfd(1, EFD_CLOEXEC);
+    if (args->fence_fd < 0)
+      return -1;
+  }
+  return 0;
+}
+
+static void copy_string(char *dst, uint32_t len, const char *src) {
+  if ((dst != NULL) && (len > 0)) {
+    strncpy(dst, src, len - 1);
+    dst[len - 1] = 0;
+  }
+}
+
+static int emu_ioctl(int fd, unsigned long request, void *arg) {
+
+  int ret;
+
+  if (request == DRM_IOCTL_RKNPU_SUBMIT)
+    return submit(arg);
+
+  if (request == DRM_IOCTL_VERSION) {
+    struct drm_version *dv = arg;
+    dv->version_major = 0;
+    dv->version_minor = 9;
+    dv->version_patchlevel = 0;
+    copy_string(dv->name, dv->name_len, "rknpu");
+    copy_string(dv->date, dv->date_len, "20240101");
+    copy_string(dv->desc, dv->desc_len, "RKNPU emulator");
+    return 0;
+  }
+
+  pthread_mutex_lock(&lock);
+  if (request == DRM_IOCTL_RKNPU_MEM_CREATE) {
+    ret = emu_mem_create(arg);
+  } else if (request == DRM_IOCTL_RKNPU_MEM_MAP) {
+    ret = emu_mem_map(arg);
+  } else if (request == DRM_IOCTL_RKNPU_MEM_DESTROY) {
+    ret = emu_mem_destroy(arg);
+  } else if (request == DRM_IOCTL_GEM_CLOSE) {
+    ret = destroy_handle(((struct drm_gem_close *)arg)->handle);
+  } else if (request == DRM_IOCTL_PRIME_FD_TO_HANDLE) {
+    ret = emu_prime_fd_to_handle(arg);
+  } else if (request == DRM_IOCTL_PRIME_HANDLE_TO_FD) {
+    ret = emu_prime_handle_to_fd(arg);
+  } else if (request == DRM_IOCTL_RKNPU_MEM_SYNC) {
+    // Coherent, nothing to do
+    ret = (find_obj(((struct rknpu_mem_sync *)arg)->obj_addr) != NULL) ? 0 : fail(EINVAL);
+  } else if (request == DRM_IOCTL_RKNPU_ACTION) {
+    ret = action(arg);
+  } else {
+    ret = fail(ENOTTY);
+  }
+  pthread_mutex_unlock(&lock);
+  return ret;
+}
+
+static void *emu_mmap(int fd, size_t size, uint64_t offset) {
+
+  emu_bo_t *bo;
+  void *map = MAP_FAILED;
+
+  pthread_mutex_lock(&lock);
+  bo = find_handle(offset / NPU_PAGE_SIZE);
+  if ((bo != NULL) && (size <= bo->size))
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, bo->memfd, 0);
+  pthread_mutex_unlock(&lock);
+  return map;
+}
+
+static int emu_open(void) {
+  return open("/dev/null", O_RDWR | O_CLOEXEC);
+}
+
+static int emu_close(int fd) {
+  return close(fd);
+}
+
+static const npu_backend_t emu_backend = {
+  .name = "emu",
+  .open = emu_open,
+  .close = emu_close,
+  .ioctl = emu_ioctl,
+  .mmap = emu_mmap,
+};
+
+const npu_backend_t *npu_backend_emu(void) {
+  return &emu_backend;
+}
+
+void npu_emu_get_stats(npu_emu_stats_t *out) {
+  pthread_mutex_lock(&lock);
+  *out = stats;
+  pthread_mutex_unlock(&lock);
+}
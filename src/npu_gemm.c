@@ -0,0 +1,631 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_matmul.h"
+#include "npu_convert.h"
+#include "npu_program.h"
+#include "npu_submit.h"
+#include "npu_log.h"
+#include "npu_hw.h"
+#include "npu_weights.h"
+#include "npu_gemm.h"
+
+typedef struct {
+  int       dtype;
+  int       m;
+  int       k;
+  int       n;
+  int       k_stride;     // packed channels per kernel of a resident B
+  uint64_t  weights_dma;  // resident B, 0 when the plan packs B itself
+} gemm_key_t;
+
+typedef struct {
+  gemm_key_t           key;
+  npu_matmul_tiling_t  tiling;
+  int                  fd;
+  npu_pool_t           *pool;
+  npu_buf_t            input;
+  npu_buf_t            weights;       // only when B isn't resident
+  npu_buf_t            output;
+  uint64_t             weights_dma;
+  size_t               input_tile;    // bytes per M tile
+  size_t               weights_row;   // bytes per packed kernel
+  size_t               output_tile;   // bytes per M x N tile
+  npu_program_t        progs[NPU_CORES];
+  pthread_mutex_t      lock;
+} gemm_plan_t;
+
+static int roundup(int v, int a) {
+  return ((v + a - 1) / a) * a;
+}
+
+static int kernel_group(int dtype) {
+  return (dtype == npu_dtype_int8) ? 32 : 16;
+}
+
+static size_t input_size(int dtype) {
+  return (dtype == npu_dtype_int8) ? sizeof(int8_t) : sizeof(_Float16);
+}
+
+static size_t output_size(int dtype) {
+  return (dtype == npu_dtype_fp16_fp16) ? sizeof(_Float16) : sizeof(float);
+}
+
+static int bank_count(size_t bytes) {
+  return (bytes + NPU_CBUF_BANK_SIZE - 1) / NPU_CBUF_BANK_SIZE;
+}
+
+/*
+ * The CBUF split the generator programs for a tile, the feature data's
+ * banks and the rest to weights, and the tiling's DRAM traffic. Each task holds its whole A tile, so it
+ * reads that and its B slice once and writes its C tile: A is read once per
+ * N tile and B once per M tile.
+ */
+static void score(int dtype, int M, int K, int N, npu_matmul_tiling_t *t) {
+
+  uint64_t mp = (M == 1) ? 1 : roundup(M, 4), kp = roundup(K, 32), np = roundup(N, kernel_group(dtype));
+
+  t->data_banks = bank_count((size_t)t->m_tile * kp * input_size(dtype));
+  t->weight_banks = NPU_CBUF_BANKS - t->data_banks;
+  t->feature_bytes = mp * kp * input_size(dtype) * t->n_tiles;
+  t->weight_bytes = np * kp * input_size(dtype) * t->m_tiles;
+  t->output_bytes = mp * np * output_size(dtype);
+  t->dram_bytes = t->feature_bytes + t->weight_bytes + t->output_bytes;
+}
+
+// Whether an m x k task fits the CBUF
+static int tile_fits(int dtype, int m, int k, int n) {
+
+  matmul_params_t params;
+  npu_cna_desc cna;
+  npu_core_desc core;
+  npu_dpu_desc dpu;
+
+  memset(&params, 0, sizeof(params));
+  params.m = m;
+  params.k = k;
+  params.n = n;
+  params.fp32tofp16 = (dtype == npu_dtype_fp16_fp16);
+  if (dtype == npu_dtype_int8)
+    return gen_matmul_int8_desc(&params, &cna, &core, &dpu) == 0;
+  return gen_matmul_fp16_desc(&params, &cna, &core, &dpu) == 0;
+}
+
+int npu_matmul_tiling_heuristic(int dtype, int M, int K, int N, int cores, npu_matmul_tiling_t *t) {
+
+  int group, kp, mp, np, m, n_tiles;
+
+  if ((dtype < npu_dtype_fp16) || (dtype > npu_dtype_int8) || (M <= 0) || (K <= 0) || (N <= 0) || (cores <= 0))
+    return -EINVAL;
+
+  group = kernel_group(dtype);
+  kp = roundup(K, 32);
+  mp = (M == 1) ? 1 : roundup(M, 4);
+  np = roundup(N, group);
+
+  // Tallest tile that fits, then evened out so the last one isn't a sliver
+  if (mp == 1) {
+    m = tile_fits(dtype, 1, kp, group) ? 1 : 0;
+  } else {
+    m = (mp < NPU_GEMM_M_TILE_MAX) ? mp : NPU_GEMM_M_TILE_MAX;
+    while ((m >= 4) && !tile_fits(dtype, m, kp, group))
+      m -= 4;
+  }
+  if (m <= 0) {
+    npu_log(NPU_LOG_ERROR, "matmul K %d does not fit in one task\n", K);
+    return -EINVAL;
+  }
+  t->m_tiles = (mp + m - 1) / m;
+  t->m_tile = (mp == 1) ? 1 : roundup((mp + t->m_tiles - 1) / t->m_tiles, 4);
+
+  // Enough N tiles to give every core work, unless the tiles get too thin
+  n_tiles = (np + NPU_GEMM_N_TILE_MAX - 1) / NPU_GEMM_N_TILE_MAX;
+  if (n_tiles * t->m_tiles < cores) {
+    int spread = (cores + t->m_tiles - 1) / t->m_tiles;
+    if (spread > np / NPU_GEMM_N_TILE_MIN)
+      spread = np / NPU_GEMM_N_TILE_MIN;
+    if (spread > n_tiles)
+      n_tiles = spread;
+  }
+  t->n_tile = roundup((np + n_tiles - 1) / n_tiles, group);
+  t->n_tiles = (np + t->n_tile - 1) / t->n_tile;
+
+  t->cores = t->m_tiles * t->n_tiles;
+  if (t->cores > cores)
+    t->cores = cores;
+  score(dtype, M, K, N, t);
+  return 0;
+}
+
+static int better(const npu_matmul_tiling_t *a, const npu_matmul_tiling_t *b) {
+  if (a->dram_bytes != b->dram_bytes)
+    return a->dram_bytes < b->dram_bytes;
+  return a->m_tiles * a->n_tiles < b->m_tiles * b->n_tiles;
+}
+
+/*
+ * Every data bank count from 1 to 11 sets the tallest M tile the CBUF can
+ * hold. From each, M and N are split further until the cores the heuristic
+ * would use all have work, and the tiling with the least traffic wins: a
+ * split re-reads the other operand, so it is cheaper to split whichever
+ * side makes the smaller one be read again.
+ */
+int npu_matmul_tiling(int dtype, int M, int K, int N, int cores, npu_matmul_tiling_t *t) {
+
+  npu_matmul_tiling_t c;
+  int group, kp, mp, np, n_first, ret;
+
+  ret = npu_matmul_tiling_heuristic(dtype, M, K, N, cores, t);
+  if (ret < 0)
+    return ret;
+
+  group = kernel_group(dtype);
+  kp = roundup(K, 32);
+  mp = (M == 1) ? 1 : roundup(M, 4);
+  np = roundup(N, group);
+  n_first = (np + NPU_GEMM_N_TILE_MAX - 1) / NPU_GEMM_N_TILE_MAX;
+
+  for (int banks = 1; banks < NPU_CBUF_BANKS; banks++) {
+    int rows = ((size_t)banks * NPU_CBUF_BANK_SIZE) / ((size_t)kp * input_size(dtype));
+    int m_max, m_first;
+
+    m_max = (mp == 1) ? rows : (rows / 4) * 4;
+    m_max = (m_max < NPU_GEMM_M_TILE_MAX) ? m_max : NPU_GEMM_M_TILE_MAX;
+    m_max = (m_max < mp) ? m_max : mp;
+    if ((m_max <= 0) || !tile_fits(dtype, m_max, kp, group))
+      continue;
+    m_first = (mp + m_max - 1) / m_max;
+
+    for (int m_tiles = m_first; (m_tiles < m_first + cores) && (m_tiles <= (mp + 3) / 4); m_tiles++) {
+      c.m_tile = (mp == 1) ? 1 : roundup((mp + m_tiles - 1) / m_tiles, 4);
+      c.m_tiles = (mp + c.m_tile - 1) / c.m_tile;
+
+      for (int n_tiles = n_first; n_tiles < n_first + cores; n_tiles++) {
+        c.n_tile = roundup((np + n_tiles - 1) / n_tiles, group);
+        c.n_tiles = (np + c.n_tile - 1) / c.n_tile;
+        if ((n_tiles > n_first) && (c.n_tile < NPU_GEMM_N_TILE_MIN))
+          break;
+        c.cores = (c.m_tiles * c.n_tiles < cores) ? c.m_tiles * c.n_tiles : cores;
+        if (c.cores < t->cores)
+          continue;
+        score(dtype, M, K, N, &c);
+        if (better(&c, t))
+          *t = c;
+      }
+    }
+  }
+  return 0;
+}
+
+static size_t weights_size(int dtype, int N, int K) {
+  return (dtype == npu_dtype_int8) ? weight_size_int8(N, K) : weight_size_fp16(N, K);
+}
+
+static void free_plan(void *p) {
+
+  gemm_plan_t *plan = p;
+
+  for (int c = 0; c < NPU_CORES; c++)
+    npu_program_free(plan->fd, &plan->progs[c]);
+  if (plan->input.map != NULL)
+    npu_pool_free(plan->pool, &plan->input);
+  if (plan->weights.map != NULL)
+    npu_pool_free(plan->pool, &plan->weights);
+  if (plan->output.map != NULL)
+    npu_pool_free(plan->pool, &plan->output);
+  pthread_mutex_destroy(&plan->lock);
+  free(plan);
+}
+
+// Tile t is (t / n_tiles, t % n_tiles), core c runs tiles [first(c), first(c+1))
+static int first_tile(const npu_matmul_tiling_t *t, int c) {
+  return (t->m_tiles * t->n_tiles * c) / t->cores;
+}
+
+static int tile_rows(const gemm_plan_t *plan, int mi) {
+  int rows = plan->key.m - mi * plan->tiling.m_tile;
+  return (rows < plan->tiling.m_tile) ? rows : plan->tiling.m_tile;
+}
+
+static int tile_cols(const gemm_plan_t *plan, int ni) {
+  int cols = plan->key.n - ni * plan->tiling.n_tile;
+  return (cols < plan->tiling.n_tile) ? cols : plan->tiling.n_tile;
+}
+
+// The last tile is cut down to its own padded size
+static int tile_height(const gemm_plan_t *plan, int mi) {
+  return (plan->key.m == 1) ? 1 : roundup(tile_rows(plan, mi), 4);
+}
+
+// A shape that can't be tiled is -EINVAL, anything else that fails -ENOMEM
+static int build_plan(npu_context_t *ctx, const gemm_key_t *key, gemm_plan_t **out) {
+
+  const npu_caps_t *caps = npu_context_caps(ctx);
+  npu_matmul_tiling_t *t;
+  gemm_plan_t *plan;
+  matmul_params_t params;
+  int kp = roundup(key->k, 32);
+  int cores, ret = -ENOMEM;
+
+  if (caps == NULL)
+    return -ENODEV;
+  cores = (caps->cores < NPU_CORES) ? caps->cores : NPU_CORES;
+
+  plan = calloc(1, sizeof(*plan));
+  if (plan == NULL)
+    return -ENOMEM;
+  plan->key = *key;
+  plan->fd = npu_context_fd(ctx);
+  plan->pool = npu_context_pool(ctx);
+  pthread_mutex_init(&plan->lock, NULL);
+  for (int c = 0; c < NPU_CORES; c++)
+    npu_program_init(&plan->progs[c]);
+
+  t = &plan->tiling;
+  if (plan->pool == NULL)
+    goto fail;
+  ret = npu_matmul_tiling(key->dtype, key->m, key->k, key->n, cores, t);
+  if (ret < 0)
+    goto fail;
+  ret = -ENOMEM;
+
+  // Kernel groups of a prefix view are further apart than a task expects, one group per task
+  if ((key->k_stride != 0) && (key->k_stride != kp)) {
+    t->n_tile = kernel_group(key->dtype);
+    t->n_tiles = (key->n + t->n_tile - 1) / t->n_tile;
+    t->cores = (t->m_tiles * t->n_tiles < cores) ? t->m_tiles * t->n_tiles : cores;
+  }
+
+  plan->input_tile = (size_t)kp * t->m_tile * input_size(key->dtype);
+  plan->weights_row = (size_t)((key->k_stride != 0) ? key->k_stride : kp) * input_size(key->dtype);
+  plan->output_tile = (size_t)t->n_tile * t->m_tile * output_size(key->dtype);
+  if ((npu_pool_alloc(plan->pool, plan->input_tile * t->m_tiles, NPU_POOL_MIN_ALIGN, &plan->input) < 0) ||
+      ((key->weights_dma == 0) &&
+       (npu_pool_alloc(plan->pool, weights_size(key->dtype, key->n, key->k), NPU_POOL_MIN_ALIGN, &plan->weights) < 0)) ||
+      (npu_pool_alloc(plan->pool, plan->output_tile * t->m_tiles * t->n_tiles, NPU_POOL_MIN_ALIGN, &plan->output) < 0)) {
+    npu_log(NPU_LOG_ERROR, "Failed to allocate matmul buffers\n");
+    goto fail;
+  }
+  plan->weights_dma = (key->weights_dma != 0) ? key->weights_dma : plan->weights.dma_addr;
+
+  for (int c = 0; c < t->cores; c++) {
+    for (int i = first_tile(t, c); i < first_tile(t, c + 1); i++) {
+      int mi = i / t->n_tiles, ni = i % t->n_tiles;
+
+      memset(&params, 0, sizeof(params));
+      params.m = tile_height(plan, mi);
+      params.k = kp;
+      params.n = roundup(tile_cols(plan, ni), kernel_group(key->dtype));
+      params.input_dma = plan->input.dma_addr + mi * plan->input_tile;
+      params.weights_dma = plan->weights_dma + (size_t)ni * t->n_tile * plan->weights_row;
+      params.output_dma = plan->output.dma_addr + i * plan->output_tile;
+      params.fp32tofp16 = (key->dtype == npu_dtype_fp16_fp16);
+      if (key->dtype == npu_dtype_int8)
+        ret = npu_program_add_matmul_int8(&plan->progs[c], &params);
+      else
+        ret = npu_program_add_matmul_fp16(&plan->progs[c], &params);
+      if (ret < 0) {
+        ret = -ENOMEM;
+        goto fail;
+      }
+    }
+    if (npu_program_finalize(plan->fd, &plan->progs[c]) < 0)
+      goto fail;
+  }
+  npu_log(NPU_LOG_DEBUG, "matmul %dx%dx%d plan %d x %d tiles of %dx%d on %d cores\n", key->m, key->k, key->n,
+    t->m_tiles, t->n_tiles, t->m_tile, t->n_tile, t->cores);
+  *out = plan;
+  return 0;
+
+fail:
+  free_plan(plan);
+  return ret;
+}
+
+// B is packed whole, an N tile starting on a kernel group is a contiguous slice
+static void pack_inputs(gemm_plan_t *plan, const void *A, const void *B) {
+
+  const npu_matmul_tiling_t *t = &plan->tiling;
+  int K = plan->key.k;
+
+  for (int mi = 0; mi < t->m_tiles; mi++) {
+    size_t row = (size_t)mi * t->m_tile * K;
+    void *dst = (uint8_t *)plan->input.map + mi * plan->input_tile;
+    if (plan->key.dtype == npu_dtype_int8)
+      npu_pack_feature_int8((const int8_t *)A + row, K, tile_rows(plan, mi), K, tile_height(plan, mi), dst);
+    else
+      npu_pack_feature_fp16((const _Float16 *)A + row, K, tile_rows(plan, mi), K, tile_height(plan, mi), dst);
+  }
+  if (B == NULL)
+    return;
+  if (plan->key.dtype == npu_dtype_int8)
+    npu_pack_weight_int8(B, K, plan->key.n, K, plan->weights.map);
+  else
+    npu_pack_weight_fp16(B, K, plan->key.n, K, plan->weights.map);
+}
+
+// The pool is cacheable, what the cpu packed has to reach memory before a run
+static int sync_inputs(gemm_plan_t *plan, int weights) {
+
+  int ret = npu_pool_sync_to_device(plan->pool, &plan->input, 0, plan->input.requested);
+
+  if ((ret == 0) && weights)
+    ret = npu_pool_sync_to_device(plan->pool, &plan->weights, 0, plan->weights.requested);
+  return ret;
+}
+
+static void unpack_output(gemm_plan_t *plan, void *C) {
+
+  const npu_matmul_tiling_t *t = &plan->tiling;
+  int N = plan->key.n;
+
+  for (int i = 0; i < t->m_tiles * t->n_tiles; i++) {
+    int mi = i / t->n_tiles, ni = i % t->n_tiles;
+    size_t pos = (size_t)mi * t->m_tile * N + ni * t->n_tile;
+    const void *src = (const uint8_t *)plan->output.map + i * plan->output_tile;
+
+    if (plan->key.dtype == npu_dtype_int8)
+      npu_unpack_output_int32(src, tile_height(plan, mi), tile_rows(plan, mi), tile_cols(plan, ni), (int32_t *)C + pos, N);
+    else if (plan->key.dtype == npu_dtype_fp16_fp16)
+      npu_unpack_output_fp16(src, tile_height(plan, mi), tile_rows(plan, mi), tile_cols(plan, ni), (_Float16 *)C + pos, N);
+    else
+      npu_unpack_output_fp32(src, tile_height(plan, mi), tile_rows(plan, mi), tile_cols(plan, ni), (float *)C + pos, N);
+  }
+}
+
+/*
+ * One core goes through the blocking submit and gets its retries. Several
+ * are queued at once and waited on together, a hang resets the NPU.
+ */
+static int run_plan(gemm_plan_t *plan) {
+
+  int fences[NPU_CORES];
+  npu_job_t job;
+  int ret = 0;
+
+  if (plan->tiling.cores == 1)
+    return npu_program_submit(plan->fd, &plan->progs[0], 0);
+
+  for (int c = 0; c < plan->tiling.cores; c++) {
+    fences[c] = -1;
+    if (ret < 0)
+      continue;
+    npu_program_job(&plan->progs[c], c, &job);
+    job.tasks[job.task_number - 1].int_status = 0;
+    ret = npu_submit_async(plan->fd, &job, -1, &fences[c]);
+  }
+  for (int c = 0; c < plan->tiling.cores; c++) {
+    const npu_program_t *p = &plan->progs[c];
+    struct rknpu_task *last;
+    int wait;
+
+    if (fences[c] < 0)
+      continue;
+    wait = npu_fence_wait(fences[c], NPU_SUBMIT_TIMEOUT);
+    npu_fence_close(fences[c]);
+    last = &((struct rknpu_task *)p->tasks_bo.map)[p->task_count - 1];
+    if ((wait == 0) && !npu_int_status_ok(last->int_status, last->int_mask))
+      wait = -EIO;
+    if ((wait < 0) && (ret == 0))
+      ret = (wait == -ETIME) ? -ETIMEDOUT : wait;
+  }
+  if ((ret == -ETIMEDOUT) || (ret == -EIO)) {
+    npu_log(NPU_LOG_ERROR, "matmul failed %d, resetting\n", ret);
+    npu_reset(plan->fd);
+  }
+  return ret;
+}
+
+// Either B is packed by the call or weights_dma points at a resident copy
+static int matmul(npu_context_t *ctx, const void *A, const void *B, uint64_t weights_dma, int k_stride, void *C,
+  int M, int K, int N, int dtype) {
+
+  gemm_key_t key;
+  gemm_plan_t *plan;
+  int ret;
+
+  memset(&key, 0, sizeof(key));
+  key.dtype = dtype;
+  key.m = M;
+  key.k = K;
+  key.n = N;
+  key.k_stride = k_stride;
+  key.weights_dma = weights_dma;
+  plan = npu_context_find_plan(ctx, &key, sizeof(key));
+  if (plan == NULL) {
+    ret = build_plan(ctx, &key, &plan);
+    if (ret < 0)
+      return ret;
+    plan = npu_context_add_plan(ctx, &key, sizeof(key), plan, free_plan);
+    if (plan == NULL)
+      return -ENOMEM;
+  }
+
+  pthread_mutex_lock(&plan->lock);
+  pack_inputs(plan, A, B);
+  ret = sync_inputs(plan, B != NULL);
+  if (ret == 0)
+    ret = run_plan(plan);
+  if (ret == 0)
+    ret = npu_pool_sync_from_device(plan->pool, &plan->output, 0, plan->output.requested);
+  if (ret == 0)
+    unpack_output(plan, C);
+  pthread_mutex_unlock(&plan->lock);
+  npu_context_release_plan(ctx, &key, sizeof(key), plan);
+  return ret;
+}
+
+static int plan_uses_buf(const void *key, size_t key_size, void *arg) {
+
+  const gemm_key_t *k = key;
+  const npu_buf_t *buf = arg;
+
+  return (key_size == sizeof(*k)) && (k->weights_dma >= buf->dma_addr) &&
+    (k->weights_dma < buf->dma_addr + buf->size);
+}
+
+void npu_matmul_forget(npu_context_t *ctx, const npu_buf_t *buf) {
+
+  if (buf->size != 0)
+    npu_context_drop_plans(ctx, plan_uses_buf, (void *)buf);
+}
+
+int npu_matmul(npu_context_t *ctx, const void *A, const void *B, void *C, int M, int K, int N, int dtype) {
+  return matmul(ctx, A, B, 0, 0, C, M, K, N, dtype);
+}
+
+static int tensor_alloc(npu_context_t *ctx, int precision, int N, int K, npu_tensor_t *t) {
+
+  npu_pool_t *pool;
+  size_t size;
+
+  memset(t, 0, sizeof(*t));
+  if ((N <= 0) || (K <= 0))
+    return -EINVAL;
+  if (precision == precision_float16)
+    size = weight_size_fp16(N, K);
+  else if (precision == precision_int8)
+    size = weight_size_int8(N, K);
+  else
+    return -EINVAL;
+
+  pool = npu_context_pool(ctx);
+  if ((pool == NULL) || (npu_pool_alloc(pool, size, NPU_POOL_MIN_ALIGN, &t->buf) < 0)) {
+    npu_log(NPU_LOG_ERROR, "Failed to allocate %zu byte tensor\n", size);
+    return -ENOMEM;
+  }
+  t->ctx = ctx;
+  t->precision = precision;
+  t->n = N;
+  t->k = K;
+  t->k_stride = roundup(K, 32);
+  t->parts = 1;
+  t->part_n[0] = N;
+  return 0;
+}
+
+// Written through the cacheable context pool, flushed once before any call reads it
+static int tensor_sync(npu_tensor_t *t) {
+
+  if (npu_pool_sync_to_device(npu_context_pool(t->ctx), &t->buf, 0, t->buf.requested) < 0) {
+    npu_tensor_free(t);
+    return -EIO;
+  }
+  return 0;
+}
+
+int npu_tensor_upload(npu_context_t *ctx, const void *B, int N, int K, int precision, npu_tensor_t *t) {
+
+  int ret = tensor_alloc(ctx, precision, N, K, t);
+
+  if (ret < 0)
+    return ret;
+  if (precision == precision_int8)
+    npu_pack_weight_int8(B, K, N, K, t->buf.map);
+  else
+    npu_pack_weight_fp16(B, K, N, K, t->buf.map);
+  return tensor_sync(t);
+}
+
+/*
+ * Each part starts on a kernel group so it packs on its own, a part whose N
+ * isn't a multiple of the group leaves zero columns before the next one.
+ */
+int npu_tensor_upload_fused(npu_context_t *ctx, const void *const *B, const int *N, int parts, int K, int precision,
+  npu_tensor_t *t) {
+
+  int group = (precision == precision_int8) ? 32 : 16;
+  size_t row = (size_t)roundup(K, 32) * ((precision == precision_int8) ? sizeof(int8_t) : sizeof(_Float16));
+  int offset[NPU_TENSOR_MAX_PARTS], total = 0, ret;
+
+  if ((parts <= 0) || (parts > NPU_TENSOR_MAX_PARTS))
+    return -EINVAL;
+  for (int i = 0; i < parts; i++) {
+    if (N[i] <= 0)
+      return -EINVAL;
+    offset[i] = total;
+    total += roundup(N[i], group);
+  }
+
+  ret = tensor_alloc(ctx, precision, total, K, t);
+  if (ret < 0)
+    return ret;
+  t->parts = parts;
+  for (int i = 0; i < parts; i++) {
+    void *dst = (uint8_t *)t->buf.map + offset[i] * row;
+    t->part_n[i] = N[i];
+    t->part_offset[i] = offset[i];
+    if (precision == precision_int8)
+      npu_pack_weight_int8(B[i], K, N[i], K, dst);
+    else
+      npu_pack_weight_fp16(B[i], K, N[i], K, dst);
+  }
+  return tensor_sync(t);
+}
+
+void npu_tensor_views(const npu_tensor_t *t, void *C, int dtype, npu_view_t *views) {
+
+  for (int i = 0; i < t->parts; i++) {
+    views[i].data = (uint8_t *)C + t->part_offset[i] * output_size(dtype);
+    views[i].n = t->part_n[i];
+    views[i].ld = t->n;
+  }
+}
+
+// The file payload is already in the NPU layout, it's a straight copy
+int npu_tensor_load(npu_context_t *ctx, const npu_weights_file_t *f, const npu_weights_entry_t *e, npu_tensor_t *t) {
+
+  int ret = tensor_alloc(ctx, e->precision, e->n, e->k, t);
+
+  if (ret < 0)
+    return ret;
+  if (e->size != t->buf.requested) {
+    npu_log(NPU_LOG_ERROR, "%s is %llu bytes, expected %zu\n", e->name, (unsigned long long)e->size, t->buf.requested);
+    npu_tensor_free(t);
+    return -EINVAL;
+  }
+  memcpy(t->buf.map, npu_weights_payload(f, e), e->size);
+  return tensor_sync(t);
+}
+
+void npu_tensor_free(npu_tensor_t *t) {
+
+  if (t->ctx != NULL) {
+    npu_matmul_forget(t->ctx, &t->buf);
+    npu_pool_free(npu_context_pool(t->ctx), &t->buf);
+  }
+  memset(t, 0, sizeof(*t));
+}
+
+int npu_matmul_tensor(npu_context_t *ctx, const void *A, const npu_tensor_t *B, void *C, int M, int dtype) {
+
+  if ((B->ctx != ctx) || (B->k_stride < roundup(B->k, 32)) || (B->precision != ((dtype == npu_dtype_int8) ? precision_int8 : precision_float16)))
+    return -EINVAL;
+  return matmul(ctx, A, NULL, B->buf.dma_addr, B->k_stride, C, M, B->k, B->n, dtype);
+}
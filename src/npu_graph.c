@@ -0,0 +1,381 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "npu_interface.h"
+#include "npu_matmul.h"
+#include "npu_convert.h"
+#include "npu_program.h"
+#include "npu_gemm.h"
+#include "npu_log.h"
+#include "npu_arena.h"
+#include "npu_graph.h"
+
+static size_t align_up(size_t v, size_t a) {
+  return ((v + a - 1) / a) * a;
+}
+
+void npu_graph_init(npu_graph_t *g, npu_context_t *ctx) {
+
+  memset(g, 0, sizeof(*g));
+  g->ctx = ctx;
+  npu_program_init(&g->prog);
+}
+
+void npu_graph_destroy(npu_graph_t *g) {
+
+  if (g->ctx != NULL) {
+    npu_program_free(npu_context_fd(g->ctx), &g->prog);
+    npu_pool_free(npu_context_pool(g->ctx), &g->arena);
+    npu_pool_free(npu_context_pool(g->ctx), &g->weights);
+  }
+  memset(g, 0, sizeof(*g));
+}
+
+static int add_tensor(npu_graph_t *g, int kind, int rows, int cols) {
+
+  npu_graph_tensor_t *t;
+
+  if (g->compiled)
+    return -EBUSY;
+  if (g->tensor_count == NPU_GRAPH_MAX_TENSORS)
+    return -ENOSPC;
+  if ((rows <= 0) || (cols <= 0))
+    return -EINVAL;
+
+  t = &g->tensors[g->tensor_count];
+  memset(t, 0, sizeof(*t));
+  t->kind = kind;
+  t->rows = rows;
+  t->cols = cols;
+  t->producer = -1;
+  t->input = -1;
+  t->output = -1;
+  return g->tensor_count++;
+}
+
+static int valid(const npu_graph_t *g, int t, int kind) {
+  return (t >= 0) && (t < g->tensor_count) && (g->tensors[t].kind == kind);
+}
+
+static int add_node(npu_graph_t *g, int op, int a, int b, int rows, int cols) {
+
+  npu_graph_node_t *node;
+  int out;
+
+  if (g->node_count == NPU_GRAPH_MAX_NODES)
+    return -ENOSPC;
+  out = add_tensor(g, npu_tensor_activation, rows, cols);
+  if (out < 0)
+    return out;
+
+  node = &g->nodes[g->node_count];
+  memset(node, 0, sizeof(*node));
+  node->op = op;
+  node->in[0] = a;
+  node->in[1] = b;
+  node->out = out;
+  g->tensors[a].consumers++;
+  if (b >= 0)
+    g->tensors[b].consumers++;
+  g->tensors[out].producer = g->node_count++;
+  return out;
+}
+
+int npu_graph_input(npu_graph_t *g, int rows, int cols) {
+
+  int t = add_tensor(g, npu_tensor_activation, rows, cols);
+
+  if (t >= 0) {
+    g->tensors[t].input = g->input_count;
+    g->inputs[g->input_count++] = t;
+  }
+  return t;
+}
+
+int npu_graph_weight(npu_graph_t *g, const _Float16 *data, int n, int k) {
+
+  int t = add_tensor(g, npu_tensor_weight, n, k);
+
+  if (t >= 0)
+    g->tensors[t].data = data;
+  return t;
+}
+
+// a is M x K, b is a N x K weight, the result M x N
+int npu_graph_matmul(npu_graph_t *g, int a, int b) {
+
+  if ((a < 0) || (b < 0))
+    return (a < 0) ? a : b;
+  if (!valid(g, a, npu_tensor_activation) || !valid(g, b, npu_tensor_weight) ||
+      (g->tensors[a].cols != g->tensors[b].cols))
+    return -EINVAL;
+  return add_node(g, npu_op_matmul, a, b, g->tensors[a].rows, g->tensors[b].rows);
+}
+
+int npu_graph_relu(npu_graph_t *g, int x) {
+
+  if (x < 0)
+    return x;
+  if (!valid(g, x, npu_tensor_activation))
+    return -EINVAL;
+  return add_node(g, npu_op_relu, x, -1, g->tensors[x].rows, g->tensors[x].cols);
+}
+
+int npu_graph_output(npu_graph_t *g, int t) {
+
+  if (t < 0)
+    return t;
+  if (!valid(g, t, npu_tensor_activation) || (g->tensors[t].output >= 0))
+    return -EINVAL;
+  g->tensors[t].output = g->output_count;
+  g->outputs[g->output_count++] = t;
+  return t;
+}
+
+/*
+ * relu takes over the matmul in front of it when nothing else reads the
+ * matmul's result, the matmul then writes the relu's output directly.
+ */
+static int fuse(npu_graph_t *g) {
+
+  for (int i = 0; i < g->node_count; i++) {
+    npu_graph_node_t *node = &g->nodes[i];
+    npu_graph_tensor_t *x;
+    npu_graph_node_t *prev;
+
+    if (node->op != npu_op_relu)
+      continue;
+    x = &g->tensors[node->in[0]];
+    prev = (x->producer >= 0) ? &g->nodes[x->producer] : NULL;
+    if ((prev == NULL) || (prev->op != npu_op_matmul) || prev->relu || (x->consumers != 1) || (x->output >= 0)) {
+      npu_log(NPU_LOG_ERROR, "graph node %d: relu must follow a matmul whose result has no other use\n", i);
+      return -ENOTSUP;
+    }
+    prev->relu = 1;
+    prev->out = node->out;
+    g->tensors[node->out].producer = x->producer;
+    x->consumers = 0;
+    x->producer = -1;
+    node->op = npu_op_fused;
+  }
+  return 0;
+}
+
+/*
+ * Activations are live from the node that writes them to the last node that
+ * reads them, inputs from the start and outputs to the end.
+ */
+static void liveness(npu_graph_t *g) {
+
+  for (int i = 0; i < g->tensor_count; i++) {
+    npu_graph_tensor_t *t = &g->tensors[i];
+    t->first = (t->input >= 0) ? -1 : t->producer;
+    t->last = (t->output >= 0) ? g->node_count : t->first;
+  }
+  for (int i = 0; i < g->node_count; i++) {
+    const npu_graph_node_t *node = &g->nodes[i];
+    if (node->op == npu_op_fused)
+      continue;
+    for (int j = 0; j < 2; j++) {
+      if ((node->in[j] >= 0) && (g->tensors[node->in[j]].last < i))
+        g->tensors[node->in[j]].last = i;
+    }
+  }
+}
+
+static int needs_buffer(const npu_graph_tensor_t *t) {
+  return (t->kind == npu_tensor_activation) && ((t->input >= 0) || (t->producer >= 0));
+}
+
+// Activations are placed by npu_arena_plan() over their node ranges
+static int place(npu_graph_t *g) {
+
+  npu_arena_block_t blocks[NPU_GRAPH_MAX_TENSORS];
+  int ids[NPU_GRAPH_MAX_TENSORS], count = 0, ret;
+
+  for (int i = 0; i < g->tensor_count; i++) {
+    const npu_graph_tensor_t *t = &g->tensors[i];
+    if (!needs_buffer(t))
+      continue;
+    blocks[count].size = t->size;
+    blocks[count].first = t->first;
+    blocks[count].last = t->last;
+    ids[count++] = i;
+  }
+  ret = npu_arena_plan(blocks, count, NPU_GRAPH_ALIGN, &g->arena_stats);
+  for (int i = 0; (ret == 0) && (i < count); i++)
+    g->tensors[ids[i]].offset = blocks[i].offset;
+  return ret;
+}
+
+static int lower_matmul(npu_graph_t *g, const npu_graph_node_t *node) {
+
+  const npu_graph_tensor_t *a = &g->tensors[node->in[0]];
+  const npu_graph_tensor_t *w = &g->tensors[node->in[1]];
+  const npu_graph_tensor_t *out = &g->tensors[node->out];
+  matmul_params_t params;
+  matmul_options_t opts;
+  npu_cna_desc cna;
+  npu_core_desc core;
+  npu_dpu_desc dpu;
+
+  for (int n0 = 0; n0 < out->channels; n0 += NPU_GEMM_N_TILE_MAX) {
+    memset(&params, 0, sizeof(params));
+    params.m = a->height;
+    params.k = a->channels;
+    params.n = (out->channels - n0 < NPU_GEMM_N_TILE_MAX) ? out->channels - n0 : NPU_GEMM_N_TILE_MAX;
+    params.input_dma = g->arena.dma_addr + a->offset;
+    params.weights_dma = g->weights.dma_addr + w->offset + (size_t)n0 * a->channels * sizeof(_Float16);
+    params.output_dma = g->arena.dma_addr + out->offset + (size_t)n0 * out->height * sizeof(_Float16);
+    params.fp32tofp16 = 1;
+    opts.relu = node->relu;
+    if (gen_matmul_fp16_desc(&params, &cna, &core, &dpu) < 0) {
+      npu_log(NPU_LOG_ERROR, "graph matmul %dx%dx%d does not fit in one task\n", a->rows, a->cols, out->cols);
+      return -E2BIG;
+    }
+    if (npu_program_add_matmul_fp16_ex(&g->prog, &params, &opts) < 0)
+      return -ENOMEM;
+  }
+  return 0;
+}
+
+int npu_graph_compile(npu_graph_t *g) {
+
+  npu_pool_t *pool = npu_context_pool(g->ctx);
+  int fd = npu_context_fd(g->ctx);
+  int ret;
+
+  if (g->compiled)
+    return -EBUSY;
+  if ((pool == NULL) || (fd < 0))
+    return -ENODEV;
+  if ((g->input_count == 0) || (g->output_count == 0))
+    return -EINVAL;
+
+  ret = fuse(g);
+  if (ret < 0)
+    return ret;
+  liveness(g);
+
+  // Rows padded for the CNA, channels to whole 32 channel input blocks so a
+  // result can be read as the next input
+  g->weights_size = 0;
+  for (int i = 0; i < g->tensor_count; i++) {
+    npu_graph_tensor_t *t = &g->tensors[i];
+    if (t->kind == npu_tensor_weight) {
+      t->offset = g->weights_size;
+      t->size = weight_size_fp16((t->rows + 31) / 32 * 32, t->cols);
+      g->weights_size = align_up(g->weights_size + t->size, NPU_GRAPH_ALIGN);
+    } else if (needs_buffer(t)) {
+      t->height = (t->rows == 1) ? 1 : (t->rows + 3) / 4 * 4;
+      t->channels = (t->cols + 31) / 32 * 32;
+      t->size = (size_t)t->height * t->channels * sizeof(_Float16);
+    }
+  }
+  ret = place(g);
+  if (ret < 0)
+    return ret;
+
+  if ((npu_pool_alloc(pool, g->arena_stats.peak, NPU_GRAPH_ALIGN, &g->arena) < 0) ||
+      (npu_pool_alloc(pool, g->weights_size, NPU_GRAPH_ALIGN, &g->weights) < 0)) {
+    npu_log(NPU_LOG_ERROR, "Failed to allocate graph buffers\n");
+    npu_pool_free(pool, &g->arena);
+    npu_pool_free(pool, &g->weights);
+    return -ENOMEM;
+  }
+
+  // Weights are packed with zero kernels up to their consumer's 32 channels
+  for (int i = 0; i < g->tensor_count; i++) {
+    npu_graph_tensor_t *t = &g->tensors[i];
+    if (t->kind != npu_tensor_weight)
+      continue;
+    memset((uint8_t *)g->weights.map + t->offset, 0, t->size);
+    npu_pack_weight_fp16(t->data, t->cols, t->rows, t->cols, (_Float16 *)((uint8_t *)g->weights.map + t->offset));
+    t->data = NULL;
+  }
+
+  ret = npu_pool_sync_to_device(pool, &g->weights, 0, g->weights_size);
+  for (int i = 0; (ret == 0) && (i < g->node_count); i++) {
+    if (g->nodes[i].op == npu_op_matmul)
+      ret = lower_matmul(g, &g->nodes[i]);
+  }
+  if (ret == 0)
+    ret = npu_program_finalize(fd, &g->prog);
+  if (ret < 0) {
+    npu_program_free(fd, &g->prog);
+    npu_pool_free(pool, &g->arena);
+    npu_pool_free(pool, &g->weights);
+    return ret;
+  }
+  g->compiled = 1;
+  return 0;
+}
+
+int npu_graph_run(npu_graph_t *g, const float *const *inputs, float *const *outputs) {
+
+  npu_pool_t *pool = npu_context_pool(g->ctx);
+  int ret;
+
+  if (!g->compiled)
+    return -EINVAL;
+
+  for (int i = 0; i < g->input_count; i++) {
+    const npu_graph_tensor_t *t = &g->tensors[g->inputs[i]];
+    npu_pack_feature_fp32(inputs[i], t->cols, t->rows, t->cols, t->height,
+      (_Float16 *)((uint8_t *)g->arena.map + t->offset));
+    ret = npu_pool_sync_to_device(pool, &g->arena, t->offset, t->size);
+    if (ret < 0)
+      return ret;
+  }
+
+  ret = npu_program_submit(npu_context_fd(g->ctx), &g->prog, 0);
+  if (ret < 0)
+    return ret;
+
+  for (int i = 0; i < g->output_count; i++) {
+    const npu_graph_tensor_t *t = &g->tensors[g->outputs[i]];
+    ret = npu_pool_sync_from_device(pool, &g->arena, t->offset, t->size);
+    if (ret < 0)
+      return ret;
+    npu_unpack_output_fp16_fp32((const _Float16 *)((const uint8_t *)g->arena.map + t->offset), t->height,
+      t->rows, t->cols, outputs[i], t->cols);
+  }
+  return 0;
+}
+
+void npu_graph_report(const npu_graph_t *g, FILE *fp) {
+
+  fprintf(fp, "graph: %d nodes, %u tasks in one submit\n", g->node_count, g->prog.task_count);
+  fprintf(fp, "  activations %zu bytes (%zu unshared, %zu live at most), weights %zu bytes\n",
+    g->arena_stats.peak, g->arena_stats.naive, g->arena_stats.live, g->weights_size);
+  for (int i = 0; i < g->tensor_count; i++) {
+    const npu_graph_tensor_t *t = &g->tensors[i];
+    if (!needs_buffer(t))
+      continue;
+    fprintf(fp, "  t%-2d %5d x %-5d nodes %2d..%-2d offset %8zu size %8zu\n", i, t->rows, t->cols, t->first,
+      t->last, t->offset, t->size);
+  }
+}
@@ -20,6 +20,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
@@ -29,38 +30,81 @@
 
 #include "rknpu-ioctl.h"
 #include "npu_hw.h"
+#include "npu_interface.h"
+#include "npu_emu.h"
+#include "npu_log.h"
+#include "npu_trace.h"
 
-void* mem_allocate(int fd, size_t size, uint64_t *dma_addr, uint64_t *obj, uint32_t flags, uint32_t *handle) {
+static npu_ioctl_fn ioctl_hook = NULL;
+static const npu_backend_t *backend = NULL;
+
+/*
+ * All driver calls go through here so a stand-in device can be swapped in
+ * for testing.
+ */
+int npu_ioctl(int fd, unsigned long request, void *arg) {
+
+  npu_ioctl_fn hook = __atomic_load_n(&ioctl_hook, __ATOMIC_ACQUIRE);
+  if (hook != NULL)
+    return hook(fd, request, arg);
+  return npu_get_backend()->ioctl(fd, request, arg);
+}
+
+void npu_set_ioctl_hook(npu_ioctl_fn fn) {
+  __atomic_store_n(&ioctl_hook, fn, __ATOMIC_RELEASE);
+}
+
+static npu_sram_usage_t sram_usage;
+static size_t sram_hot_max = NPU_SRAM_HOT_MAX;
+static size_t large_bo_min = NPU_LARGE_BO_MIN;
+static npu_mem_usage_t mem_usage;
+
+static const char *mem_flag_names[NPU_MEM_FLAG_BITS] = {
+  "non-contiguous", "cacheable", "write-combine", "kernel-mapping", "iommu",
+  "zeroing", "secure", "non-dma32", "try-sram",
+};
+
+static void* mem_allocate_sram(int fd, size_t size, size_t sram_size, uint64_t *dma_addr, uint64_t *obj, uint32_t flags, uint32_t *handle) {
 
   int ret;
+  uint64_t trace = NPU_TRACE_BEGIN();
+  // RKNPU_MEM_NON_CACHEABLE is 0, the mapping is uncached unless the caller
+  // asks for RKNPU_MEM_CACHEABLE or RKNPU_MEM_WRITE_COMBINE
   struct rknpu_mem_create mem_create = {
-    .flags = flags | RKNPU_MEM_NON_CACHEABLE,
+    .flags = flags,
     .size = size,
+    .sram_size = sram_size,
   };
 
-  ret = ioctl(fd, DRM_IOCTL_RKNPU_MEM_CREATE, &mem_create);
+  ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_MEM_CREATE, &mem_create);
   if(ret < 0)  {
-    printf("RKNPU_MEM_CREATE failed %d\n",ret);
+    npu_log(NPU_LOG_ERROR, "RKNPU_MEM_CREATE failed %d\n",ret);
     return NULL;
   }
+  // Set before anything else can fail so the caller can destroy the BO
+  *dma_addr = mem_create.dma_addr;
+  *obj = mem_create.obj_addr;
+  *handle = mem_create.handle;
 
   struct rknpu_mem_map mem_map = { .handle = mem_create.handle, .offset=0 };
-  ret = ioctl(fd, DRM_IOCTL_RKNPU_MEM_MAP, &mem_map);
+  ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_MEM_MAP, &mem_map);
   if(ret < 0) {
-    printf("RKNPU_MEM_MAP failed %d\n",ret);
+    npu_log(NPU_LOG_ERROR, "RKNPU_MEM_MAP failed %d\n",ret);
     return NULL;
   }
-  printf("mem_create.dma_addr is %lx, mem_create.obj_addr is %lx, mem_create.handle is %d\n", mem_create.dma_addr, mem_create.obj_addr, mem_create.handle);
+  npu_log(NPU_LOG_DEBUG, "mem_create.dma_addr is %lx, mem_create.obj_addr is %lx, mem_create.handle is %d\n", mem_create.dma_addr, mem_create.obj_addr, mem_create.handle);
 
-  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mem_map.offset);
+  void *map = npu_get_backend()->mmap(fd, size, mem_map.offset);
 
-  *dma_addr = mem_create.dma_addr;
-  *obj = mem_create.obj_addr;
-  *handle = mem_create.handle;
-  printf("map is %p\n", map);
+  npu_log(NPU_LOG_DEBUG, "map is %p\n", map);
+  NPU_TRACE_END(npu_trace_alloc, trace, size);
   return map;
 }
 
+void* mem_allocate(int fd, size_t size, uint64_t *dma_addr, uint64_t *obj, uint32_t flags, uint32_t *handle) {
+  return mem_allocate_sram(fd, size, 0, dma_addr, obj, flags, handle);
+}
+
 void mem_destroy(int fd, uint32_t handle, uint64_t obj_addr) {
 
   int ret;
@@ -69,49 +113,417 @@ void mem_destroy(int fd, uint32_t handle, uint64_t obj_addr) {
     .obj_addr = obj_addr
   };
 
-  ret = ioctl(fd, DRM_IOCTL_RKNPU_MEM_DESTROY, &destroy);
+  ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_MEM_DESTROY, &destroy);
   if (ret <0) {
-    printf("RKNPU_MEM_DESTROY failed %d\n",ret);
+    npu_log(NPU_LOG_ERROR, "RKNPU_MEM_DESTROY failed %d\n",ret);
   }
 }
 
-int npu_open() {
+static void account(uint32_t flags, size_t size, int sign) {
 
-  char buf1[256], buf2[256], buf3[256];
+  uint64_t bytes = __atomic_add_fetch(&mem_usage.bytes, sign * (int64_t)size, __ATOMIC_RELAXED);
+  uint64_t peak = __atomic_load_n(&mem_usage.peak_bytes, __ATOMIC_RELAXED);
 
-  memset(buf1, 0 ,sizeof(buf1));
-  memset(buf2, 0 ,sizeof(buf2));
-  memset(buf3, 0, sizeof(buf3));
-  printf("buf1 is %s, buf2 is %s, buf3 is %s\n", buf1, buf2, buf3);
+  while ((bytes > peak) &&
+         !__atomic_compare_exchange_n(&mem_usage.peak_bytes, &peak, bytes, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  __atomic_add_fetch(&mem_usage.bos, sign, __ATOMIC_RELAXED);
+  if ((flags & RKNPU_MEM_NON_CONTIGUOUS) == 0)
+    __atomic_add_fetch(&mem_usage.contiguous_bytes, sign * (int64_t)size, __ATOMIC_RELAXED);
+  for (int b = 0; b < NPU_MEM_FLAG_BITS; b++) {
+    if (flags & (1u << b)) {
+      __atomic_add_fetch(&mem_usage.flag_bytes[b], sign * (int64_t)size, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&mem_usage.flag_bos[b], sign, __ATOMIC_RELAXED);
+    }
+  }
+}
 
-  // Open DRI called "rknpu"
-  int fd = open("/dev/dri/card1", O_RDWR);
-  if(fd<0) {
-    printf("Failed to open /dev/dri/card1 %d\n",errno);
-    return fd;
+static int bo_alloc(int fd, size_t size, size_t sram_size, uint32_t flags, npu_bo_t *bo) {
+
+  memset(bo, 0, sizeof(*bo));
+  bo->map = mem_allocate_sram(fd, size, sram_size, &bo->dma_addr, &bo->obj_addr, flags, &bo->handle);
+  if ((bo->map == NULL) || (bo->map == MAP_FAILED)) {
+    if (bo->handle != 0)
+      mem_destroy(fd, bo->handle, bo->obj_addr);
+    memset(bo, 0, sizeof(*bo));
+    return -1;
+  }
+  bo->size = size;
+  bo->flags = flags;
+  account(flags, size, 1);
+  return 0;
+}
+
+/*
+ * Allocate and map a buffer object, bo is zeroed on failure.
+ *
+ * With NPU_BO_IOMMU, large buffers (weights mostly) are built from
+ * scattered pages behind the NPU IOMMU, so they don't need a contiguous CMA
+ * range. Smaller ones stay contiguous. If the non-contiguous allocation
+ * fails the buffer is retried from CMA.
+ */
+int npu_bo_alloc(int fd, size_t size, uint32_t flags, npu_bo_t *bo) {
+
+  uint32_t large = RKNPU_MEM_NON_CONTIGUOUS | RKNPU_MEM_IOMMU;
+  int iommu = (flags & NPU_BO_IOMMU) != 0;
+
+  flags &= ~NPU_BO_IOMMU;
+  if (iommu && (large_bo_min != 0) && (size >= large_bo_min) && ((flags & large) == 0)) {
+    if (bo_alloc(fd, size, 0, flags | large, bo) == 0)
+      return 0;
+    npu_log(NPU_LOG_INFO, "non-contiguous allocation of %zu failed, trying CMA\n", size);
+  }
+  return bo_alloc(fd, size, 0, flags, bo);
+}
+
+// 0 keeps every npu_bo_alloc() contiguous
+void npu_set_large_bo_min(size_t bytes) {
+  large_bo_min = bytes;
+}
+
+void npu_get_mem_usage(npu_mem_usage_t *usage) {
+
+  usage->bytes = __atomic_load_n(&mem_usage.bytes, __ATOMIC_RELAXED);
+  usage->peak_bytes = __atomic_load_n(&mem_usage.peak_bytes, __ATOMIC_RELAXED);
+  usage->bos = __atomic_load_n(&mem_usage.bos, __ATOMIC_RELAXED);
+  usage->contiguous_bytes = __atomic_load_n(&mem_usage.contiguous_bytes, __ATOMIC_RELAXED);
+  for (int b = 0; b < NPU_MEM_FLAG_BITS; b++) {
+    usage->flag_bytes[b] = __atomic_load_n(&mem_usage.flag_bytes[b], __ATOMIC_RELAXED);
+    usage->flag_bos[b] = __atomic_load_n(&mem_usage.flag_bos[b], __ATOMIC_RELAXED);
+  }
+}
+
+const char *npu_mem_flag_name(int bit) {
+  if ((bit < 0) || (bit >= NPU_MEM_FLAG_BITS))
+    return NULL;
+  return mem_flag_names[bit];
+}
+
+static void gem_close(int fd, uint32_t handle) {
+
+  struct drm_gem_close close_args = {
+    .handle = handle,
+  };
+
+  if (npu_ioctl(fd, DRM_IOCTL_GEM_CLOSE, &close_args) < 0)
+    npu_log(NPU_LOG_ERROR, "GEM_CLOSE failed\n");
+}
+
+/*
+ * The driver hands back the address and size of an existing object when
+ * RKNPU_MEM_CREATE is given its handle, which is how imported buffers get
+ * their NPU address.
+ */
+int npu_bo_import(int fd, int dmabuf_fd, size_t size, npu_bo_t *bo) {
+
+  uint64_t trace = NPU_TRACE_BEGIN();
+  struct drm_prime_handle prime = {
+    .fd = dmabuf_fd,
+  };
+  struct rknpu_mem_create mem_create;
+  struct rknpu_mem_map mem_map;
+  off_t pos, end;
+  int ret;
+
+  memset(bo, 0, sizeof(*bo));
+  // Checked up front, the handle may be shared with an earlier import. The
+  // caller's file position is put back, it may be reading the buffer too.
+  pos = lseek(dmabuf_fd, 0, SEEK_CUR);
+  end = lseek(dmabuf_fd, 0, SEEK_END);
+  if (pos >= 0)
+    lseek(dmabuf_fd, pos, SEEK_SET);
+  if ((end <= 0) || (size > (size_t)end)) {
+    npu_log(NPU_LOG_ERROR, "dma-buf %d is too small or can't be sized\n", dmabuf_fd);
+    return -1;
+  }
+  if (size == 0)
+    size = end;
+
+  ret = npu_ioctl(fd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &prime);
+  if (ret < 0) {
+    npu_log(NPU_LOG_ERROR, "PRIME_FD_TO_HANDLE failed %d\n", ret);
+    return ret;
+  }
+
+  memset(&mem_create, 0, sizeof(mem_create));
+  mem_create.handle = prime.handle;
+  ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_MEM_CREATE, &mem_create);
+  if (ret < 0)
+    goto fail;
+
+  memset(&mem_map, 0, sizeof(mem_map));
+  mem_map.handle = prime.handle;
+  ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_MEM_MAP, &mem_map);
+  if (ret < 0)
+    goto fail;
+
+  bo->map = npu_get_backend()->mmap(fd, size, mem_map.offset);
+  if (bo->map == MAP_FAILED) {
+    bo->map = NULL;
+    ret = -1;
+    goto fail;
   }
+  bo->size = size;
+  bo->dma_addr = mem_create.dma_addr;
+  bo->obj_addr = mem_create.obj_addr;
+  bo->handle = prime.handle;
+  // Cache maintenance is up to the exporter (DMA_BUF_IOCTL_SYNC)
+  bo->flags = 0;
+  bo->imported = 1;
+  NPU_TRACE_END(npu_trace_alloc, trace, size);
+  return 0;
+
+fail:
+  gem_close(fd, prime.handle);
+  memset(bo, 0, sizeof(*bo));
+  return ret;
+}
+
+// The fd stays valid after npu_bo_free(), close it when done
+int npu_bo_export(int fd, const npu_bo_t *bo, int *dmabuf_fd) {
+
+  struct drm_prime_handle prime = {
+    .handle = bo->handle,
+    .flags = DRM_CLOEXEC | DRM_RDWR,
+    .fd = -1,
+  };
+  int ret;
+
+  *dmabuf_fd = -1;
+  ret = npu_ioctl(fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &prime);
+  if (ret < 0) {
+    npu_log(NPU_LOG_ERROR, "PRIME_HANDLE_TO_FD failed %d\n", ret);
+    return ret;
+  }
+  *dmabuf_fd = prime.fd;
+  return 0;
+}
+
+/*
+ * Small, constantly re-read buffers (regcmds, task arrays, decode activations)
+ * go to the on-chip SRAM when there is room, otherwise the driver falls back to
+ * DRAM. Placement is detected from the change in free SRAM so bo->sram_size
+ * can be off if another process allocates SRAM at the same time.
+ */
+int npu_bo_alloc_hot(int fd, size_t size, uint32_t flags, npu_bo_t *bo) {
 
+  uint32_t total, free_before, free_after;
+  size_t sram_size = (size + NPU_PAGE_SIZE - 1) & ~((size_t)NPU_PAGE_SIZE - 1);
+
+  if ((size > sram_hot_max) || (npu_get_sram_size(fd, &total, &free_before) < 0) ||
+      (free_before < sram_size)) {
+    __atomic_add_fetch(&sram_usage.fallback_allocs, 1, __ATOMIC_RELAXED);
+    return bo_alloc(fd, size, 0, flags, bo);
+  }
+
+  if (bo_alloc(fd, size, sram_size, flags | RKNPU_MEM_TRY_ALLOC_SRAM, bo) < 0)
+    return -1;
+
+  if ((npu_get_sram_size(fd, &total, &free_after) == 0) && (free_after < free_before)) {
+    bo->sram_size = free_before - free_after;
+    __atomic_add_fetch(&sram_usage.sram_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sram_usage.bytes_in_sram, bo->sram_size, __ATOMIC_RELAXED);
+  } else {
+    __atomic_add_fetch(&sram_usage.fallback_allocs, 1, __ATOMIC_RELAXED);
+  }
+  return 0;
+}
+
+void npu_set_sram_hot_max(size_t bytes) {
+  sram_hot_max = bytes;
+}
+
+int npu_get_sram_size(int fd, uint32_t *total, uint32_t *free_size) {
+
+  struct rknpu_action act = {
+    .flags = RKNPU_GET_TOTAL_SRAM_SIZE,
+  };
+  int ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_ACTION, &act);
+  if (ret < 0)
+    return ret;
+  *total = act.value;
+
+  act.flags = RKNPU_GET_FREE_SRAM_SIZE;
+  act.value = 0;
+  ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_ACTION, &act);
+  if (ret < 0)
+    return ret;
+  *free_size = act.value;
+  return 0;
+}
+
+int npu_get_sram_usage(int fd, npu_sram_usage_t *usage) {
+
+  usage->sram_allocs = __atomic_load_n(&sram_usage.sram_allocs, __ATOMIC_RELAXED);
+  usage->fallback_allocs = __atomic_load_n(&sram_usage.fallback_allocs, __ATOMIC_RELAXED);
+  usage->bytes_in_sram = __atomic_load_n(&sram_usage.bytes_in_sram, __ATOMIC_RELAXED);
+  return npu_get_sram_size(fd, &usage->total, &usage->free);
+}
+
+void npu_bo_free(int fd, npu_bo_t *bo) {
+
+  if (bo->map == NULL)
+    return;
+  if (bo->sram_size > 0)
+    __atomic_sub_fetch(&sram_usage.bytes_in_sram, bo->sram_size, __ATOMIC_RELAXED);
+  munmap(bo->map, bo->size);
+  if (bo->imported) {
+    gem_close(fd, bo->handle);
+  } else {
+    mem_destroy(fd, bo->handle, bo->obj_addr);
+    account(bo->flags, bo->size, -1);
+  }
+  memset(bo, 0, sizeof(*bo));
+}
+
+/*
+ * Cache maintenance for RKNPU_MEM_CACHEABLE buffers, flush after the cpu has
+ * written a range and invalidate before reading what the NPU wrote. The
+ * range is widened to whole cache lines.
+ */
+static int mem_sync(int fd, uint64_t obj_addr, size_t offset, size_t size, uint32_t flags) {
+
+  size_t start = offset & ~((size_t)NPU_CACHE_LINE - 1);
+  size_t end = (offset + size + NPU_CACHE_LINE - 1) & ~((size_t)NPU_CACHE_LINE - 1);
+  struct rknpu_mem_sync sync = {
+    .flags = flags,
+    .obj_addr = obj_addr,
+    .offset = start,
+    .size = end - start,
+  };
+
+  if (size == 0)
+    return 0;
+  int ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_MEM_SYNC, &sync);
+  if (ret < 0) {
+    npu_log(NPU_LOG_ERROR, "RKNPU_MEM_SYNC failed %d\n", ret);
+  }
+  return ret;
+}
+
+int npu_sync_to_device(int fd, uint64_t obj_addr, size_t offset, size_t size) {
+  return mem_sync(fd, obj_addr, offset, size, RKNPU_MEM_SYNC_TO_DEVICE);
+}
+
+int npu_sync_from_device(int fd, uint64_t obj_addr, size_t offset, size_t size) {
+  return mem_sync(fd, obj_addr, offset, size, RKNPU_MEM_SYNC_FROM_DEVICE);
+}
+
+// Uncached and write-combined mappings need no maintenance
+int npu_bo_sync_to_device(int fd, npu_bo_t *bo, size_t offset, size_t size) {
+  if ((bo->flags & RKNPU_MEM_CACHEABLE) == 0)
+    return 0;
+  return npu_sync_to_device(fd, bo->obj_addr, offset, size);
+}
+
+int npu_bo_sync_from_device(int fd, npu_bo_t *bo, size_t offset, size_t size) {
+  if ((bo->flags & RKNPU_MEM_CACHEABLE) == 0)
+    return 0;
+  return npu_sync_from_device(fd, bo->obj_addr, offset, size);
+}
+
+// fd of path if the DRM driver behind it is rknpu, otherwise -1
+static int open_rknpu_node(const char *path) {
+
+  char name[16];
   struct drm_version dv;
+  int fd = open(path, O_RDWR | O_CLOEXEC);
+
+  if (fd < 0)
+    return -1;
+
+  // Only the name is wanted, date and desc are left at zero length
   memset(&dv, 0, sizeof(dv));
-  dv.name = buf1;
-  dv.name_len = sizeof(buf1);
-  dv.date = buf2;
-  dv.date_len = sizeof(buf2);
-  dv.desc = buf3;
-  dv.desc_len = sizeof(buf3);
-  printf("dv.name is %s, dv.date is %s, dv.desc is %s\n", dv.name, dv.date, dv.desc);
-  int ret = ioctl(fd, DRM_IOCTL_VERSION, &dv);
-  printf("ret is %d\n", ret);
-  if (ret <0) {
-    printf("DRM_IOCTL_VERISON failed %d\n",ret);
-    return ret;
+  dv.name = name;
+  dv.name_len = sizeof(name) - 1;
+  if (npu_ioctl(fd, DRM_IOCTL_VERSION, &dv) < 0) {
+    npu_log(NPU_LOG_ERROR, "DRM_IOCTL_VERSION failed on %s %d\n", path, errno);
+    close(fd);
+    return -1;
+  }
+  name[(dv.name_len < sizeof(name)) ? dv.name_len : sizeof(name) - 1] = 0;
+  if (strcmp(name, "rknpu") != 0) {
+    close(fd);
+    return -1;
   }
-  //printf("drm name is %s - %s - %s\n", dv.name, dv.date, dv.desc);
+  npu_log(NPU_LOG_INFO, "rknpu %d.%d.%d on %s\n", dv.version_major, dv.version_minor,
+    dv.version_patchlevel, path);
   return fd;
 }
 
+/*
+ * The card number depends on probe order, so the node is found by driver
+ * name. RKNPU_DEVICE picks a node explicitly.
+ */
+static int drm_open(void) {
+
+  const char *path = getenv("RKNPU_DEVICE");
+  char node[32];
+  int fd;
+
+  if (path != NULL) {
+    fd = open_rknpu_node(path);
+    if (fd < 0)
+      npu_log(NPU_LOG_ERROR, "%s is not an rknpu device\n", path);
+    return fd;
+  }
+
+  for (int i = 0; i < 16; i++) {
+    snprintf(node, sizeof(node), "/dev/dri/card%d", i);
+    fd = open_rknpu_node(node);
+    if (fd >= 0)
+      return fd;
+  }
+  npu_log(NPU_LOG_ERROR, "No rknpu device under /dev/dri\n");
+  return -1;
+}
+
+static int drm_close(int fd) {
+  return close(fd);
+}
+
+static int drm_ioctl(int fd, unsigned long request, void *arg) {
+  return ioctl(fd, request, arg);
+}
+
+static void *drm_mmap(int fd, size_t size, uint64_t offset) {
+  return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+}
+
+static const npu_backend_t drm_backend = {
+  .name = "drm",
+  .open = drm_open,
+  .close = drm_close,
+  .ioctl = drm_ioctl,
+  .mmap = drm_mmap,
+};
+
+const npu_backend_t *npu_backend_drm(void) {
+  return &drm_backend;
+}
+
+const npu_backend_t *npu_get_backend(void) {
+
+  const npu_backend_t *b = __atomic_load_n(&backend, __ATOMIC_ACQUIRE);
+
+  if (b == NULL) {
+    const char *env = getenv("RKNPU_BACKEND");
+    b = ((env != NULL) && (strcmp(env, "emu") == 0)) ? npu_backend_emu() : &drm_backend;
+    __atomic_store_n(&backend, b, __ATOMIC_RELEASE);
+  }
+  return b;
+}
+
+void npu_set_backend(const npu_backend_t *b) {
+  __atomic_store_n(&backend, b, __ATOMIC_RELEASE);
+}
+
+int npu_open() {
+  return npu_get_backend()->open();
+}
+
 int npu_close(int fd) {
-  return close(fd);	
+  return npu_get_backend()->close(fd);
 }
 
 int npu_reset(int fd) {
@@ -120,5 +532,5 @@ int npu_reset(int fd) {
   struct rknpu_action act = {
     .flags = RKNPU_ACT_RESET,
   };
-  return ioctl(fd, DRM_IOCTL_RKNPU_ACTION, &act);	
+  return npu_ioctl(fd, DRM_IOCTL_RKNPU_ACTION, &act);	
 }
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "npu_log.h"
+
+int npu_log_level = NPU_LOG_NONE;
+
+static const char *level_names[] = { "none", "error", "info", "debug" };
+
+__attribute__((constructor))
+static void log_init(void) {
+
+  const char *env = getenv("RKNPU_LOG");
+
+  if (env == NULL)
+    return;
+  for (int i = 0; i < (int)(sizeof(level_names) / sizeof(level_names[0])); i++) {
+    if (strcmp(env, level_names[i]) == 0) {
+      npu_log_level = i;
+      return;
+    }
+  }
+  npu_set_log_level(atoi(env));
+}
+
+void npu_log_printf(const char *fmt, ...) {
+
+  va_list ap;
+
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+void npu_set_log_level(int level) {
+  if (level < NPU_LOG_NONE)
+    level = NPU_LOG_NONE;
+  if (level > NPU_LOG_DEBUG)
+    level = NPU_LOG_DEBUG;
+  npu_log_level = level;
+}
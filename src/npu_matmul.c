@@ -27,6 +27,7 @@
 #include "npu_cna.h"
 #include "npu_dpu.h"
 #include "npu_matmul.h"
+#include "npu_trace.h"
 
 
 /*
@@ -36,6 +37,7 @@
 void gen_matmul_task(uint64_t *ops, npu_cna_desc *cna_desc, npu_core_desc *core_desc, npu_dpu_desc *dpu_desc) {
 
   uint32_t value;
+  uint64_t trace = NPU_TRACE_BEGIN();
 
   ops[0] = NPUOP(OP_REG_DPU, 0xE, DPU_S_POINTER);
   value = ((cna_desc->proc_precision & 0x7) <<7) |  ((cna_desc->in_precision & 0x7)<<4) | 
@@ -197,6 +199,16 @@ void gen_matmul_task(uint64_t *ops, npu_cna_desc *cna_desc, npu_core_desc *core_
   ops[105] = NPUOP(OP_REG_PC, 0x0, PC_REGISTER_AMOUNTS);
   ops[106] = NPUOP(OP_40, 0x0, 0x0);
   ops[107] = NPUOP(OP_ENABLE, (PC_ENABLE_DPU | PC_ENABLE_CNA | PC_ENABLE), PC_OPERATION_ENABLE);
+  NPU_TRACE_END(npu_trace_regcmd, trace, 108);
+}
+
+// ReLU runs in the BS stage with its ALU and MUL left bypassed
+static void apply_options(const matmul_options_t *opts, npu_dpu_desc *dpu) {
+
+   if ((opts != NULL) && opts->relu) {
+     dpu->bs_bypass = 0;
+     dpu->bs_relu_bypass = 0;
+   }
 }
 
 /*
@@ -208,7 +220,7 @@ void gen_matmul_task(uint64_t *ops, npu_cna_desc *cna_desc, npu_core_desc *core_
  * TODO: Fix a) & b) 
  *
  */
-int gen_matmul_fp16(matmul_params_t *params) {
+int gen_matmul_fp16_desc(matmul_params_t *params, npu_cna_desc *cna, npu_core_desc *core, npu_dpu_desc *dpu) {
 
    npu_cna_desc cna_desc;
    npu_core_desc core_desc;
@@ -239,10 +251,10 @@ int gen_matmul_fp16(matmul_params_t *params) {
    cna_desc.weight_height = 1;
    cna_desc.weight_kernels = params->n;
    cna_desc.weight_bytes_per_kernel = cna_desc.weight_width * cna_desc.weight_height * 
-     cna_desc.datain_channel * sizeof(__fp16);
+     cna_desc.datain_channel * sizeof(_Float16);
    cna_desc.weight_bytes = cna_desc.weight_bytes_per_kernel * cna_desc.weight_kernels; 
 
-   fd_bytes = cna_desc.datain_width * cna_desc.datain_height * cna_desc.datain_channel * sizeof(__fp16);
+   fd_bytes = cna_desc.datain_width * cna_desc.datain_height * cna_desc.datain_channel * sizeof(_Float16);
    fd_banks = (fd_bytes / NPU_CBUF_BANK_SIZE);
    fd_banks = ((fd_bytes % NPU_CBUF_BANK_SIZE) == 0) ? fd_banks : fd_banks +1;
    weight_banks = (cna_desc.weight_bytes / NPU_CBUF_BANK_SIZE);
@@ -334,6 +346,28 @@ int gen_matmul_fp16(matmul_params_t *params) {
    dpu_desc.channel_wdma = core_desc.dataout_channel;
    dpu_desc.surf_add = (!params->fp32tofp16) ? dpu_desc.dst_surf_stride * 4 : dpu_desc.dst_surf_stride * 2;
 
+   *cna = cna_desc;
+   *core = core_desc;
+   *dpu = dpu_desc;
+   return 0;
+}
+
+int gen_matmul_fp16(matmul_params_t *params) {
+   return gen_matmul_fp16_ex(params, NULL);
+}
+
+int gen_matmul_fp16_ex(matmul_params_t *params, const matmul_options_t *opts) {
+
+   npu_cna_desc cna_desc;
+   npu_core_desc core_desc;
+   npu_dpu_desc dpu_desc;
+   int ret;
+
+   ret = gen_matmul_fp16_desc(params, &cna_desc, &core_desc, &dpu_desc);
+   if (ret != 0)
+     return ret;
+   apply_options(opts, &dpu_desc);
+
    gen_matmul_task(params->tasks,&cna_desc,&core_desc,&dpu_desc);
 
    return 0;
@@ -348,7 +382,7 @@ int gen_matmul_fp16(matmul_params_t *params) {
  * TODO: Fix a) & b)
  *
  */
-int gen_matmul_int8(matmul_params_t *params) {
+int gen_matmul_int8_desc(matmul_params_t *params, npu_cna_desc *cna, npu_core_desc *core, npu_dpu_desc *dpu) {
 
    npu_cna_desc cna_desc;
    npu_core_desc core_desc;
@@ -468,6 +502,28 @@ int gen_matmul_int8(matmul_params_t *params) {
    dpu_desc.channel_wdma = core_desc.dataout_channel;
    dpu_desc.surf_add = dpu_desc.dst_surf_stride * 8;
 
+   *cna = cna_desc;
+   *core = core_desc;
+   *dpu = dpu_desc;
+   return 0;
+}
+
+int gen_matmul_int8(matmul_params_t *params) {
+   return gen_matmul_int8_ex(params, NULL);
+}
+
+int gen_matmul_int8_ex(matmul_params_t *params, const matmul_options_t *opts) {
+
+   npu_cna_desc cna_desc;
+   npu_core_desc core_desc;
+   npu_dpu_desc dpu_desc;
+   int ret;
+
+   ret = gen_matmul_int8_desc(params, &cna_desc, &core_desc, &dpu_desc);
+   if (ret != 0)
+     return ret;
+   apply_options(opts, &dpu_desc);
+
    gen_matmul_task(params->tasks,&cna_desc,&core_desc,&dpu_desc);
 
    return 0;
@@ -499,3 +555,46 @@ int weight_int8(int C, int k, int c) {
   dst = dst + ((c-1)%32) + (((k-1)%32)*32);
   return dst;
 }
+
+/*
+ * Packed weights are padded to whole kernel groups (16 for fp16, 32 for int8)
+ * and K to a multiple of 32 channels, padding is zero filled.
+ */
+size_t weight_size_fp16(int N, int K) {
+  return (size_t)(((N + 15) / 16) * 16) * ((K + 31) / 32) * 32 * sizeof(_Float16);
+}
+
+size_t weight_size_int8(int N, int K) {
+  return (size_t)(((N + 31) / 32) * 32) * ((K + 31) / 32) * 32 * sizeof(int8_t);
+}
+
+/*
+ * Pack a row-major N x K matrix (one row per kernel) into the fp16 weight layout.
+ */
+void pack_weight_fp16(int N, int K, const _Float16 *src, _Float16 *dst) {
+
+  uint64_t trace = NPU_TRACE_BEGIN();
+  int kp = ((K + 31) / 32) * 32;
+
+  memset(dst, 0, weight_size_fp16(N, K));
+  for (int n = 1; n <= N; n++) {
+    for (int k = 1; k <= K; k++) {
+      dst[weight_fp16(kp, n, k)] = src[((n-1)*K) + (k-1)];
+    }
+  }
+  NPU_TRACE_END(npu_trace_pack, trace, (uint64_t)N * K);
+}
+
+void pack_weight_int8(int N, int K, const int8_t *src, int8_t *dst) {
+
+  uint64_t trace = NPU_TRACE_BEGIN();
+  int kp = ((K + 31) / 32) * 32;
+
+  memset(dst, 0, weight_size_int8(N, K));
+  for (int n = 1; n <= N; n++) {
+    for (int k = 1; k <= K; k++) {
+      dst[weight_int8(kp, n, k)] = src[((n-1)*K) + (k-1)];
+    }
+  }
+  NPU_TRACE_END(npu_trace_pack, trace, (uint64_t)N * K);
+}
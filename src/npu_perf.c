@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "npu_hw.h"
+#include "npu_cna.h"
+#include "npu_dpu.h"
+#include "npu_matmul.h"
+#include "npu_perf.h"
+
+#define DIV_UP(a, b) (((a) + (b) - 1) / (b))
+
+// rk3588, per core
+void npu_perf_default_hw(npu_perf_hw_t *hw) {
+  hw->fp16_kernels = 16;
+  hw->int8_kernels = 32;
+  hw->atom_channels = 32;
+  hw->freq_mhz = 1000.0;
+  hw->dram_gbps = 10.0;
+  hw->task_overhead_us = 0.0;
+  hw->cbuf_banks = NPU_CBUF_BANKS;
+  hw->cbuf_bank_size = NPU_CBUF_BANK_SIZE;
+}
+
+static int precision_bytes(int precision) {
+  switch (precision) {
+    case precision_int8: return 1;
+    case precision_float16: return 2;
+    case precision_int32:
+    case precision_float32: return 4;
+  }
+  return 0;
+}
+
+int npu_perf_estimate(const npu_perf_hw_t *hw, const npu_cna_desc *cna, const npu_dpu_desc *dpu, npu_perf_t *perf) {
+
+  int in_bytes = precision_bytes(cna->in_precision);
+  int out_bytes = precision_bytes(dpu->out_precision);
+  uint64_t rows, kernels, channels;
+  uint32_t atom_kernels, in_c2, out_c2;
+  double bank_bytes;
+
+  memset(perf, 0, sizeof(*perf));
+  if ((in_bytes == 0) || (out_bytes == 0) || (in_bytes > 2) || (hw->freq_mhz <= 0) || (hw->dram_gbps <= 0))
+    return -1;
+
+  atom_kernels = (in_bytes == 2) ? hw->fp16_kernels : hw->int8_kernels;
+  // Feature data is stored in C2 sized planes, 16 bytes per pixel
+  in_c2 = 16 / in_bytes;
+  out_c2 = (out_bytes == 2) ? 8 : 4;
+
+  rows = (uint64_t)cna->dataout_width * cna->dataout_height;
+  kernels = cna->weight_kernels;
+  channels = (uint64_t)cna->datain_channel * cna->weight_width * cna->weight_height;
+
+  perf->macs = rows * kernels * channels;
+  perf->mac_cycles = rows * DIV_UP(kernels, atom_kernels) * DIV_UP(channels, hw->atom_channels);
+  perf->mac_utilisation = (double)perf->macs / ((double)perf->mac_cycles * atom_kernels * hw->atom_channels);
+
+  perf->feature_bytes = (uint64_t)cna->datain_width * cna->datain_height *
+    DIV_UP(cna->datain_channel, in_c2) * in_c2 * in_bytes;
+  perf->weight_bytes = cna->weight_bytes;
+  perf->output_bytes = rows * DIV_UP(kernels, out_c2) * out_c2 * out_bytes;
+  perf->dram_bytes = perf->feature_bytes + perf->weight_bytes + perf->output_bytes;
+
+  perf->compute_us = perf->mac_cycles / hw->freq_mhz;
+  perf->memory_us = perf->dram_bytes / (hw->dram_gbps * 1000.0);
+  perf->bound = (perf->memory_us > perf->compute_us) ? npu_perf_memory_bound : npu_perf_compute_bound;
+  perf->time_us = ((perf->bound == npu_perf_memory_bound) ? perf->memory_us : perf->compute_us) + hw->task_overhead_us;
+  perf->intensity = (double)perf->macs / perf->dram_bytes;
+
+  // Weights beyond their banks are streamed, only what fits is resident
+  perf->data_banks = cna->data_bank;
+  perf->weight_banks = cna->weight_bank;
+  bank_bytes = (double)hw->cbuf_banks * hw->cbuf_bank_size;
+  perf->cbuf_utilisation = (perf->feature_bytes +
+    ((perf->weight_bytes < (uint64_t)cna->weight_bank * hw->cbuf_bank_size) ?
+      perf->weight_bytes : (uint64_t)cna->weight_bank * hw->cbuf_bank_size)) / bank_bytes;
+  return 0;
+}
+
+int npu_perf_matmul(const npu_perf_hw_t *hw, int precision, int M, int K, int N, int fp16_out, npu_perf_t *perf) {
+
+  matmul_params_t params;
+  npu_cna_desc cna;
+  npu_core_desc core;
+  npu_dpu_desc dpu;
+  int ret;
+
+  memset(&params, 0, sizeof(params));
+  params.m = M;
+  params.k = K;
+  params.n = N;
+  params.fp32tofp16 = fp16_out ? 1 : 0;
+
+  if (precision == precision_float16) {
+    ret = gen_matmul_fp16_desc(&params, &cna, &core, &dpu);
+  } else if (precision == precision_int8) {
+    ret = gen_matmul_int8_desc(&params, &cna, &core, &dpu);
+  } else {
+    return -1;
+  }
+  if (ret != 0)
+    return ret;
+  return npu_perf_estimate(hw, &cna, &dpu, perf);
+}
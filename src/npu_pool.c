@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_log.h"
+#include "npu_pool.h"
+
+struct npu_pool_chunk {
+  npu_bo_t               bo;
+  int                    dedicated;
+  struct npu_pool_chunk  *prev;
+  struct npu_pool_chunk  *next;
+};
+
+struct npu_pool_block {
+  struct npu_pool_chunk  *chunk;
+  size_t                 offset;
+  struct npu_pool_block  *next;
+};
+
+#define CLASS_SIZE(c) ((size_t)1 << ((c) + NPU_POOL_MIN_SHIFT))
+
+static int size_class(size_t size) {
+
+  for (int c = 0; c < NPU_POOL_CLASSES; c++) {
+    if (size <= CLASS_SIZE(c))
+      return c;
+  }
+  return -1;
+}
+
+static int drm_alloc(void *ctx, size_t size, uint32_t flags, npu_bo_t *bo) {
+  return npu_bo_alloc((int)(intptr_t)ctx, size, flags, bo);
+}
+
+static void drm_free(void *ctx, npu_bo_t *bo) {
+  npu_bo_free((int)(intptr_t)ctx, bo);
+}
+
+static int drm_sync(void *ctx, npu_bo_t *bo, size_t offset, size_t size, int to_device) {
+  if (to_device)
+    return npu_bo_sync_to_device((int)(intptr_t)ctx, bo, offset, size);
+  return npu_bo_sync_from_device((int)(intptr_t)ctx, bo, offset, size);
+}
+
+static struct npu_pool_chunk *chunk_create(npu_pool_t *pool, size_t size, int dedicated) {
+
+  struct npu_pool_chunk *chunk = calloc(1, sizeof(*chunk));
+
+  if (chunk == NULL)
+    return NULL;
+
+  if (pool->backend.alloc(pool->backend.ctx, size, pool->flags, &chunk->bo) < 0) {
+    free(chunk);
+    return NULL;
+  }
+  chunk->dedicated = dedicated;
+  chunk->next = pool->chunks;
+  if (pool->chunks != NULL)
+    pool->chunks->prev = chunk;
+  pool->chunks = chunk;
+
+  pool->stats.backend_allocs++;
+  pool->stats.bytes_reserved += chunk->bo.size;
+  if (dedicated) {
+    pool->stats.dedicated++;
+  } else {
+    pool->stats.chunks++;
+  }
+  return chunk;
+}
+
+static void chunk_destroy(npu_pool_t *pool, struct npu_pool_chunk *chunk) {
+
+  if (chunk->prev != NULL)
+    chunk->prev->next = chunk->next;
+  else
+    pool->chunks = chunk->next;
+  if (chunk->next != NULL)
+    chunk->next->prev = chunk->prev;
+
+  pool->stats.bytes_reserved -= chunk->bo.size;
+  if (chunk->dedicated) {
+    pool->stats.dedicated--;
+  } else {
+    pool->stats.chunks--;
+  }
+  pool->backend.free(pool->backend.ctx, &chunk->bo);
+  free(chunk);
+}
+
+static int push_block(npu_pool_t *pool, int c, struct npu_pool_chunk *chunk, size_t offset) {
+
+  struct npu_pool_block *block = malloc(sizeof(*block));
+
+  if (block == NULL)
+    return -1;
+  block->chunk = chunk;
+  block->offset = offset;
+  block->next = pool->free_lists[c];
+  pool->free_lists[c] = block;
+  return 0;
+}
+
+/*
+ * Hand the unused tail of the current chunk to the free lists before a new
+ * chunk is started so nothing is lost.
+ */
+static void retire_current(npu_pool_t *pool) {
+
+  size_t offset = pool->current_used;
+
+  if (pool->current == NULL)
+    return;
+
+  offset = (offset + NPU_POOL_MIN_ALIGN - 1) & ~((size_t)NPU_POOL_MIN_ALIGN - 1);
+  for (int c = NPU_POOL_CLASSES - 1; c >= 0; c--) {
+    while (offset + CLASS_SIZE(c) <= pool->current->bo.size) {
+      if (push_block(pool, c, pool->current, offset) < 0)
+        return;
+      offset += CLASS_SIZE(c);
+    }
+  }
+  pool->current = NULL;
+  pool->current_used = 0;
+}
+
+int npu_pool_init(npu_pool_t *pool, const npu_pool_backend_t *backend, uint32_t flags, size_t chunk_size) {
+
+  memset(pool, 0, sizeof(*pool));
+  if (chunk_size == 0)
+    chunk_size = NPU_POOL_CHUNK_SIZE;
+  if (chunk_size < CLASS_SIZE(NPU_POOL_CLASSES - 1))
+    return -1;
+
+  pool->backend = *backend;
+  pool->flags = flags;
+  pool->chunk_size = chunk_size;
+  return pthread_mutex_init(&pool->lock, NULL);
+}
+
+int npu_pool_init_drm(npu_pool_t *pool, int fd, uint32_t flags) {
+
+  npu_pool_backend_t backend = {
+    .alloc = drm_alloc,
+    .free = drm_free,
+    .sync = drm_sync,
+    .ctx = (void *)(intptr_t)fd,
+  };
+  return npu_pool_init(pool, &backend, flags, NPU_POOL_CHUNK_SIZE);
+}
+
+void npu_pool_destroy(npu_pool_t *pool) {
+
+  for (int c = 0; c < NPU_POOL_CLASSES; c++) {
+    while (pool->free_lists[c] != NULL) {
+      struct npu_pool_block *block = pool->free_lists[c];
+      pool->free_lists[c] = block->next;
+      free(block);
+    }
+  }
+  while (pool->chunks != NULL)
+    chunk_destroy(pool, pool->chunks);
+  pthread_mutex_destroy(&pool->lock);
+  memset(pool, 0, sizeof(*pool));
+}
+
+static void fill_buf(npu_buf_t *buf, struct npu_pool_chunk *chunk, size_t offset, size_t size, int c) {
+
+  buf->map = (uint8_t *)chunk->bo.map + offset;
+  buf->dma_addr = chunk->bo.dma_addr + offset;
+  buf->obj_addr = chunk->bo.obj_addr;
+  buf->offset = offset;
+  buf->size = size;
+  buf->size_class = c;
+  buf->chunk = chunk;
+}
+
+/*
+ * align must be a power of two, anything below NPU_POOL_MIN_ALIGN is raised
+ * to it. BOs are only page aligned, so an alignment a fresh chunk can't meet
+ * with room left for the class gets a dedicated BO, over-allocated to fit.
+ */
+int npu_pool_alloc(npu_pool_t *pool, size_t size, size_t align, npu_buf_t *buf) {
+
+  struct npu_pool_block **link, *block;
+  struct npu_pool_chunk *chunk;
+  uint64_t addr;
+  size_t offset;
+  int c;
+
+  memset(buf, 0, sizeof(*buf));
+  if ((size == 0) || ((align & (align - 1)) != 0))
+    return -1;
+  if (align < NPU_POOL_MIN_ALIGN)
+    align = NPU_POOL_MIN_ALIGN;
+
+  pthread_mutex_lock(&pool->lock);
+
+  // A block at least as big as the alignment keeps the free lists reusable
+  c = size_class((size > align) ? size : align);
+  if ((c >= 0) && (align > NPU_PAGE_SIZE) && (align > pool->chunk_size - CLASS_SIZE(c)))
+    c = -1;
+  if (c < 0) {
+    chunk = chunk_create(pool, size + ((align > NPU_PAGE_SIZE) ? align - NPU_PAGE_SIZE : 0), 1);
+    if (chunk == NULL) {
+      pthread_mutex_unlock(&pool->lock);
+      return -1;
+    }
+    addr = chunk->bo.dma_addr;
+    offset = ((addr + align - 1) & ~((uint64_t)align - 1)) - addr;
+    if (offset + size > chunk->bo.size) {
+      chunk_destroy(pool, chunk);
+      pthread_mutex_unlock(&pool->lock);
+      return -1;
+    }
+    fill_buf(buf, chunk, offset, chunk->bo.size - offset, -1);
+    goto done;
+  }
+
+  for (link = &pool->free_lists[c]; *link != NULL; link = &(*link)->next) {
+    block = *link;
+    if (((block->chunk->bo.dma_addr + block->offset) & (align - 1)) == 0) {
+      *link = block->next;
+      fill_buf(buf, block->chunk, block->offset, CLASS_SIZE(c), c);
+      free(block);
+      pool->stats.free_list_hits++;
+      goto done;
+    }
+  }
+
+  // A fresh chunk always fits, unless the backend's BOs aren't page aligned
+  for (int fresh = 0; ; fresh = 1) {
+    if (pool->current != NULL) {
+      addr = pool->current->bo.dma_addr + pool->current_used;
+      offset = pool->current_used + (((addr + align - 1) & ~((uint64_t)align - 1)) - addr);
+      if (offset + CLASS_SIZE(c) <= pool->current->bo.size)
+        break;
+      retire_current(pool);
+      if (fresh) {
+        pthread_mutex_unlock(&pool->lock);
+        return -1;
+      }
+    }
+    pool->current = chunk_create(pool, pool->chunk_size, 0);
+    if (pool->current == NULL) {
+      pthread_mutex_unlock(&pool->lock);
+      return -1;
+    }
+    pool->current_used = 0;
+  }
+  fill_buf(buf, pool->current, offset, CLASS_SIZE(c), c);
+  pool->current_used = offset + CLASS_SIZE(c);
+
+done:
+  buf->requested = size;
+  pool->stats.allocs++;
+  pool->stats.bytes_in_use += buf->size;
+  pool->stats.bytes_requested += size;
+  if (pool->stats.bytes_in_use > pool->stats.peak_in_use)
+    pool->stats.peak_in_use = pool->stats.bytes_in_use;
+  if (c >= 0)
+    pool->stats.class_live[c]++;
+  pthread_mutex_unlock(&pool->lock);
+  return 0;
+}
+
+void npu_pool_free(npu_pool_t *pool, npu_buf_t *buf) {
+
+  if (buf->chunk == NULL)
+    return;
+
+  pthread_mutex_lock(&pool->lock);
+
+  pool->stats.frees++;
+  pool->stats.bytes_in_use -= buf->size;
+  pool->stats.bytes_requested -= buf->requested;
+
+  if (buf->size_class < 0) {
+    chunk_destroy(pool, buf->chunk);
+  } else {
+    pool->stats.class_live[buf->size_class]--;
+    if (push_block(pool, buf->size_class, buf->chunk, buf->offset) < 0)
+      npu_log(NPU_LOG_ERROR, "npu_pool_free: lost a %zu byte block\n", buf->size);
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+  memset(buf, 0, sizeof(*buf));
+}
+
+void npu_pool_get_stats(npu_pool_t *pool, npu_pool_stats_t *stats) {
+
+  pthread_mutex_lock(&pool->lock);
+  *stats = pool->stats;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static int pool_sync(npu_pool_t *pool, const npu_buf_t *buf, size_t offset, size_t size, int to_device) {
+
+  if (((pool->flags & RKNPU_MEM_CACHEABLE) == 0) || (pool->backend.sync == NULL) || (buf->chunk == NULL))
+    return 0;
+  return pool->backend.sync(pool->backend.ctx, &buf->chunk->bo, buf->offset + offset, size, to_device);
+}
+
+int npu_pool_sync_to_device(npu_pool_t *pool, const npu_buf_t *buf, size_t offset, size_t size) {
+  return pool_sync(pool, buf, offset, size, 1);
+}
+
+int npu_pool_sync_from_device(npu_pool_t *pool, const npu_buf_t *buf, size_t offset, size_t size) {
+  return pool_sync(pool, buf, offset, size, 0);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_submit.h"
+#include "npu_log.h"
+#include "npu_profile.h"
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int get_amount(int fd, uint32_t flags, uint64_t *value) {
+
+  struct rknpu_action act = {
+    .flags = flags,
+  };
+  int ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_ACTION, &act);
+  if (ret < 0) {
+    npu_log(NPU_LOG_ERROR, "RKNPU_ACTION %u failed %d\n", flags, ret);
+    return ret;
+  }
+  *value = act.value;
+  return 0;
+}
+
+int npu_profile_clear(int fd) {
+
+  struct rknpu_action act = {
+    .flags = RKNPU_ACT_CLR_TOTAL_RW_AMOUNT,
+  };
+  return npu_ioctl(fd, DRM_IOCTL_RKNPU_ACTION, &act);
+}
+
+int npu_profile_read(int fd, npu_profile_t *prof) {
+
+  if ((get_amount(fd, RKNPU_GET_DT_RD_AMOUNT, &prof->data_read) < 0) ||
+      (get_amount(fd, RKNPU_GET_WT_RD_AMOUNT, &prof->weight_read) < 0) ||
+      (get_amount(fd, RKNPU_GET_DT_WR_AMOUNT, &prof->data_write) < 0) ||
+      (get_amount(fd, RKNPU_GET_TOTAL_RW_AMOUNT, &prof->total_rw) < 0))
+    return -1;
+  return 0;
+}
+
+int npu_submit_profiled(int fd, const npu_job_t *job, npu_profile_t *prof) {
+
+  uint64_t start;
+  int ret;
+
+  memset(prof, 0, sizeof(*prof));
+  if (npu_profile_clear(fd) < 0)
+    return -1;
+
+  start = now_ns();
+  ret = npu_submit(fd, job);
+  prof->wall_us = (now_ns() - start) / 1000.0;
+  if (ret < 0)
+    return ret;
+
+  if (npu_profile_read(fd, prof) < 0)
+    return -1;
+  if (prof->wall_us > 0) {
+    prof->read_gbps = (prof->data_read + prof->weight_read) / (prof->wall_us * 1000.0);
+    prof->write_gbps = prof->data_write / (prof->wall_us * 1000.0);
+  }
+  return 0;
+}
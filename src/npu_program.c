@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_hw.h"
+#include "npu_interface.h"
+#include "npu_matmul.h"
+#include "npu_submit.h"
+#include "npu_log.h"
+#include "npu_program.h"
+
+#define OPS_PER_ALIGN     (NPU_PROGRAM_ALIGN / sizeof(uint64_t))
+// gen_matmul_* write 108 of these, the last 4 are the tail
+#define MATMUL_REGCMD_OPS 112
+#define MATMUL_AMOUNT     (MATMUL_REGCMD_OPS - (RKNPU_PC_DATA_EXTRA_AMOUNT + 4))
+
+void npu_program_init(npu_program_t *p) {
+  memset(p, 0, sizeof(*p));
+}
+
+void npu_program_free(int fd, npu_program_t *p) {
+
+  npu_bo_free(fd, &p->regcmd_bo);
+  npu_bo_free(fd, &p->tasks_bo);
+  free(p->regcmd);
+  free(p->tasks);
+  memset(p, 0, sizeof(*p));
+}
+
+// Keeps the buffers for building the next program
+void npu_program_reset(npu_program_t *p) {
+  p->regcmd_count = 0;
+  p->task_count = 0;
+}
+
+static int reserve(npu_program_t *p, size_t ops) {
+
+  if (p->regcmd_count + ops > p->regcmd_capacity) {
+    size_t capacity = p->regcmd_capacity ? p->regcmd_capacity : 1024;
+    while (capacity < p->regcmd_count + ops)
+      capacity *= 2;
+    uint64_t *regcmd = realloc(p->regcmd, capacity * sizeof(*regcmd));
+    if (regcmd == NULL)
+      return -ENOMEM;
+    p->regcmd = regcmd;
+    p->regcmd_capacity = capacity;
+  }
+
+  if (p->task_count == p->task_capacity) {
+    uint32_t capacity = p->task_capacity ? p->task_capacity * 2 : 16;
+    struct rknpu_task *tasks = realloc(p->tasks, capacity * sizeof(*tasks));
+    if (tasks == NULL)
+      return -ENOMEM;
+    p->tasks = tasks;
+    p->task_capacity = capacity;
+  }
+  return 0;
+}
+
+uint32_t npu_pc_register_amount(uint32_t amount) {
+  return (amount + RKNPU_PC_DATA_EXTRA_AMOUNT + NPU_PC_DATA_AMOUNT_SCALE - 1) / NPU_PC_DATA_AMOUNT_SCALE - 1;
+}
+
+int npu_program_add_task(npu_program_t *p, const uint64_t *ops, uint32_t amount, uint32_t enable_mask, uint32_t int_mask) {
+
+  size_t block = (amount + RKNPU_PC_DATA_EXTRA_AMOUNT + OPS_PER_ALIGN - 1) & ~(OPS_PER_ALIGN - 1);
+  struct rknpu_task *task;
+  uint64_t *dst;
+
+  if (amount == 0)
+    return -EINVAL;
+  if (reserve(p, block) < 0)
+    return -ENOMEM;
+
+  dst = p->regcmd + p->regcmd_count;
+  memcpy(dst, ops, amount * sizeof(uint64_t));
+  // Chain ops are patched by npu_program_layout
+  dst[amount] = NPUOP(OP_NONE, 0x0, 0x0);
+  dst[amount + 1] = NPUOP(OP_REG_PC, 0x0, PC_REGISTER_AMOUNTS);
+  dst[amount + 2] = NPUOP(OP_40, 0x0, 0x0);
+  dst[amount + 3] = NPUOP(OP_ENABLE, enable_mask, PC_OPERATION_ENABLE);
+  memset(dst + amount + RKNPU_PC_DATA_EXTRA_AMOUNT, 0,
+    (block - amount - RKNPU_PC_DATA_EXTRA_AMOUNT) * sizeof(uint64_t));
+
+  task = &p->tasks[p->task_count];
+  memset(task, 0, sizeof(*task));
+  task->op_idx = p->task_count;
+  task->enable_mask = enable_mask;
+  task->int_mask = int_mask;
+  task->int_clear = 0x1ffff;
+  task->regcfg_amount = amount;
+  task->regcfg_offset = p->regcmd_count * sizeof(uint64_t);
+
+  p->regcmd_count += block;
+  p->task_count++;
+  return p->task_count - 1;
+}
+
+static int add_matmul(npu_program_t *p, matmul_params_t *params, const matmul_options_t *opts,
+  int (*gen)(matmul_params_t *, const matmul_options_t *)) {
+
+  uint64_t ops[MATMUL_REGCMD_OPS];
+  uint64_t *saved = params->tasks;
+  int ret;
+
+  params->tasks = ops;
+  ret = gen(params, opts);
+  params->tasks = saved;
+  if (ret != 0)
+    return -EINVAL;
+  // CNA, core and DPU enabled, wait for the DPU to finish
+  return npu_program_add_task(p, ops, MATMUL_AMOUNT, 0xd, 0x300);
+}
+
+int npu_program_add_matmul_fp16(npu_program_t *p, matmul_params_t *params) {
+  return add_matmul(p, params, NULL, gen_matmul_fp16_ex);
+}
+
+int npu_program_add_matmul_int8(npu_program_t *p, matmul_params_t *params) {
+  return add_matmul(p, params, NULL, gen_matmul_int8_ex);
+}
+
+int npu_program_add_matmul_fp16_ex(npu_program_t *p, matmul_params_t *params, const matmul_options_t *opts) {
+  return add_matmul(p, params, opts, gen_matmul_fp16_ex);
+}
+
+int npu_program_add_matmul_int8_ex(npu_program_t *p, matmul_params_t *params, const matmul_options_t *opts) {
+  return add_matmul(p, params, opts, gen_matmul_int8_ex);
+}
+
+size_t npu_program_regcmd_size(const npu_program_t *p) {
+  return p->regcmd_count * sizeof(uint64_t);
+}
+
+size_t npu_program_tasks_size(const npu_program_t *p) {
+  return p->task_count * sizeof(struct rknpu_task);
+}
+
+int npu_program_layout(npu_program_t *p, uint64_t regcmd_dma, uint64_t *regcmd, struct rknpu_task *tasks) {
+
+  if ((p->task_count == 0) || (regcmd_dma % NPU_PROGRAM_ALIGN) != 0)
+    return -EINVAL;
+
+  for (uint32_t i = 0; i < p->task_count; i++)
+    p->tasks[i].regcmd_addr = regcmd_dma + p->tasks[i].regcfg_offset;
+
+  for (uint32_t i = 0; i < p->task_count; i++) {
+    uint64_t *tail = p->regcmd + p->tasks[i].regcfg_offset / sizeof(uint64_t) + p->tasks[i].regcfg_amount;
+    if (i + 1 < p->task_count) {
+      tail[0] = NPUOP(OP_REG_PC, p->tasks[i + 1].regcmd_addr, PC_BASE_ADDRESS);
+      tail[1] = NPUOP(OP_REG_PC, npu_pc_register_amount(p->tasks[i + 1].regcfg_amount), PC_REGISTER_AMOUNTS);
+    } else {
+      tail[0] = NPUOP(OP_NONE, 0x0, 0x0);
+      tail[1] = NPUOP(OP_REG_PC, 0x0, PC_REGISTER_AMOUNTS);
+    }
+  }
+
+  if (regcmd != NULL)
+    memcpy(regcmd, p->regcmd, npu_program_regcmd_size(p));
+  if (tasks != NULL)
+    memcpy(tasks, p->tasks, npu_program_tasks_size(p));
+  return 0;
+}
+
+static int ensure_bo(int fd, npu_bo_t *bo, size_t size, uint32_t flags) {
+
+  if ((bo->map != NULL) && (bo->size >= size))
+    return 0;
+  npu_bo_free(fd, bo);
+  return npu_bo_alloc(fd, size, flags, bo);
+}
+
+int npu_program_finalize(int fd, npu_program_t *p) {
+
+  if (p->task_count == 0)
+    return -EINVAL;
+
+  if ((ensure_bo(fd, &p->regcmd_bo, npu_program_regcmd_size(p), 0) < 0) ||
+      (ensure_bo(fd, &p->tasks_bo, npu_program_tasks_size(p), RKNPU_MEM_KERNEL_MAPPING) < 0)) {
+    npu_log(NPU_LOG_ERROR, "Failed to allocate program buffers\n");
+    return -ENOMEM;
+  }
+  return npu_program_layout(p, p->regcmd_bo.dma_addr, p->regcmd_bo.map, p->tasks_bo.map);
+}
+
+void npu_program_job(const npu_program_t *p, int core, npu_job_t *job) {
+
+  memset(job, 0, sizeof(*job));
+  job->task_obj_addr = p->tasks_bo.obj_addr;
+  job->task_start = 0;
+  job->task_number = p->task_count;
+  job->core_mask = 1 << core;
+  job->flags = RKNPU_JOB_PINGPONG;
+  job->tasks = p->tasks_bo.map;
+}
+
+int npu_program_submit(int fd, const npu_program_t *p, int core) {
+
+  npu_job_t job;
+
+  npu_program_job(p, core, &job);
+  return npu_submit(fd, &job);
+}
+
+void npu_regop_decode(uint64_t op, npu_regop_t *out) {
+  out->op = (op >> 48) & 0xffff;
+  out->value = (op >> 16) & 0xffffffff;
+  out->reg = op & 0xffff;
+}
+
+static const char *block_name(uint16_t op) {
+
+  switch (op) {
+    case OP_NONE:     return "none";
+    case OP_40:       return "op40";
+    case OP_ENABLE:   return "enable";
+    case OP_REG_PC:   return "pc";
+    case OP_REG_CNA:  return "cna";
+    case OP_REG_CORE: return "core";
+    case OP_REG_DPU:  return "dpu";
+    case (BLOCK_DPU_RDMA | PC_OP_01): return "dpu_rdma";
+    case (BLOCK_PPU | PC_OP_01):      return "ppu";
+    case (BLOCK_PPU_RDMA | PC_OP_01): return "ppu_rdma";
+  }
+  return NULL;
+}
+
+/*
+ * Returns 0 if the task array and the PC chain agree, otherwise -(1 + index)
+ * of the first bad task.
+ */
+int npu_program_verify(const uint64_t *regcmd, uint64_t regcmd_dma, size_t regcmd_size,
+  const struct rknpu_task *tasks, uint32_t task_count) {
+
+  uint64_t expect_addr = (task_count > 0) ? tasks[0].regcmd_addr : 0;
+  npu_regop_t op;
+
+  for (uint32_t i = 0; i < task_count; i++) {
+    const struct rknpu_task *t = &tasks[i];
+    const uint64_t *ops;
+    uint64_t offset = t->regcmd_addr - regcmd_dma;
+
+    if ((t->regcmd_addr != expect_addr) || (t->regcmd_addr < regcmd_dma) ||
+        (t->regcmd_addr % NPU_PROGRAM_ALIGN) != 0 || (offset != t->regcfg_offset) ||
+        (offset + (t->regcfg_amount + RKNPU_PC_DATA_EXTRA_AMOUNT) * sizeof(uint64_t) > regcmd_size))
+      return -(1 + i);
+    ops = regcmd + offset / sizeof(uint64_t);
+
+    for (uint32_t j = 0; j < t->regcfg_amount; j++) {
+      npu_regop_decode(ops[j], &op);
+      if (block_name(op.op) == NULL)
+        return -(1 + i);
+    }
+
+    // Tail, the PC follows this to the next task
+    npu_regop_decode(ops[t->regcfg_amount], &op);
+    if (i + 1 < task_count) {
+      if ((op.op != OP_REG_PC) || (op.reg != PC_BASE_ADDRESS))
+        return -(1 + i);
+      expect_addr = op.value;
+    } else if (op.op != OP_NONE) {
+      return -(1 + i);
+    }
+    npu_regop_decode(ops[t->regcfg_amount + 1], &op);
+    if ((op.op != OP_REG_PC) || (op.reg != PC_REGISTER_AMOUNTS) ||
+        (op.value != ((i + 1 < task_count) ? npu_pc_register_amount(tasks[i + 1].regcfg_amount) : 0)))
+      return -(1 + i);
+    npu_regop_decode(ops[t->regcfg_amount + 3], &op);
+    if ((op.op != OP_ENABLE) || (op.reg != PC_OPERATION_ENABLE) || (op.value != t->enable_mask))
+      return -(1 + i);
+  }
+  return 0;
+}
+
+void npu_program_dump(FILE *fp, const uint64_t *regcmd, uint64_t regcmd_dma,
+  const struct rknpu_task *tasks, uint32_t task_count) {
+
+  npu_regop_t op;
+
+  for (uint32_t i = 0; i < task_count; i++) {
+    const struct rknpu_task *t = &tasks[i];
+    const uint64_t *ops = regcmd + (t->regcmd_addr - regcmd_dma) / sizeof(uint64_t);
+
+    fprintf(fp, "task %u regcmd 0x%llx amount %u enable 0x%x int_mask 0x%x\n", i,
+      (unsigned long long)t->regcmd_addr, t->regcfg_amount, t->enable_mask, t->int_mask);
+    for (uint32_t j = 0; j < t->regcfg_amount + RKNPU_PC_DATA_EXTRA_AMOUNT; j++) {
+      const char *name;
+      npu_regop_decode(ops[j], &op);
+      name = block_name(op.op);
+      fprintf(fp, "  %4u %-8s 0x%04x = 0x%08x\n", j, name ? name : "?", op.reg, op.value);
+    }
+  }
+}
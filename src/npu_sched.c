@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "npu_interface.h"
+#include "npu_submit.h"
+#include "npu_log.h"
+#include "npu_sched.h"
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int drm_run(void *ctx, int core, npu_sched_task_t *task) {
+
+  npu_job_t job = task->job;
+
+  // A single core job, npu_submit puts the task range in this core's slot
+  job.core_mask = 1 << core;
+  memset(job.subcore_task, 0, sizeof(job.subcore_task));
+  return npu_submit((int)(intptr_t)ctx, &job);
+}
+
+static int sim_run(void *ctx, int core, npu_sched_task_t *task) {
+  if (task->sim_us > 0)
+    usleep(task->sim_us);
+  return 0;
+}
+
+static void queue_push(struct npu_sched_core *q, npu_sched_task_t *task) {
+
+  task->next = NULL;
+  if (q->tail != NULL)
+    q->tail->next = task;
+  else
+    q->head = task;
+  q->tail = task;
+  q->depth++;
+}
+
+// Removes the first task, or with unpinned set the first one allowed to move
+static npu_sched_task_t *queue_take(struct npu_sched_core *q, int unpinned) {
+
+  npu_sched_task_t *prev = NULL, *task = q->head;
+
+  while ((task != NULL) && unpinned && task->pinned) {
+    prev = task;
+    task = task->next;
+  }
+  if (task == NULL)
+    return NULL;
+
+  if (prev != NULL)
+    prev->next = task->next;
+  else
+    q->head = task->next;
+  if (q->tail == task)
+    q->tail = prev;
+  q->depth--;
+  task->next = NULL;
+  return task;
+}
+
+static int has_unpinned(struct npu_sched_core *q) {
+
+  for (npu_sched_task_t *task = q->head; task != NULL; task = task->next) {
+    if (!task->pinned)
+      return 1;
+  }
+  return 0;
+}
+
+// Victim is the longest other queue that has something allowed to move
+static npu_sched_task_t *steal(npu_sched_t *s, int core) {
+
+  int victim = -1;
+  uint32_t depth = 0;
+
+  for (int c = 0; c < s->num_cores; c++) {
+    if ((c != core) && (s->cores[c].depth > depth) && has_unpinned(&s->cores[c])) {
+      victim = c;
+      depth = s->cores[c].depth;
+    }
+  }
+  if (victim < 0)
+    return NULL;
+  return queue_take(&s->cores[victim], 1);
+}
+
+static void *worker(void *arg) {
+
+  npu_sched_t *s = arg;
+  int core = -1;
+  npu_sched_task_t *task;
+  uint64_t start;
+
+  pthread_mutex_lock(&s->lock);
+  for (int c = 0; c < s->num_cores; c++) {
+    if (pthread_equal(s->cores[c].thread, pthread_self()))
+      core = c;
+  }
+
+  while (!s->stop) {
+    int stolen = 0;
+
+    task = queue_take(&s->cores[core], 0);
+    if ((task == NULL) && ((s->flags & NPU_SCHED_NO_STEAL) == 0)) {
+      task = steal(s, core);
+      stolen = (task != NULL);
+    }
+    if (task == NULL) {
+      pthread_cond_wait(&s->work, &s->lock);
+      continue;
+    }
+
+    s->cores[core].running = 1;
+    s->stats.jobs[core]++;
+    s->stats.stolen[core] += stolen;
+    pthread_mutex_unlock(&s->lock);
+
+    start = now_ns();
+    task->status = s->backend.run(s->backend.ctx, core, task);
+    task->ran_on = core;
+    task->stolen = stolen;
+
+    pthread_mutex_lock(&s->lock);
+    s->stats.busy_ns[core] += now_ns() - start;
+    s->cores[core].running = 0;
+    pthread_mutex_unlock(&s->lock);
+
+    if (task->done != NULL)
+      task->done(task);
+
+    pthread_mutex_lock(&s->lock);
+    s->stats.completed++;
+    if (s->stats.completed == s->stats.submitted)
+      pthread_cond_broadcast(&s->idle);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+int npu_sched_init(npu_sched_t *s, const npu_sched_backend_t *backend, int num_cores, uint32_t flags) {
+
+  memset(s, 0, sizeof(*s));
+  if ((num_cores < 1) || (num_cores > NPU_SCHED_MAX_CORES))
+    return -1;
+
+  s->backend = *backend;
+  s->num_cores = num_cores;
+  s->flags = flags;
+  s->start_ns = now_ns();
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->work, NULL);
+  pthread_cond_init(&s->idle, NULL);
+
+  // Hold the lock so workers see every thread id before looking up their core
+  pthread_mutex_lock(&s->lock);
+  for (int c = 0; c < num_cores; c++) {
+    if (pthread_create(&s->cores[c].thread, NULL, worker, s) != 0) {
+      npu_log(NPU_LOG_ERROR, "Failed to start scheduler thread for core %d\n", c);
+      s->num_cores = c;
+      pthread_mutex_unlock(&s->lock);
+      npu_sched_destroy(s);
+      return -1;
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+  return 0;
+}
+
+int npu_sched_init_drm(npu_sched_t *s, int fd, int num_cores, uint32_t flags) {
+
+  npu_sched_backend_t backend = { .run = drm_run, .ctx = (void *)(intptr_t)fd };
+  return npu_sched_init(s, &backend, num_cores, flags);
+}
+
+int npu_sched_init_sim(npu_sched_t *s, int num_cores, uint32_t flags) {
+
+  npu_sched_backend_t backend = { .run = sim_run, .ctx = NULL };
+  return npu_sched_init(s, &backend, num_cores, flags);
+}
+
+// Queued jobs are finished before the workers exit
+void npu_sched_destroy(npu_sched_t *s) {
+
+  npu_sched_wait_idle(s);
+
+  pthread_mutex_lock(&s->lock);
+  s->stop = 1;
+  pthread_cond_broadcast(&s->work);
+  pthread_mutex_unlock(&s->lock);
+
+  for (int c = 0; c < s->num_cores; c++)
+    pthread_join(s->cores[c].thread, NULL);
+
+  pthread_cond_destroy(&s->idle);
+  pthread_cond_destroy(&s->work);
+  pthread_mutex_destroy(&s->lock);
+}
+
+int npu_sched_submit(npu_sched_t *s, npu_sched_task_t *task) {
+
+  int core = task->core;
+
+  if ((core >= s->num_cores) || (task->pinned && (core < 0)))
+    return -EINVAL;
+
+  pthread_mutex_lock(&s->lock);
+  if (core < 0) {
+    // Shortest queue, counting the job each core is running
+    uint32_t best = UINT32_MAX;
+    for (int c = 0; c < s->num_cores; c++) {
+      uint32_t load = s->cores[c].depth + s->cores[c].running;
+      if (load < best) {
+        best = load;
+        core = c;
+      }
+    }
+  }
+
+  task->ran_on = -1;
+  task->stolen = 0;
+  queue_push(&s->cores[core], task);
+  if (s->cores[core].depth > s->stats.peak_depth[core])
+    s->stats.peak_depth[core] = s->cores[core].depth;
+  s->stats.submitted++;
+  // Wake everyone, an idle core may steal this
+  pthread_cond_broadcast(&s->work);
+  pthread_mutex_unlock(&s->lock);
+  return 0;
+}
+
+void npu_sched_wait_idle(npu_sched_t *s) {
+
+  pthread_mutex_lock(&s->lock);
+  while (s->stats.completed != s->stats.submitted)
+    pthread_cond_wait(&s->idle, &s->lock);
+  pthread_mutex_unlock(&s->lock);
+}
+
+void npu_sched_get_stats(npu_sched_t *s, npu_sched_stats_t *stats) {
+
+  pthread_mutex_lock(&s->lock);
+  *stats = s->stats;
+  stats->elapsed_ns = now_ns() - s->start_ns;
+  for (int c = 0; c < s->num_cores; c++) {
+    stats->queue_depth[c] = s->cores[c].depth;
+    stats->utilisation[c] = stats->elapsed_ns ? (double)stats->busy_ns[c] / stats->elapsed_ns : 0.0;
+  }
+  pthread_mutex_unlock(&s->lock);
+}
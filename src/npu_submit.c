@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_submit.h"
+#include "npu_log.h"
+#include "npu_trace.h"
+
+static uint32_t default_timeout = NPU_SUBMIT_TIMEOUT;
+static npu_submit_stats_t submit_stats;
+
+static void fill_submit(const npu_job_t *job, uint32_t flags, struct rknpu_submit *submit) {
+
+  uint32_t core_mask = job->core_mask ? job->core_mask : 1;
+  int has_subcore = 0;
+
+  memset(submit, 0, sizeof(*submit));
+  submit->flags = RKNPU_JOB_PC | job->flags | flags;
+  submit->timeout = job->timeout ? job->timeout : __atomic_load_n(&default_timeout, __ATOMIC_RELAXED);
+  submit->task_start = job->task_start;
+  submit->task_number = job->task_number;
+  submit->priority = job->priority;
+  submit->task_obj_addr = job->task_obj_addr;
+  submit->core_mask = core_mask;
+  submit->fence_fd = -1;
+
+  for (int i = 0; i < 5; i++) {
+    submit->subcore_task[i] = job->subcore_task[i];
+    has_subcore |= (job->subcore_task[i].task_number != 0);
+  }
+  if (!has_subcore) {
+    int core = __builtin_ctz(core_mask);
+    submit->subcore_task[core].task_start = job->task_start;
+    submit->subcore_task[core].task_number = job->task_number;
+  }
+}
+
+/*
+ * Same grouping of status bits as the driver applies before comparing
+ * against the task int_mask.
+ */
+int npu_int_status_ok(uint32_t int_status, uint32_t int_mask) {
+
+  uint32_t fuzz = 0;
+
+  for (int i = 0; i < 12; i += 2) {
+    if (int_status & (0x3 << i))
+      fuzz |= 0x3 << i;
+  }
+  return fuzz == int_mask;
+}
+
+static void count(uint64_t *counter) {
+  __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+static int check_tasks(const npu_job_t *job, const struct rknpu_submit *submit, int clear) {
+
+  for (int i = 0; i < 5; i++) {
+    const struct rknpu_subcore_task *sub = &submit->subcore_task[i];
+    struct rknpu_task *last;
+
+    if (sub->task_number == 0)
+      continue;
+    last = &job->tasks[sub->task_start + sub->task_number - 1];
+    if (clear) {
+      last->int_status = 0;
+    } else if (!npu_int_status_ok(last->int_status, last->int_mask)) {
+      npu_log(NPU_LOG_ERROR, "task %u int_status 0x%x expected 0x%x\n",
+        sub->task_start + sub->task_number - 1, last->int_status, last->int_mask);
+      return -EIO;
+    }
+  }
+  return 0;
+}
+
+static int submit_once(int fd, const npu_job_t *job, struct rknpu_submit *submit) {
+
+  uint64_t trace = NPU_TRACE_BEGIN();
+  int ret;
+
+  count(&submit_stats.submits);
+  // A stale status from an earlier run must not pass for this one
+  if (job->tasks != NULL)
+    check_tasks(job, submit, 1);
+
+  ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_SUBMIT, submit);
+  // Blocking, so the span covers execution
+  NPU_TRACE_END(npu_trace_submit, trace, job->task_number);
+
+  if (ret < 0) {
+    if ((errno == ETIMEDOUT) || (errno == ETIME)) {
+      count(&submit_stats.timeouts);
+      npu_log(NPU_LOG_ERROR, "RKNPU_SUBMIT timed out after %u ms\n", submit->timeout);
+      return -ETIMEDOUT;
+    }
+    return ret;
+  }
+  if ((job->tasks != NULL) && (check_tasks(job, submit, 0) < 0)) {
+    count(&submit_stats.faults);
+    return -EIO;
+  }
+  return 0;
+}
+
+int npu_submit(int fd, const npu_job_t *job) {
+
+  struct rknpu_submit submit;
+  int ret;
+
+  for (uint32_t attempt = 0; ; attempt++) {
+    fill_submit(job, RKNPU_JOB_BLOCK, &submit);
+    ret = submit_once(fd, job, &submit);
+    if ((ret != -ETIMEDOUT) && (ret != -EIO))
+      return ret;
+
+    count(&submit_stats.resets);
+    if (npu_reset(fd) < 0)
+      npu_log(NPU_LOG_ERROR, "npu_reset failed\n");
+
+    if (attempt >= job->retries) {
+      count(&submit_stats.failures);
+      return ret;
+    }
+    count(&submit_stats.retries);
+    npu_log(NPU_LOG_INFO, "retrying job, attempt %u of %u\n", attempt + 2, job->retries + 1);
+  }
+}
+
+// Used for jobs that leave npu_job_t.timeout at 0
+void npu_set_submit_timeout(uint32_t timeout_ms) {
+  __atomic_store_n(&default_timeout, timeout_ms ? timeout_ms : NPU_SUBMIT_TIMEOUT, __ATOMIC_RELAXED);
+}
+
+void npu_get_submit_stats(npu_submit_stats_t *stats) {
+  stats->submits = __atomic_load_n(&submit_stats.submits, __ATOMIC_RELAXED);
+  stats->timeouts = __atomic_load_n(&submit_stats.timeouts, __ATOMIC_RELAXED);
+  stats->faults = __atomic_load_n(&submit_stats.faults, __ATOMIC_RELAXED);
+  stats->resets = __atomic_load_n(&submit_stats.resets, __ATOMIC_RELAXED);
+  stats->retries = __atomic_load_n(&submit_stats.retries, __ATOMIC_RELAXED);
+  stats->failures = __atomic_load_n(&submit_stats.failures, __ATOMIC_RELAXED);
+}
+
+void npu_clear_submit_stats(void) {
+  __atomic_store_n(&submit_stats.submits, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&submit_stats.timeouts, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&submit_stats.faults, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&submit_stats.resets, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&submit_stats.retries, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&submit_stats.failures, 0, __ATOMIC_RELAXED);
+}
+
+int npu_submit_async(int fd, const npu_job_t *job, int in_fence, int *out_fence) {
+
+  struct rknpu_submit submit;
+  uint64_t trace = NPU_TRACE_BEGIN();
+  int ret;
+
+  *out_fence = -1;
+  fill_submit(job, RKNPU_JOB_NONBLOCK | RKNPU_JOB_FENCE_OUT, &submit);
+  if (in_fence >= 0) {
+    submit.flags |= RKNPU_JOB_FENCE_IN;
+    submit.fence_fd = in_fence;
+  }
+
+  ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_SUBMIT, &submit);
+  if (ret < 0) {
+    npu_log(NPU_LOG_ERROR, "RKNPU_SUBMIT (async) failed %d\n", ret);
+    return ret;
+  }
+  *out_fence = submit.fence_fd;
+  NPU_TRACE_END(npu_trace_submit, trace, job->task_number);
+  return 0;
+}
+
+/*
+ * Returns 0 once signalled, -ETIME if timeout_ms (-1 waits forever) expires.
+ */
+int npu_fence_wait(int fence_fd, int timeout_ms) {
+
+  struct pollfd pfd = { .fd = fence_fd, .events = POLLIN };
+  uint64_t trace = (timeout_ms != 0) ? NPU_TRACE_BEGIN() : 0;
+  int ret;
+
+  do {
+    ret = poll(&pfd, 1, timeout_ms);
+  } while ((ret < 0) && (errno == EINTR));
+  NPU_TRACE_END(npu_trace_wait, trace, fence_fd);
+
+  if (ret < 0)
+    return -errno;
+  if (ret == 0)
+    return -ETIME;
+  if (pfd.revents & (POLLERR | POLLNVAL))
+    return -EINVAL;
+  return 0;
+}
+
+// 1 if signalled, 0 if still pending
+int npu_fence_poll(int fence_fd) {
+
+  int ret = npu_fence_wait(fence_fd, 0);
+  if (ret == -ETIME)
+    return 0;
+  return (ret == 0) ? 1 : ret;
+}
+
+void npu_fence_close(int fence_fd) {
+  if (fence_fd >= 0)
+    close(fence_fd);
+}
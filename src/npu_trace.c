@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "npu_trace.h"
+
+typedef struct {
+  uint64_t  start_ns;
+  uint64_t  dur_ns;
+  uint64_t  arg;
+  uint32_t  event;
+} trace_event_t;
+
+/*
+ * Only the owning thread writes events and head, readers load head with
+ * acquire. Rings are never freed so a dump can still read the events of a
+ * thread that has exited.
+ */
+typedef struct trace_ring {
+  trace_event_t      events[NPU_TRACE_RING_SIZE];
+  uint64_t           head;
+  uint64_t           tail;    // events before this were cleared
+  int                tid;
+  struct trace_ring  *next;
+} trace_ring_t;
+
+int npu_trace_on = 0;
+
+static trace_ring_t *rings = NULL;
+static __thread trace_ring_t *local_ring = NULL;
+static char *exit_path = NULL;
+
+static const char *event_names[npu_trace_events] = {
+  [npu_trace_alloc]  = "alloc",
+  [npu_trace_pack]   = "pack",
+  [npu_trace_regcmd] = "regcmd",
+  [npu_trace_submit] = "submit",
+  [npu_trace_wait]   = "wait",
+  [npu_trace_unpack] = "unpack",
+};
+
+static void trace_at_exit(void) {
+  npu_trace_dump(exit_path);
+}
+
+__attribute__((constructor))
+static void trace_init(void) {
+
+  const char *env = getenv("RKNPU_TRACE");
+
+  if ((env == NULL) || (*env == '\0'))
+    return;
+  exit_path = strdup(env);
+  if ((exit_path == NULL) || (atexit(trace_at_exit) != 0))
+    return;
+  npu_trace_enable(1);
+}
+
+static trace_ring_t *get_ring(void) {
+
+  trace_ring_t *ring = local_ring;
+
+  if (ring != NULL)
+    return ring;
+
+  ring = calloc(1, sizeof(*ring));
+  if (ring == NULL)
+    return NULL;
+  ring->tid = syscall(SYS_gettid);
+  ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  local_ring = ring;
+  return ring;
+}
+
+void npu_trace_enable(int enable) {
+  __atomic_store_n(&npu_trace_on, enable ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+uint64_t npu_trace_now(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void npu_trace_record(int event, uint64_t start_ns, uint64_t arg) {
+
+  uint64_t end_ns = npu_trace_now();
+  trace_ring_t *ring = get_ring();
+  trace_event_t *e;
+  uint64_t head;
+
+  if ((ring == NULL) || (event < 0) || (event >= npu_trace_events))
+    return;
+
+  head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  e = &ring->events[head & (NPU_TRACE_RING_SIZE - 1)];
+  e->start_ns = start_ns;
+  e->dur_ns = end_ns - start_ns;
+  e->arg = arg;
+  e->event = event;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void ring_range(trace_ring_t *ring, uint64_t *first, uint64_t *last) {
+
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+  if (head - tail > NPU_TRACE_RING_SIZE)
+    tail = head - NPU_TRACE_RING_SIZE;
+  *first = tail;
+  *last = head;
+}
+
+// Events currently held, across all threads
+uint32_t npu_trace_count(void) {
+
+  uint32_t count = 0;
+  uint64_t first, last;
+
+  for (trace_ring_t *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+    ring_range(r, &first, &last);
+    count += last - first;
+  }
+  return count;
+}
+
+void npu_trace_clear(void) {
+
+  for (trace_ring_t *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+    __atomic_store_n(&r->tail, __atomic_load_n(&r->head, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+}
+
+int npu_trace_write(FILE *fp) {
+
+  int pid = getpid();
+  int count = 0;
+  uint64_t first, last;
+
+  fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  for (trace_ring_t *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+    ring_range(r, &first, &last);
+    for (uint64_t i = first; i < last; i++) {
+      const trace_event_t *e = &r->events[i & (NPU_TRACE_RING_SIZE - 1)];
+      fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"npu\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+        "\"pid\":%d,\"tid\":%d,\"args\":{\"arg\":%llu}}", count ? "," : "",
+        event_names[e->event], e->start_ns / 1000.0, e->dur_ns / 1000.0, pid, r->tid,
+        (unsigned long long)e->arg);
+      count++;
+    }
+  }
+  fprintf(fp, "\n]}\n");
+  return ferror(fp) ? -1 : count;
+}
+
+// Returns the number of events written or -1
+int npu_trace_dump(const char *path) {
+
+  FILE *fp = fopen(path, "w");
+  int ret;
+
+  if (fp == NULL)
+    return -1;
+  ret = npu_trace_write(fp);
+  if (fclose(fp) != 0)
+    ret = -1;
+  return ret;
+}
+
+const char *npu_trace_event_name(int event) {
+  if ((event < 0) || (event >= npu_trace_events))
+    return NULL;
+  return event_names[event];
+}
@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_hw.h"
+#include "npu_matmul.h"
+#include "npu_log.h"
+#include "npu_weights.h"
+
+static int write_padding(npu_weights_writer_t *w, uint64_t align) {
+
+  static const uint8_t zeros[NPU_WEIGHTS_ALIGN];
+  uint64_t pad = (align - (w->pos % align)) % align;
+
+  if ((pad > 0) && (fwrite(zeros, 1, pad, w->fp) != pad))
+    return -1;
+  w->pos += pad;
+  return 0;
+}
+
+int npu_weights_writer_open(npu_weights_writer_t *w, const char *path) {
+
+  npu_weights_header_t header;
+
+  memset(w, 0, sizeof(*w));
+  w->fp = fopen(path, "wb");
+  if (w->fp == NULL) {
+    npu_log(NPU_LOG_ERROR, "Failed to create %s\n", path);
+    return -1;
+  }
+
+  // Placeholder, rewritten once the table offset is known
+  memset(&header, 0, sizeof(header));
+  if (fwrite(&header, sizeof(header), 1, w->fp) != 1) {
+    fclose(w->fp);
+    w->fp = NULL;
+    return -1;
+  }
+  w->pos = sizeof(header);
+  return 0;
+}
+
+/*
+ * Pack a row-major N x K tensor and append it to the file.
+ */
+int npu_weights_writer_add(npu_weights_writer_t *w, const char *name, int precision, int N, int K, const void *src) {
+
+  npu_weights_entry_t *e;
+  size_t size;
+  void *packed;
+
+  if ((N <= 0) || (K <= 0) || (strlen(name) >= NPU_WEIGHTS_NAME_LEN))
+    return -1;
+
+  if (precision == precision_float16) {
+    size = weight_size_fp16(N, K);
+  } else if (precision == precision_int8) {
+    size = weight_size_int8(N, K);
+  } else {
+    return -1;
+  }
+
+  if (w->count == w->capacity) {
+    uint32_t capacity = w->capacity ? w->capacity * 2 : 16;
+    npu_weights_entry_t *entries = realloc(w->entries, capacity * sizeof(*entries));
+    if (entries == NULL)
+      return -1;
+    w->entries = entries;
+    w->capacity = capacity;
+  }
+
+  packed = malloc(size);
+  if (packed == NULL)
+    return -1;
+
+  if (precision == precision_float16) {
+    pack_weight_fp16(N, K, src, packed);
+  } else {
+    pack_weight_int8(N, K, src, packed);
+  }
+
+  if (write_padding(w, NPU_WEIGHTS_ALIGN) < 0) {
+    free(packed);
+    return -1;
+  }
+
+  e = &w->entries[w->count];
+  memset(e, 0, sizeof(*e));
+  strcpy(e->name, name);
+  e->precision = precision;
+  e->layout = (precision == precision_float16) ? npu_layout_weight_fp16 : npu_layout_weight_int8;
+  e->n = N;
+  e->k = K;
+  e->offset = w->pos;
+  e->size = size;
+
+  if (fwrite(packed, 1, size, w->fp) != size) {
+    free(packed);
+    return -1;
+  }
+  free(packed);
+
+  w->pos += size;
+  w->count++;
+  return 0;
+}
+
+int npu_weights_writer_close(npu_weights_writer_t *w) {
+
+  npu_weights_header_t header;
+  int ret = 0;
+
+  if (w->fp == NULL)
+    return -1;
+
+  if (write_padding(w, sizeof(uint64_t)) < 0)
+    ret = -1;
+
+  memset(&header, 0, sizeof(header));
+  header.magic = NPU_WEIGHTS_MAGIC;
+  header.version = NPU_WEIGHTS_VERSION;
+  header.tensor_count = w->count;
+  header.alignment = NPU_WEIGHTS_ALIGN;
+  header.table_offset = w->pos;
+  header.file_size = w->pos + (uint64_t)w->count * sizeof(npu_weights_entry_t);
+
+  if ((ret == 0) && (w->count > 0) &&
+      (fwrite(w->entries, sizeof(npu_weights_entry_t), w->count, w->fp) != w->count))
+    ret = -1;
+
+  if ((ret == 0) && ((fseek(w->fp, 0, SEEK_SET) != 0) ||
+      (fwrite(&header, sizeof(header), 1, w->fp) != 1)))
+    ret = -1;
+
+  if (fclose(w->fp) != 0)
+    ret = -1;
+
+  free(w->entries);
+  memset(w, 0, sizeof(*w));
+  return ret;
+}
+
+// The table comes from the file, an entry is only trusted once its payload size matches its shape
+static int entry_valid(const npu_weights_entry_t *e) {
+
+  if ((e->n == 0) || (e->k == 0) || (e->n > INT32_MAX - 31) || (e->k > INT32_MAX - 31))
+    return 0;
+  if ((e->precision == precision_float16) && (e->layout == npu_layout_weight_fp16))
+    return e->size == weight_size_fp16(e->n, e->k);
+  if ((e->precision == precision_int8) && (e->layout == npu_layout_weight_int8))
+    return e->size == weight_size_int8(e->n, e->k);
+  return 0;
+}
+
+int npu_weights_open(npu_weights_file_t *f, const char *path) {
+
+  const npu_weights_header_t *h;
+  struct stat st;
+
+  memset(f, 0, sizeof(*f));
+  f->fd = open(path, O_RDONLY);
+  if (f->fd < 0) {
+    npu_log(NPU_LOG_ERROR, "Failed to open %s\n", path);
+    return -1;
+  }
+
+  if ((fstat(f->fd, &st) < 0) || (st.st_size < (off_t)sizeof(npu_weights_header_t)))
+    goto fail;
+
+  f->size = st.st_size;
+  f->map = mmap(NULL, f->size, PROT_READ, MAP_SHARED, f->fd, 0);
+  if (f->map == MAP_FAILED) {
+    f->map = NULL;
+    goto fail;
+  }
+  madvise(f->map, f->size, MADV_SEQUENTIAL);
+
+  h = f->map;
+  if ((h->magic != NPU_WEIGHTS_MAGIC) || (h->version != NPU_WEIGHTS_VERSION) ||
+      (h->alignment == 0) || ((h->alignment & (h->alignment - 1)) != 0) || (h->file_size > f->size) || (h->table_offset > h->file_size) ||
+      ((h->file_size - h->table_offset) / sizeof(npu_weights_entry_t) < h->tensor_count)) {
+    npu_log(NPU_LOG_ERROR, "%s is not a valid weights file\n", path);
+    goto fail;
+  }
+
+  f->header = h;
+  f->entries = (const npu_weights_entry_t *)((const uint8_t *)f->map + h->table_offset);
+
+  for (uint32_t i = 0; i < h->tensor_count; i++) {
+    const npu_weights_entry_t *e = &f->entries[i];
+    if ((e->offset % h->alignment) != 0 || (e->offset > h->table_offset) ||
+        (e->size > h->table_offset - e->offset)) {
+      npu_log(NPU_LOG_ERROR, "%s tensor %u is out of bounds\n", path, i);
+      goto fail;
+    }
+    if (!entry_valid(e)) {
+      npu_log(NPU_LOG_ERROR, "%s tensor %u has an invalid type or size\n", path, i);
+      goto fail;
+    }
+  }
+  return 0;
+
+fail:
+  npu_weights_close(f);
+  return -1;
+}
+
+void npu_weights_close(npu_weights_file_t *f) {
+
+  if (f->map != NULL)
+    munmap(f->map, f->size);
+  if (f->fd >= 0)
+    close(f->fd);
+  memset(f, 0, sizeof(*f));
+  f->fd = -1;
+}
+
+const npu_weights_entry_t *npu_weights_find(const npu_weights_file_t *f, const char *name) {
+
+  for (uint32_t i = 0; i < f->header->tensor_count; i++) {
+    if (strncmp(f->entries[i].name, name, NPU_WEIGHTS_NAME_LEN) == 0)
+      return &f->entries[i];
+  }
+  return NULL;
+}
+
+const void *npu_weights_payload(const npu_weights_file_t *f, const npu_weights_entry_t *e) {
+  return (const uint8_t *)f->map + e->offset;
+}
+
+/*
+ * The rknpu driver can't wrap user memory, so the payload is copied straight
+ * from the page cache into a new BO. No repacking is needed. The BO is mapped
+ * cacheable so the copy runs at full speed, then flushed once.
+ */
+int npu_weights_upload(int fd, const npu_weights_file_t *f, const npu_weights_entry_t *e, npu_bo_t *bo) {
+
+  if (npu_bo_alloc(fd, e->size, RKNPU_MEM_CACHEABLE, bo) < 0)
+    return -1;
+  memcpy(bo->map, npu_weights_payload(f, e), e->size);
+  if (npu_bo_sync_to_device(fd, bo, 0, e->size) < 0) {
+    npu_bo_free(fd, bo);
+    return -1;
+  }
+  return 0;
+}
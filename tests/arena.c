@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "npu_arena.h"
+#include "npu_test.h"
+
+// Arena placement over hand made and random lifetimes: blocks that are live
+// together never share bytes, offsets are aligned and the peak lands on the
+// live set where it should. No NPU required.
+
+static int valid(const npu_arena_block_t *b, int count, size_t align, const npu_arena_stats_t *stats) {
+
+  int errors = 0;
+
+  for (int i = 0; i < count; i++) {
+    errors += check((b[i].offset % align) == 0, "aligned offset");
+    errors += check(b[i].offset + b[i].size <= stats->peak, "inside the arena");
+    for (int j = i + 1; j < count; j++) {
+      int live = (b[i].first <= b[j].last) && (b[j].first <= b[i].last);
+      int shared = (b[i].offset < b[j].offset + b[j].size) && (b[j].offset < b[i].offset + b[i].size);
+      if (live && shared) {
+        printf("blocks %d and %d are live together and overlap\n", i, j);
+        errors++;
+      }
+    }
+  }
+  errors += check(stats->live <= stats->peak, "peak covers the live set");
+  errors += check(stats->peak <= stats->naive, "no worse than naive");
+  return errors;
+}
+
+int main(int argc, char **argv) {
+
+  npu_arena_block_t b[64];
+  npu_arena_stats_t stats;
+  int errors = 0;
+
+  // An MLP chain, each activation read by the next layer only: two buffers
+  // ping-pong whatever the depth
+  for (int i = 0; i < 8; i++) {
+    b[i].size = 4096;
+    b[i].first = i - 1;
+    b[i].last = i;
+  }
+  b[7].last = 8;
+  errors += check(npu_arena_plan(b, 8, 64, &stats) == 0, "plan chain");
+  errors += valid(b, 8, 64, &stats);
+  errors += check(stats.peak == 2 * 4096, "chain ping-pongs");
+  errors += check(stats.naive == 8 * 4096, "chain naive");
+  npu_arena_report(b, 8, &stats, stdout);
+
+  // Taking the big middle block first lets the small ones share its far side,
+  // in order of first use the third block would stack on top of the first
+  b[0] = (npu_arena_block_t){ .size = 100, .first = 0, .last = 1 };
+  b[1] = (npu_arena_block_t){ .size = 200, .first = 1, .last = 2 };
+  b[2] = (npu_arena_block_t){ .size = 100, .first = 2, .last = 3 };
+  errors += check(npu_arena_plan(b, 3, 64, &stats) == 0, "plan three");
+  errors += valid(b, 3, 64, &stats);
+  errors += check(stats.peak == 384 && stats.live == 384, "peak is the live set");
+  errors += check(b[0].offset == b[2].offset, "small blocks share");
+
+  // A residual that stays live across the block it skips
+  for (int i = 0; i < 6; i++) {
+    b[i].size = 1000 + 100 * i;
+    b[i].first = i;
+    b[i].last = i + 1;
+  }
+  b[1].last = 5;
+  errors += check(npu_arena_plan(b, 6, 256, &stats) == 0, "plan residual");
+  errors += valid(b, 6, 256, &stats);
+
+  // Random lifetimes and sizes
+  srand(1);
+  for (int round = 0; round < 200; round++) {
+    int count = 1 + rand() % 64;
+    for (int i = 0; i < count; i++) {
+      b[i].size = 1 + rand() % 100000;
+      b[i].first = rand() % 40 - 1;
+      b[i].last = b[i].first + rand() % 10;
+    }
+    errors += check(npu_arena_plan(b, count, 64, &stats) == 0, "plan random");
+    errors += valid(b, count, 64, &stats);
+    if (errors)
+      break;
+  }
+
+  errors += check(npu_arena_plan(b, 4, 48, &stats) == -EINVAL, "align not a power of two");
+  errors += check(npu_arena_plan(b, 0, 64, &stats) == 0 && stats.peak == 0, "empty");
+
+  return npu_test_done(errors, "arena");
+}
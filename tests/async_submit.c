@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_submit.h"
+#include "npu_standin.h"
+#include "npu_test.h"
+
+// Async submit and fences against the stand-in device, no /dev/dri needed.
+
+#define DELAY_MS 100
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+int main(int argc, char **argv) {
+
+  npu_job_t job;
+  npu_standin_stats_t stats;
+  int fence, fence_a, fence_b, fences[4];
+  int errors = 0;
+  double start, elapsed;
+
+  int fd = npu_standin_open(DELAY_MS);
+  if (fd < 0) {
+    printf("npu_standin_open failed\n");
+    return -1;
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.task_obj_addr = 0x1000;
+  job.task_number = 1;
+
+  // Submit returns straight away, the fence signals once the job is done
+  start = now_ms();
+  errors += check(npu_submit_async(fd, &job, -1, &fence) == 0, "async submit");
+  elapsed = now_ms() - start;
+  errors += check(elapsed < DELAY_MS / 2, "async submit does not block");
+  errors += check(fence >= 0, "out fence returned");
+  errors += check(npu_fence_poll(fence) == 0, "fence pending");
+  errors += check(npu_fence_wait(fence, 10) == -ETIME, "short wait times out");
+  errors += check(npu_fence_wait(fence, -1) == 0, "fence wait");
+  errors += check(npu_fence_poll(fence) == 1, "fence signalled");
+  npu_fence_close(fence);
+
+  npu_standin_get_stats(&stats);
+  errors += check((stats.last_submit.flags & (RKNPU_JOB_NONBLOCK | RKNPU_JOB_FENCE_OUT | RKNPU_JOB_PC)) ==
+    (RKNPU_JOB_NONBLOCK | RKNPU_JOB_FENCE_OUT | RKNPU_JOB_PC), "async flags");
+  errors += check((stats.last_submit.flags & RKNPU_JOB_FENCE_IN) == 0, "no in fence");
+  errors += check(stats.last_submit.timeout == NPU_SUBMIT_TIMEOUT, "default timeout");
+  errors += check(stats.last_submit.core_mask == 1, "default core");
+  errors += check(stats.last_submit.subcore_task[0].task_number == 1, "subcore task filled");
+
+  // Blocking submit keeps the old behaviour
+  job.core_mask = 4;
+  errors += check(npu_submit(fd, &job) == 0, "blocking submit");
+  npu_standin_get_stats(&stats);
+  errors += check((stats.last_submit.flags & RKNPU_JOB_NONBLOCK) == 0, "blocking flags");
+  errors += check(stats.last_submit.subcore_task[2].task_number == 1, "subcore task for core 2");
+  job.core_mask = 0;
+
+  // B waits on A even though A is slower, A's fence can be closed right away
+  job.task_obj_addr = 0xa000;
+  errors += check(npu_submit_async(fd, &job, -1, &fence_a) == 0, "submit A");
+  npu_standin_set_delay(0);
+  job.task_obj_addr = 0xb000;
+  errors += check(npu_submit_async(fd, &job, fence_a, &fence_b) == 0, "submit B after A");
+  npu_standin_get_stats(&stats);
+  errors += check((stats.last_submit.flags & RKNPU_JOB_FENCE_IN) != 0, "in fence flag");
+  errors += check(stats.last_submit.fence_fd == fence_a, "in fence passed");
+  npu_fence_close(fence_a);
+  errors += check(npu_fence_wait(fence_b, 1000) == 0, "wait B");
+  npu_fence_close(fence_b);
+  npu_standin_get_stats(&stats);
+  errors += check((stats.completed == 4) && (stats.order[2] == 0xa000) && (stats.order[3] == 0xb000),
+    "A completes before B");
+
+  // Independent jobs overlap, the host is free while they run
+  npu_standin_set_delay(DELAY_MS);
+  start = now_ms();
+  for (int i = 0; i < 4; i++) {
+    job.task_obj_addr = 0x10000 * (i + 1);
+    errors += check(npu_submit_async(fd, &job, -1, &fences[i]) == 0, "submit batch");
+  }
+  for (int i = 0; i < 4; i++) {
+    errors += check(npu_fence_wait(fences[i], 1000) == 0, "wait batch");
+    npu_fence_close(fences[i]);
+  }
+  elapsed = now_ms() - start;
+  npu_standin_get_stats(&stats);
+  errors += check(stats.max_in_flight == 4, "jobs in flight together");
+  printf("4 x %d ms jobs completed in %.1f ms\n", DELAY_MS, elapsed);
+
+  npu_standin_close(fd);
+
+  return npu_test_done(errors, "async submit");
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include "npu_interface.h"
+#include "npu_context.h"
+#include "npu_matmul.h"
+#include "npu_attention.h"
+#include "npu_emu.h"
+#include "npu_test.h"
+
+// Attention and the KV cache against a double precision reference on the
+// emulator backend.
+
+static void reference(const _Float16 *q, const _Float16 *k, const _Float16 *v, double *o,
+  int Lq, int Lk, int d, float scale, int causal) {
+
+  double *p = malloc(Lk * sizeof(double));
+
+  for (int i = 0; i < Lq; i++) {
+    int n = causal ? i + Lk - Lq + 1 : Lk;
+    double max = -INFINITY, sum = 0;
+    for (int j = 0; j < n; j++) {
+      double dot = 0;
+      for (int c = 0; c < d; c++)
+        dot += (double)q[i * d + c] * (double)k[j * d + c];
+      p[j] = dot * scale;
+      max = (p[j] > max) ? p[j] : max;
+    }
+    for (int j = 0; j < n; j++) {
+      p[j] = exp(p[j] - max);
+      sum += p[j];
+    }
+    for (int c = 0; c < d; c++) {
+      double acc = 0;
+      for (int j = 0; j < n; j++)
+        acc += p[j] / sum * (double)v[j * d + c];
+      o[i * d + c] = acc;
+    }
+  }
+  free(p);
+}
+
+// Error is dominated by P being rounded to fp16 before P V
+static int run(npu_context_t *ctx, int Lq, int Lk, int d, int causal, int seed) {
+
+  _Float16 *q = malloc(Lq * d * sizeof(_Float16)), *k = malloc(Lk * d * sizeof(_Float16));
+  _Float16 *v = malloc(Lk * d * sizeof(_Float16));
+  float *o = malloc(Lq * d * sizeof(float));
+  double *ref = malloc(Lq * d * sizeof(double)), worst = 0;
+  float scale = 1.0f / sqrtf(d);
+  int errors = 0;
+
+  srand(seed);
+  for (int i = 0; i < Lq * d; i++)
+    q[i] = (_Float16)((rand() % 2001 - 1000) / 500.0f);
+  for (int i = 0; i < Lk * d; i++) {
+    k[i] = (_Float16)((rand() % 2001 - 1000) / 500.0f);
+    v[i] = (_Float16)((rand() % 2001 - 1000) / 1000.0f);
+  }
+
+  reference(q, k, v, ref, Lq, Lk, d, scale, causal);
+  errors += check(npu_attention(ctx, q, k, v, o, Lq, Lk, d, scale, causal) == 0, "attention");
+  for (int i = 0; i < Lq * d; i++)
+    worst = (fabs(o[i] - ref[i]) > worst) ? fabs(o[i] - ref[i]) : worst;
+  if (worst > 2e-3) {
+    printf("%d x %d x %d causal %d: max error %g\n", Lq, Lk, d, causal, worst);
+    errors++;
+  }
+  free(q);
+  free(k);
+  free(v);
+  free(o);
+  free(ref);
+  return errors;
+}
+
+static double max_error(const float *o, const double *ref, int count) {
+
+  double worst = 0;
+
+  for (int i = 0; i < count; i++)
+    worst = (fabs(o[i] - ref[i]) > worst) ? fabs(o[i] - ref[i]) : worst;
+  return worst;
+}
+
+// Prefill then token by token decode, checked against the host copy of K and V
+static int run_cache(npu_context_t *ctx, int d, int capacity, int prefill, int steps) {
+
+  npu_kv_cache_t kv;
+  int total = prefill + steps;
+  _Float16 *k, *v, *q = malloc(prefill * d * sizeof(_Float16)), *vt, *packed;
+  float *o = malloc(prefill * d * sizeof(float)), scale = 1.0f / sqrtf(d);
+  double *ref = malloc(prefill * d * sizeof(double));
+  int errors = 0;
+
+  errors += check(npu_kv_cache_init(ctx, &kv, d, capacity) == 0, "cache init");
+  errors += check(kv.capacity >= capacity && (kv.capacity % NPU_ATTN_LK_ALIGN) == 0, "capacity rounded");
+  k = calloc(kv.capacity * d, sizeof(_Float16));
+  v = calloc(kv.capacity * d, sizeof(_Float16));
+  for (int i = 0; i < total * d; i++) {
+    k[i] = (_Float16)((rand() % 2001 - 1000) / 500.0f);
+    v[i] = (_Float16)((rand() % 2001 - 1000) / 1000.0f);
+  }
+
+  for (int i = 0; i < prefill * d; i++)
+    q[i] = (_Float16)((rand() % 2001 - 1000) / 500.0f);
+  errors += check(npu_kv_cache_append(&kv, k, v, prefill) == 0 && kv.len == prefill, "prefill append");
+  errors += check(npu_attention_kv(ctx, q, &kv, o, prefill, scale, 1) == 0, "prefill attention");
+  reference(q, k, v, ref, prefill, prefill, d, scale, 1);
+  if (max_error(o, ref, prefill * d) > 2e-3) {
+    printf("prefill %d: max error %g\n", prefill, max_error(o, ref, prefill * d));
+    errors++;
+  }
+
+  uint32_t plans = ctx->plan_count;
+  for (int t = prefill; t < total; t++) {
+    errors += check(npu_kv_cache_append(&kv, k + t * d, v + t * d, 1) == 0, "decode append");
+    for (int i = 0; i < d; i++)
+      q[i] = (_Float16)((rand() % 2001 - 1000) / 500.0f);
+    errors += check(npu_attention_kv(ctx, q, &kv, o, 1, scale, 1) == 0, "decode attention");
+    reference(q, k, v, ref, 1, t + 1, d, scale, 1);
+    if (max_error(o, ref, d) > 2e-3) {
+      printf("decode %d: max error %g\n", t + 1, max_error(o, ref, d));
+      errors++;
+    }
+  }
+  errors += check(ctx->plan_count - plans <= 2 * ((total - 1) / NPU_ATTN_LK_ALIGN - (prefill - 1) / NPU_ATTN_LK_ALIGN + 1),
+    "decode plans per bucket only");
+
+  // The cache holds exactly what packing the whole of K and V^T would give
+  vt = calloc(d * kv.capacity, sizeof(_Float16));
+  for (int t = 0; t < total; t++) {
+    for (int c = 0; c < d; c++)
+      vt[c * kv.capacity + t] = v[t * d + c];
+  }
+  packed = malloc(weight_size_fp16(kv.capacity, d));
+  pack_weight_fp16(kv.capacity, d, k, packed);
+  errors += check(memcmp(packed, kv.k.map, weight_size_fp16(kv.capacity, d)) == 0, "K layout");
+  free(packed);
+  packed = malloc(weight_size_fp16(d, kv.capacity));
+  pack_weight_fp16(d, kv.capacity, vt, packed);
+  errors += check(memcmp(packed, kv.v.map, weight_size_fp16(d, kv.capacity)) == 0, "V layout");
+  free(packed);
+  free(vt);
+
+  errors += check(npu_kv_cache_append(&kv, k, v, kv.capacity - total + 1) == -ENOSPC, "append past capacity");
+  npu_kv_cache_reset(&kv);
+  errors += check(kv.len == 0, "reset");
+  npu_kv_cache_destroy(&kv);
+  free(k);
+  free(v);
+  free(q);
+  free(o);
+  free(ref);
+  return errors;
+}
+
+int main(int argc, char **argv) {
+
+  npu_context_t ctx;
+  float s[2 * 5] = { 1, 2, 3, 4, 5, 5, 4, 3, 2, 1 };
+  _Float16 p[2 * 6];
+  int errors = 0;
+
+  // Masked columns are zero and the rest sums to one
+  memset(p, 0x55, sizeof(p));
+  npu_softmax_fp16(s, 5, 2, 5, 1.0f, 3, p, 6);
+  errors += check(p[3] == 0 && p[4] == 0 && p[6 + 4] == 0, "causal mask");
+  errors += check(fabsf((float)p[0] + (float)p[1] + (float)p[2] - 1) < 1e-3, "row sums to one");
+  errors += check((float)p[6] > (float)p[6 + 1] && p[6 + 3] != 0, "row 1 sees one more key");
+  errors += check(fabsf((float)p[2] - expf(0) / (expf(-2) + expf(-1) + 1)) < 1e-3, "softmax value");
+
+  npu_set_backend(npu_backend_emu());
+  npu_context_init(&ctx);
+
+  errors += run(&ctx, 5, 70, 40, 0, 1);
+  errors += run(&ctx, 16, 16, 32, 1, 2);
+  errors += run(&ctx, 1, 300, 64, 1, 3);
+
+  // Decode steps within one bucket share the plans
+  uint32_t plans = ctx.plan_count;
+  errors += run(&ctx, 1, 301, 64, 1, 4);
+  errors += run(&ctx, 1, 384, 64, 1, 5);
+  errors += check(ctx.plan_count == plans, "one plan per bucket");
+
+  errors += check(npu_attention(&ctx, NULL, NULL, NULL, NULL, 1, 0, 64, 1.0f, 0) < 0, "empty");
+
+  // KV cache, one bucket boundary crossed while decoding
+  srand(6);
+  errors += run_cache(&ctx, 64, 200, 16, 120);
+  errors += run_cache(&ctx, 40, 64, 5, 3);
+  npu_context_destroy(&ctx);
+
+  return npu_test_done(errors, "attention");
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "npu_matmul.h"
+#include "npu_convert.h"
+
+// Throughput of the per element packing loop used by the tests vs the
+// fused conversion routines. Usage: bench_convert [M K N]
+
+static inline int64_t getCurrentTimeUs() {
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void report(const char *name, int64_t elapse_us, int iterations, size_t bytes) {
+  double us = (double)elapse_us / iterations;
+  printf("%-36s %10.1f us  %8.2f GB/s\n", name, us, bytes / (us * 1000.0));
+}
+
+int main(int argc, char **argv) {
+
+  int M = 384, K = 4096, N = 4096;
+  int iterations = 10;
+  int64_t start_us;
+
+  if (argc == 4) {
+    M = atoi(argv[1]);
+    K = atoi(argv[2]);
+    N = atoi(argv[3]);
+  }
+  if ((M <= 0) || (K <= 0) || (N <= 0) || (M % 4) || (K % 32) || (N % 16)) {
+    printf("M must be a multiple of 4, K of 32 and N of 16\n");
+    return -1;
+  }
+
+  float *a = malloc((size_t)M * K * sizeof(float));
+  _Float16 *feature = malloc((size_t)M * K * sizeof(_Float16));
+  float *out = malloc((size_t)M * N * sizeof(float));
+  _Float16 *out16 = malloc((size_t)M * N * sizeof(_Float16));
+  float *c = malloc((size_t)M * N * sizeof(float));
+  _Float16 *c16 = malloc((size_t)M * N * sizeof(_Float16));
+
+  for (size_t i = 0; i < (size_t)M * K; i++)
+    a[i] = rand() / (float)RAND_MAX;
+  for (size_t i = 0; i < (size_t)M * N; i++) {
+    out[i] = rand() / (float)RAND_MAX;
+    out16[i] = (_Float16)out[i];
+  }
+
+  printf("M is %d, K is %d, N is %d\n", M, K, N);
+
+  start_us = getCurrentTimeUs();
+  for (int it = 0; it < iterations; it++) {
+    for (int m = 1; m <= M; m++) {
+      for (int k = 1; k <= K; k++) {
+        feature[feature_data(K, M, 1, 8, k, m, 1)] = a[((m-1)*K)+(k-1)];
+      }
+    }
+  }
+  report("pack fp32->fp16 (feature_data loop)", getCurrentTimeUs() - start_us, iterations, (size_t)M * K * 6);
+
+  start_us = getCurrentTimeUs();
+  for (int it = 0; it < iterations; it++)
+    npu_pack_feature_fp32(a, K, M, K, M, feature);
+  report("npu_pack_feature_fp32", getCurrentTimeUs() - start_us, iterations, (size_t)M * K * 6);
+
+  start_us = getCurrentTimeUs();
+  for (int it = 0; it < iterations; it++) {
+    for (int m = 1; m <= M; m++) {
+      for (int n = 1; n <= N; n++) {
+        c16[((m-1)*N)+(n-1)] = out[feature_data(N, M, 1, 4, n, m, 1)];
+      }
+    }
+  }
+  report("unpack fp32->fp16 (feature_data loop)", getCurrentTimeUs() - start_us, iterations, (size_t)M * N * 6);
+
+  start_us = getCurrentTimeUs();
+  for (int it = 0; it < iterations; it++)
+    npu_unpack_output_fp32_fp16(out, M, M, N, c16, N);
+  report("npu_unpack_output_fp32_fp16", getCurrentTimeUs() - start_us, iterations, (size_t)M * N * 6);
+
+  start_us = getCurrentTimeUs();
+  for (int it = 0; it < iterations; it++)
+    npu_unpack_output_fp16_fp32(out16, M, M, N, c, N);
+  report("npu_unpack_output_fp16_fp32", getCurrentTimeUs() - start_us, iterations, (size_t)M * N * 6);
+
+  start_us = getCurrentTimeUs();
+  for (int it = 0; it < iterations; it++)
+    npu_fp32_to_fp16(a, feature, (size_t)M * K);
+  report("npu_fp32_to_fp16", getCurrentTimeUs() - start_us, iterations, (size_t)M * K * 6);
+
+  free(a);
+  free(feature);
+  free(out);
+  free(out16);
+  free(c);
+  free(c16);
+  return 0;
+}
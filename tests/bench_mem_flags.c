@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+
+// CPU read / write bandwidth of BOs mapped non-cacheable, write-combine and
+// cacheable. Cacheable timings include the cache maintenance needed to hand
+// the buffer to and from the NPU. Usage: bench_mem_flags [size_mb]
+
+static inline int64_t getCurrentTimeUs() {
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void bench(int fd, const char *name, uint32_t flags, size_t size, void *host) {
+
+  npu_bo_t bo;
+  int64_t start_us, write_us, read_us, copy_us;
+  volatile uint64_t sink = 0;
+  int iterations = 5;
+
+  if (npu_bo_alloc(fd, size, flags, &bo) < 0) {
+    printf("%-16s allocation failed\n", name);
+    return;
+  }
+
+  // write, then flush to the device
+  start_us = getCurrentTimeUs();
+  for (int it = 0; it < iterations; it++) {
+    uint64_t *p = bo.map;
+    for (size_t i = 0; i < size / sizeof(uint64_t); i++)
+      p[i] = i;
+    npu_bo_sync_to_device(fd, &bo, 0, size);
+  }
+  write_us = getCurrentTimeUs() - start_us;
+
+  // invalidate, then read what the device produced
+  start_us = getCurrentTimeUs();
+  for (int it = 0; it < iterations; it++) {
+    const uint64_t *p = bo.map;
+    uint64_t sum = 0;
+    npu_bo_sync_from_device(fd, &bo, 0, size);
+    for (size_t i = 0; i < size / sizeof(uint64_t); i++)
+      sum += p[i];
+    sink += sum;
+  }
+  read_us = getCurrentTimeUs() - start_us;
+
+  start_us = getCurrentTimeUs();
+  for (int it = 0; it < iterations; it++) {
+    memcpy(bo.map, host, size);
+    npu_bo_sync_to_device(fd, &bo, 0, size);
+  }
+  copy_us = getCurrentTimeUs() - start_us;
+
+  printf("%-16s write %8.2f MB/s  read %8.2f MB/s  memcpy in %8.2f MB/s\n", name,
+         (double)size * iterations / write_us, (double)size * iterations / read_us,
+         (double)size * iterations / copy_us);
+
+  npu_bo_free(fd, &bo);
+}
+
+int main(int argc, char **argv) {
+
+  size_t size = 16 << 20;
+
+  if (argc == 2)
+    size = (size_t)atoi(argv[1]) << 20;
+  if (size == 0) {
+    printf("Usage: %s [size_mb]\n", argv[0]);
+    return -1;
+  }
+
+  int fd = npu_open();
+  if (fd < 0)
+    return -1;
+
+  void *host = malloc(size);
+  memset(host, 0x5a, size);
+
+  printf("Buffer size %zu MB\n", size >> 20);
+  bench(fd, "non-cacheable", RKNPU_MEM_NON_CACHEABLE, size, host);
+  bench(fd, "write-combine", RKNPU_MEM_WRITE_COMBINE, size, host);
+  bench(fd, "cacheable+sync", RKNPU_MEM_CACHEABLE, size, host);
+
+  free(host);
+  npu_close(fd);
+  return 0;
+}
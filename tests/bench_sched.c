@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "npu_sched.h"
+
+/*
+ * Three model instances each tied to a core, with uneven load. Compares
+ * makespan and utilisation with and without work stealing on the simulated
+ * device.
+ *
+ * usage: bench_sched [jobs] [job_us]
+ */
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void bench(const char *name, uint32_t flags, npu_sched_task_t *tasks, int jobs, int job_us) {
+
+  // Instance 0 gets 60% of the work, 1 gets 30%, 2 gets 10%
+  static const int share[10] = { 0, 0, 0, 0, 0, 0, 1, 1, 1, 2 };
+  npu_sched_t sched;
+  npu_sched_stats_t stats;
+  double start, elapsed;
+
+  memset(tasks, 0, jobs * sizeof(*tasks));
+  srand(1);
+  for (int i = 0; i < jobs; i++) {
+    tasks[i].core = share[rand() % 10];
+    // +-50% jitter around job_us
+    tasks[i].sim_us = job_us / 2 + rand() % (job_us + 1);
+  }
+
+  if (npu_sched_init_sim(&sched, 3, flags) < 0) {
+    printf("npu_sched_init_sim failed\n");
+    exit(-1);
+  }
+  start = now_ms();
+  for (int i = 0; i < jobs; i++)
+    npu_sched_submit(&sched, &tasks[i]);
+  npu_sched_wait_idle(&sched);
+  elapsed = now_ms() - start;
+  npu_sched_get_stats(&sched, &stats);
+  npu_sched_destroy(&sched);
+
+  printf("%-12s makespan %8.1f ms\n", name, elapsed);
+  for (int c = 0; c < 3; c++) {
+    printf("  core %d jobs %5lu stolen %5lu peak depth %5u busy %8.1f ms (%.0f%%)\n", c,
+      (unsigned long)stats.jobs[c], (unsigned long)stats.stolen[c], stats.peak_depth[c],
+      stats.busy_ns[c] / 1e6, 100.0 * stats.busy_ns[c] / (elapsed * 1e6));
+  }
+}
+
+int main(int argc, char **argv) {
+
+  int jobs = (argc > 1) ? atoi(argv[1]) : 600;
+  int job_us = (argc > 2) ? atoi(argv[2]) : 1000;
+  npu_sched_task_t *tasks = malloc(jobs * sizeof(*tasks));
+
+  if ((jobs <= 0) || (job_us <= 0) || (tasks == NULL)) {
+    printf("usage: %s [jobs] [job_us]\n", argv[0]);
+    return -1;
+  }
+
+  printf("%d jobs of ~%d us on 3 simulated cores\n", jobs, job_us);
+  bench("no stealing", NPU_SCHED_NO_STEAL, tasks, jobs, job_us);
+  bench("stealing", 0, tasks, jobs, job_us);
+
+  free(tasks);
+  return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_matmul.h"
+
+// Per GEMV latency with the regcmd, task and activation buffers in DRAM vs
+// on-chip SRAM. Usage: bench_sram [K N [iterations]]
+
+static inline int64_t getCurrentTimeUs() {
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+uint64_t npu_regs[112];
+
+static int run(int fd, int hot, int K, int N, int iterations, npu_bo_t *weights, npu_bo_t *output) {
+
+  npu_bo_t regcmd, tasks, input;
+  int (*alloc)(int, size_t, uint32_t, npu_bo_t *) = hot ? npu_bo_alloc_hot : npu_bo_alloc;
+  int ret = 0;
+
+  if ((alloc(fd, sizeof(npu_regs), 0, &regcmd) < 0) ||
+      (alloc(fd, sizeof(struct rknpu_task), RKNPU_MEM_KERNEL_MAPPING, &tasks) < 0) ||
+      (alloc(fd, K * sizeof(_Float16), 0, &input) < 0)) {
+    printf("Failed to allocate memory\n");
+    return -1;
+  }
+
+  matmul_params_t params;
+  params.m = 1;
+  params.k = K;
+  params.n = N;
+  params.input_dma = input.dma_addr;
+  params.weights_dma = weights->dma_addr;
+  params.output_dma = output->dma_addr;
+  params.tasks = (uint64_t *) &npu_regs;
+  params.fp32tofp16 = 1;
+  gen_matmul_fp16(&params);
+  memcpy(regcmd.map, npu_regs, sizeof(npu_regs));
+  memset(input.map, 0, K * sizeof(_Float16));
+
+  struct rknpu_task *task = tasks.map;
+  task->flags = 0;
+  task->op_idx = 0;
+  task->enable_mask = 0xd;
+  task->int_mask = 0x300;
+  task->int_clear = 0x1ffff;
+  task->int_status = 0;
+  task->regcfg_amount = sizeof(npu_regs)/sizeof(uint64_t)-(RKNPU_PC_DATA_EXTRA_AMOUNT+4);
+  task->regcfg_offset = 0;
+  task->regcmd_addr = regcmd.dma_addr;
+
+  struct rknpu_submit submit = {
+    .flags = RKNPU_JOB_PC | RKNPU_JOB_BLOCK | RKNPU_JOB_PINGPONG,
+    .timeout = 6000,
+    .task_start = 0,
+    .task_number = 1,
+    .task_obj_addr = tasks.obj_addr,
+    .core_mask = 1,
+    .fence_fd = -1,
+    .subcore_task = {{0, 1}},
+  };
+
+  int64_t start_us = getCurrentTimeUs();
+  for (int it = 0; it < iterations; it++) {
+    ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_SUBMIT, &submit);
+    if (ret < 0) {
+      printf("RKNPU_SUBMIT returned %d\n", ret);
+      break;
+    }
+  }
+  int64_t elapse_us = getCurrentTimeUs() - start_us;
+
+  printf("%-5s regcmd %zu B, tasks %zu B, input %zu B in SRAM : %8.1f us per GEMV\n",
+         hot ? "sram" : "dram", regcmd.sram_size, tasks.sram_size, input.sram_size,
+         (double)elapse_us / iterations);
+
+  npu_bo_free(fd, &input);
+  npu_bo_free(fd, &tasks);
+  npu_bo_free(fd, &regcmd);
+  return ret;
+}
+
+int main(int argc, char **argv) {
+
+  int K = 4096, N = 4096, iterations = 200;
+  npu_bo_t weights, output;
+  npu_sram_usage_t usage;
+
+  if (argc >= 3) {
+    K = atoi(argv[1]);
+    N = atoi(argv[2]);
+  }
+  if (argc == 4)
+    iterations = atoi(argv[3]);
+  if ((K <= 0) || (K % 32) || (N <= 0) || (N % 16) || (iterations <= 0)) {
+    printf("K must be a multiple of 32, N of 16\n");
+    return -1;
+  }
+
+  int fd = npu_open();
+  if (fd < 0)
+    return -1;
+
+  if (npu_get_sram_usage(fd, &usage) < 0) {
+    printf("Driver doesn't report SRAM\n");
+  } else {
+    printf("SRAM total %u KB, free %u KB\n", usage.total >> 10, usage.free >> 10);
+  }
+
+  if ((npu_bo_alloc(fd, weight_size_fp16(N, K), 0, &weights) < 0) ||
+      (npu_bo_alloc(fd, N * sizeof(_Float16), 0, &output) < 0)) {
+    printf("Failed to allocate memory\n");
+    return -1;
+  }
+  memset(weights.map, 0, weights.size);
+
+  npu_reset(fd);
+  run(fd, 0, K, N, iterations, &weights, &output);
+  run(fd, 1, K, N, iterations, &weights, &output);
+
+  if (npu_get_sram_usage(fd, &usage) == 0) {
+    printf("SRAM allocations %llu, fallbacks to DRAM %llu\n",
+           (unsigned long long)usage.sram_allocs, (unsigned long long)usage.fallback_allocs);
+  }
+
+  npu_bo_free(fd, &output);
+  npu_bo_free(fd, &weights);
+  npu_close(fd);
+  return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_context.h"
+#include "npu_pool.h"
+#include "npu_emu.h"
+#include "npu_test.h"
+
+// Lazy open, cached capabilities and the plan cache, runs on the emulator backend.
+
+#define THREADS 8
+
+static uint32_t ioctls = 0;
+static uint32_t plans_freed = 0;
+
+// Counts driver calls on the way to the emulator
+static int counting_ioctl(int fd, unsigned long request, void *arg) {
+  __atomic_add_fetch(&ioctls, 1, __ATOMIC_RELAXED);
+  return npu_backend_emu()->ioctl(fd, request, arg);
+}
+
+static void free_plan(void *plan) {
+  __atomic_add_fetch(&plans_freed, 1, __ATOMIC_RELAXED);
+  free(plan);
+}
+
+typedef struct {
+  npu_context_t  *ctx;
+  const void     *caps;
+  void           *plan;
+} thread_arg_t;
+
+static int key_is(const void *key, size_t key_size, void *arg) {
+  return (key_size == sizeof(int)) && (*(const int *)key == *(int *)arg);
+}
+
+static void *thread_fn(void *p) {
+
+  thread_arg_t *arg = p;
+  int key[3] = { 4, 64, 32 };
+  int *plan;
+
+  arg->caps = npu_context_caps(arg->ctx);
+  arg->plan = npu_context_find_plan(arg->ctx, key, sizeof(key));
+  if (arg->plan == NULL) {
+    plan = malloc(sizeof(int));
+    *plan = 42;
+    arg->plan = npu_context_add_plan(arg->ctx, key, sizeof(key), plan, free_plan);
+  }
+  npu_context_release_plan(arg->ctx, key, sizeof(key), arg->plan);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+
+  npu_context_t ctx;
+  thread_arg_t args[THREADS];
+  pthread_t threads[THREADS];
+  const npu_caps_t *caps;
+  npu_buf_t buf;
+  uint32_t before;
+  int key_a = 1, key_b = 2, key_c = 3;
+  int errors = 0;
+
+  npu_set_backend(npu_backend_emu());
+  npu_set_ioctl_hook(counting_ioctl);
+
+  // Nothing happens until the device is needed
+  npu_context_init(&ctx);
+  errors += check(ctx.fd == -1, "not opened by init");
+  errors += check(ioctls == 0, "no driver calls at init");
+
+  caps = npu_context_caps(&ctx);
+  errors += check(caps != NULL, "caps");
+  errors += check(ctx.fd >= 0, "opened on first use");
+  errors += check(caps->iommu_enabled == 1, "iommu enabled");
+  errors += check(caps->drv_version != 0 && caps->hw_version != 0, "versions");
+  errors += check(caps->cores == NPU_CORES, "core count");
+
+  // Later queries come from the cache
+  before = ioctls;
+  errors += check(npu_context_caps(&ctx) == caps, "same caps");
+  errors += check(npu_context_fd(&ctx) == ctx.fd, "same fd");
+  errors += check(ioctls == before, "cached caps cost no driver calls");
+
+  // The pool is created once and backed by the context's fd
+  errors += check(npu_context_pool(&ctx) == npu_context_pool(&ctx), "one pool");
+  errors += check(npu_pool_alloc(npu_context_pool(&ctx), 1000, 64, &buf) == 0, "pool alloc");
+  npu_pool_free(npu_context_pool(&ctx), &buf);
+
+  // Plan cache
+  errors += check(npu_context_find_plan(&ctx, &key_a, sizeof(key_a)) == NULL, "empty cache");
+  int *plan_a = malloc(sizeof(int));
+  errors += check(npu_context_add_plan(&ctx, &key_a, sizeof(key_a), plan_a, free_plan) == plan_a, "add plan");
+  errors += check(npu_context_find_plan(&ctx, &key_a, sizeof(key_a)) == plan_a, "find plan");
+  errors += check(npu_context_find_plan(&ctx, &key_b, sizeof(key_b)) == NULL, "other key misses");
+  errors += check(npu_context_add_plan(&ctx, &key_a, sizeof(key_a), malloc(sizeof(int)), free_plan) == plan_a, "duplicate keeps the first");
+  errors += check(plans_freed == 1, "duplicate freed");
+  npu_context_release_plan(&ctx, &key_a, sizeof(key_a), plan_a);
+  npu_context_release_plan(&ctx, &key_a, sizeof(key_a), plan_a);
+  npu_context_release_plan(&ctx, &key_a, sizeof(key_a), plan_a);
+
+  // Past plan_max the least recently used plan nobody holds goes
+  ctx.plan_max = 2;
+  int *plan_b = malloc(sizeof(int));
+  errors += check(npu_context_add_plan(&ctx, &key_b, sizeof(key_b), plan_b, free_plan) == plan_b, "add second plan");
+  npu_context_release_plan(&ctx, &key_b, sizeof(key_b), plan_b);
+  errors += check(npu_context_find_plan(&ctx, &key_a, sizeof(key_a)) == plan_a, "touch first plan");
+  npu_context_release_plan(&ctx, &key_a, sizeof(key_a), plan_a);
+  int *plan_c = malloc(sizeof(int));
+  npu_context_add_plan(&ctx, &key_c, sizeof(key_c), plan_c, free_plan);
+  npu_context_release_plan(&ctx, &key_c, sizeof(key_c), plan_c);
+  errors += check(ctx.plan_count == 2, "cache bounded");
+  errors += check(plans_freed == 2, "lru plan freed");
+  errors += check(npu_context_find_plan(&ctx, &key_b, sizeof(key_b)) == NULL, "lru plan gone");
+  errors += check(npu_context_find_plan(&ctx, &key_a, sizeof(key_a)) == plan_a, "recent plan kept");
+
+  // A held plan survives a drop, it is freed on release instead
+  npu_context_drop_plans(&ctx, key_is, &key_c);
+  errors += check(plans_freed == 3 && ctx.plan_count == 1, "unheld plan dropped");
+  npu_context_drop_plans(&ctx, key_is, &key_a);
+  errors += check(plans_freed == 3, "held plan kept");
+  errors += check(npu_context_find_plan(&ctx, &key_a, sizeof(key_a)) == NULL, "dropped plan not found");
+  npu_context_release_plan(&ctx, &key_a, sizeof(key_a), plan_a);
+  errors += check(plans_freed == 4 && ctx.plan_count == 0, "dropped plan freed on release");
+  int *plan_d = malloc(sizeof(int));
+  npu_context_add_plan(&ctx, &key_a, sizeof(key_a), plan_d, free_plan);
+
+  // Threads racing on a fresh context see one set of caps and one plan
+  npu_context_destroy(&ctx);
+  errors += check(plans_freed == 5, "plans freed on destroy");
+  npu_context_init(&ctx);
+  for (int i = 0; i < THREADS; i++) {
+    args[i].ctx = &ctx;
+    pthread_create(&threads[i], NULL, thread_fn, &args[i]);
+  }
+  for (int i = 0; i < THREADS; i++)
+    pthread_join(threads[i], NULL);
+  for (int i = 1; i < THREADS; i++) {
+    errors += check(args[i].caps == args[0].caps, "shared caps");
+    errors += check(args[i].plan == args[0].plan, "shared plan");
+  }
+  errors += check(ctx.plan_count == 1, "one plan built");
+  errors += check(*(int *)args[0].plan == 42, "plan contents");
+  npu_context_destroy(&ctx);
+
+  npu_set_ioctl_hook(NULL);
+
+  return npu_test_done(errors, "context");
+}
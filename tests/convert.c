@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "npu_matmul.h"
+#include "npu_convert.h"
+
+// Checks fp32 <-> fp16 conversion is round to nearest even and that the
+// fused pack / unpack routines match the feature_data() layout. No NPU required.
+
+#define RANDOM_SAMPLES (1 << 20)
+
+static uint16_t h_bits(_Float16 h) { uint16_t b; memcpy(&b, &h, 2); return b; }
+static _Float16 h_from(uint16_t b) { _Float16 h; memcpy(&h, &b, 2); return h; }
+static uint32_t f_bits(float f) { uint32_t b; memcpy(&b, &f, 4); return b; }
+static float f_from(uint32_t b) { float f; memcpy(&f, &b, 4); return f; }
+
+static int check_fp32_to_fp16(const float *in, int count, const char *what) {
+
+  // odd length so both the vector body and the scalar tail are exercised
+  _Float16 *out = malloc(count * sizeof(_Float16));
+  int errors = 0;
+
+  npu_fp32_to_fp16(in, out, count);
+  for (int i = 0; i < count; i++) {
+    _Float16 expected = (_Float16)in[i];
+    if (isnan(in[i])) {
+      if (!isnan((float)out[i]))
+        errors++;
+    } else if (h_bits(out[i]) != h_bits(expected)) {
+      if (errors < 10)
+        printf("%s: fp32 0x%08x -> fp16 0x%04x, expected 0x%04x\n", what, f_bits(in[i]), h_bits(out[i]), h_bits(expected));
+      errors++;
+    }
+  }
+  free(out);
+  return errors;
+}
+
+int main(int argc, char **argv) {
+
+  int errors = 0;
+  float *f = malloc(RANDOM_SAMPLES * sizeof(float));
+  _Float16 *h = malloc(65536 * sizeof(_Float16));
+
+  // fp16 -> fp32 is exact, check every bit pattern
+  for (int i = 0; i < 65536; i++)
+    h[i] = h_from(i);
+  npu_fp16_to_fp32(h, f, 65535);
+  f[65535] = 0.0f;
+  for (int i = 0; i < 65535; i++) {
+    float expected = (float)h[i];
+    if (isnan(expected) ? !isnan(f[i]) : (f_bits(f[i]) != f_bits(expected))) {
+      if (errors < 10)
+        printf("fp16 0x%04x -> fp32 0x%08x, expected 0x%08x\n", i, f_bits(f[i]), f_bits(expected));
+      errors++;
+    }
+  }
+
+  // every fp16 value must survive the round trip
+  errors += check_fp32_to_fp16(f, 65535, "round trip");
+
+  // midpoints between neighbouring fp16 values are ties and must go to even
+  int ties = 0;
+  for (int i = 0; i < 0x7bff; i++) {
+    double lo = (float)h_from(i), hi = (float)h_from(i + 1);
+    f[ties++] = (float)((lo + hi) / 2);
+    f[ties++] = -(float)((lo + hi) / 2);
+  }
+  f[ties++] = 65520.0f;   // tie between max and inf
+  f[ties++] = 0x1p-25f;   // tie between zero and min subnormal
+  f[ties++] = 0x1.8p-25f;
+  errors += check_fp32_to_fp16(f, ties, "ties");
+
+  // random bit patterns over the whole fp32 range
+  srand(1);
+  for (int i = 0; i < RANDOM_SAMPLES; i++)
+    f[i] = f_from(((uint32_t)rand() << 16) ^ (uint32_t)rand());
+  errors += check_fp32_to_fp16(f, RANDOM_SAMPLES - 3, "random");
+
+  // fused feature pack against feature_data(), M padded to 4 and K to 32
+  {
+    int M = 5, K = 44, height = 8, kp = 64, lda = 48;
+    float *a = malloc(M * lda * sizeof(float));
+    _Float16 *packed = malloc(height * kp * sizeof(_Float16));
+    _Float16 *packed16 = malloc(height * kp * sizeof(_Float16));
+    _Float16 *a16 = malloc(M * lda * sizeof(_Float16));
+
+    for (int i = 0; i < M * lda; i++) {
+      a[i] = (rand() % 2001 - 1000) / 7.0f;
+      a16[i] = (_Float16)a[i];
+    }
+    memset(packed, 0xff, height * kp * sizeof(_Float16));
+    memset(packed16, 0xff, height * kp * sizeof(_Float16));
+    npu_pack_feature_fp32(a, lda, M, K, height, packed);
+    npu_pack_feature_fp16(a16, lda, M, K, height, packed16);
+    for (int m = 1; m <= height; m++) {
+      for (int k = 1; k <= kp; k++) {
+        int pos = feature_data(kp, height, 1, 8, k, m, 1);
+        _Float16 expected = ((m <= M) && (k <= K)) ? a16[(m-1)*lda + (k-1)] : 0;
+        if ((h_bits(packed[pos]) != h_bits(expected)) || (h_bits(packed16[pos]) != h_bits(expected))) {
+          if (errors < 10)
+            printf("pack mismatch m:%d k:%d\n", m, k);
+          errors++;
+        }
+      }
+    }
+    free(a);
+    free(a16);
+    free(packed);
+    free(packed16);
+  }
+
+  // output unpack against feature_data(), fp32 (C2=4) and fp16 (C2=8)
+  {
+    int M = 3, N = 20, height = 4;
+    float *out32 = malloc(height * 24 * sizeof(float));
+    _Float16 *out16 = malloc(height * 24 * sizeof(_Float16));
+    float *c32 = malloc(M * N * sizeof(float));
+    _Float16 *c16 = malloc(M * N * sizeof(_Float16));
+    float *c16_32 = malloc(M * N * sizeof(float));
+
+    for (int i = 0; i < height * 24; i++) {
+      out32[i] = i * 0.5f;
+      out16[i] = (_Float16)(i * 0.25f);
+    }
+    npu_unpack_output_fp32(out32, height, M, N, c32, N);
+    npu_unpack_output_fp32_fp16(out32, height, M, N, c16, N);
+    npu_unpack_output_fp16_fp32(out16, height, M, N, c16_32, N);
+    for (int m = 1; m <= M; m++) {
+      for (int n = 1; n <= N; n++) {
+        float e32 = out32[feature_data(N, height, 1, 4, n, m, 1)];
+        float e16 = (float)out16[feature_data(N, height, 1, 8, n, m, 1)];
+        int i = (m-1)*N + (n-1);
+        if ((c32[i] != e32) || ((float)c16[i] != (float)(_Float16)e32) || (c16_32[i] != e16)) {
+          if (errors < 10)
+            printf("unpack mismatch m:%d n:%d\n", m, n);
+          errors++;
+        }
+      }
+    }
+    free(out32);
+    free(out16);
+    free(c32);
+    free(c16);
+    free(c16_32);
+  }
+
+  // strided weight packing against pack_weight_*(), N and K not padded
+  {
+    int N = 40, K = 70, ldb = 72;
+    _Float16 *b16 = malloc(N * ldb * sizeof(_Float16)), *w16 = malloc(N * K * sizeof(_Float16));
+    int8_t *b8 = malloc(N * ldb), *w8 = malloc(N * K);
+    _Float16 *packed16 = malloc(weight_size_fp16(N, K)), *expected16 = malloc(weight_size_fp16(N, K));
+    int8_t *packed8 = malloc(weight_size_int8(N, K)), *expected8 = malloc(weight_size_int8(N, K));
+
+    for (int n = 0; n < N; n++) {
+      for (int k = 0; k < ldb; k++) {
+        b16[n * ldb + k] = (_Float16)((rand() % 2001 - 1000) / 7.0f);
+        b8[n * ldb + k] = (int8_t)(rand() % 256 - 128);
+        if (k < K) {
+          w16[n * K + k] = b16[n * ldb + k];
+          w8[n * K + k] = b8[n * ldb + k];
+        }
+      }
+    }
+    memset(packed16, 0xff, weight_size_fp16(N, K));
+    memset(packed8, 0x7f, weight_size_int8(N, K));
+    pack_weight_fp16(N, K, w16, expected16);
+    pack_weight_int8(N, K, w8, expected8);
+    npu_pack_weight_fp16(b16, ldb, N, K, packed16);
+    npu_pack_weight_int8(b8, ldb, N, K, packed8);
+    if (memcmp(packed16, expected16, weight_size_fp16(N, K)) != 0) {
+      printf("fp16 weight pack mismatch\n");
+      errors++;
+    }
+    if (memcmp(packed8, expected8, weight_size_int8(N, K)) != 0) {
+      printf("int8 weight pack mismatch\n");
+      errors++;
+    }
+    free(b16);
+    free(w16);
+    free(b8);
+    free(w8);
+    free(packed16);
+    free(expected16);
+    free(packed8);
+    free(expected8);
+  }
+
+  free(f);
+  free(h);
+
+  if (errors == 0) {
+    printf("fp16 conversion and packing successful\n");
+    return 0;
+  }
+  printf("fp16 conversion FAILED with %d errors\n", errors);
+  return -1;
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_matmul.h"
+#include "npu_convert.h"
+#include "npu_program.h"
+#include "npu_emu.h"
+#include "npu_test.h"
+
+/*
+ * dma-buf import and export on the emulator backend. A memfd stands in for
+ * a frame from another device, the NPU reads it in place and the output is
+ * read back through an exported fd.
+ */
+
+#define M 4
+#define K 64
+#define N 32
+
+int main(int argc, char **argv) {
+
+  static float a[M * K], w[N * K], ref[M * N], out[M * N];
+  static _Float16 a16[M * K], w16[N * K];
+  size_t frame_size = M * K * sizeof(_Float16);
+  npu_bo_t input, reimport, weights, output, bad;
+  npu_emu_stats_t stats;
+  npu_program_t prog;
+  matmul_params_t params;
+  void *frame, *view;
+  int frame_fd, out_fd;
+  int errors = 0;
+
+  npu_set_backend(npu_backend_emu());
+  int fd = npu_open();
+  errors += check(fd >= 0, "open");
+
+  srand(1);
+  for (int i = 0; i < M * K; i++)
+    a[i] = (rand() % 9) - 4;
+  for (int i = 0; i < N * K; i++)
+    w[i] = ((rand() % 9) - 4) / 8.0f;
+  npu_fp32_to_fp16(a, a16, M * K);
+  npu_fp32_to_fp16(w, w16, N * K);
+  for (int m = 0; m < M; m++) {
+    for (int n = 0; n < N; n++) {
+      float sum = 0;
+      for (int k = 0; k < K; k++)
+        sum += a[m * K + k] * w[n * K + k];
+      ref[m * N + n] = sum;
+    }
+  }
+
+  // The producer writes its frame straight in the NPU feature layout
+  frame_fd = memfd_create("frame", MFD_CLOEXEC);
+  errors += check((frame_fd >= 0) && (ftruncate(frame_fd, frame_size) == 0), "create frame");
+  frame = mmap(NULL, frame_size, PROT_READ | PROT_WRITE, MAP_SHARED, frame_fd, 0);
+  errors += check(frame != MAP_FAILED, "map frame");
+  if (errors)
+    return -1;
+  npu_pack_feature_fp16(a16, K, M, K, M, frame);
+
+  errors += check(lseek(frame_fd, 128, SEEK_SET) == 128, "seek frame");
+  errors += check(npu_bo_import(fd, frame_fd, 0, &input) == 0, "import");
+  errors += check(lseek(frame_fd, 0, SEEK_CUR) == 128, "import keeps the file position");
+  errors += check(input.imported && (input.size == frame_size) && (input.dma_addr != 0), "imported bo");
+  errors += check(memcmp(input.map, frame, frame_size) == 0, "import shares the pages");
+  errors += check(npu_bo_import(fd, frame_fd, frame_size * 2, &bad) < 0, "import larger than the dma-buf");
+  errors += check(npu_bo_import(fd, -1, frame_size, &bad) < 0, "import bad fd");
+
+  errors += check(npu_bo_alloc(fd, weight_size_fp16(N, K), 0, &weights) == 0, "alloc weights");
+  errors += check(npu_bo_alloc(fd, M * N * sizeof(float), 0, &output) == 0, "alloc output");
+  if (errors)
+    return -1;
+  pack_weight_fp16(N, K, w16, weights.map);
+
+  npu_program_init(&prog);
+  memset(&params, 0, sizeof(params));
+  params.m = M;
+  params.k = K;
+  params.n = N;
+  params.input_dma = input.dma_addr;
+  params.weights_dma = weights.dma_addr;
+  params.output_dma = output.dma_addr;
+  errors += check(npu_program_add_matmul_fp16(&prog, &params) == 0, "matmul");
+  errors += check(npu_program_finalize(fd, &prog) == 0, "finalize");
+  errors += check(npu_program_submit(fd, &prog, 0) == 0, "submit");
+
+  // The consumer only gets the exported fd
+  errors += check(npu_bo_export(fd, &output, &out_fd) == 0, "export");
+  view = mmap(NULL, output.size, PROT_READ, MAP_SHARED, out_fd, 0);
+  errors += check(view != MAP_FAILED, "map exported fd");
+  if (view != MAP_FAILED) {
+    npu_unpack_output_fp32(view, M, M, N, out, N);
+    for (int i = 0; i < M * N; i++) {
+      if (fabsf(out[i] - ref[i]) > 1e-3f) {
+        printf("MISMATCH %d: %f vs %f\n", i, out[i], ref[i]);
+        errors++;
+        break;
+      }
+    }
+    munmap(view, output.size);
+  }
+
+  // Importing our own export resolves to the same object
+  errors += check(npu_bo_import(fd, out_fd, 0, &reimport) == 0, "reimport");
+  errors += check((reimport.handle == output.handle) && (reimport.dma_addr == output.dma_addr), "same object");
+  // Shares the handle with output, so only the mapping is dropped
+  if (reimport.map != NULL)
+    munmap(reimport.map, reimport.size);
+  close(out_fd);
+
+  npu_program_free(fd, &prog);
+  npu_bo_free(fd, &input);
+  npu_bo_free(fd, &weights);
+  npu_bo_free(fd, &output);
+  npu_emu_get_stats(&stats);
+  errors += check(stats.live_bos == 0, "all BOs released");
+
+  // The exporter's buffer outlives the import
+  errors += check(((_Float16 *)frame)[0] == a16[0], "frame intact");
+  munmap(frame, frame_size);
+  close(frame_fd);
+  npu_close(fd);
+
+  return npu_test_done(errors, "dmabuf");
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_dvfs.h"
+#include "npu_standin.h"
+#include "npu_test.h"
+
+// DVFS and bandwidth profiles against the stand-in device, no /dev/dri needed.
+
+// Position of the first recorded action with these flags, -1 if missing
+static int find_action(const npu_standin_stats_t *stats, uint32_t flags) {
+  for (uint32_t i = 0; i < stats->action_count; i++) {
+    if (stats->actions[i].flags == flags)
+      return i;
+  }
+  return -1;
+}
+
+int main(int argc, char **argv) {
+
+  npu_standin_stats_t stats;
+  npu_dvfs_state_t state;
+  int errors = 0;
+
+  int fd = npu_standin_open(0);
+  if (fd < 0) {
+    printf("npu_standin_open failed\n");
+    return -1;
+  }
+
+  errors += check(npu_dvfs_profile(npu_dvfs_profiles) == NULL, "unknown profile");
+  errors += check(npu_dvfs_apply(fd, -1) < 0, "apply unknown profile");
+  for (int p = 0; p < npu_dvfs_profiles; p++) {
+    errors += check(npu_dvfs_profile_from_name(npu_dvfs_profile_name(p)) == p, "profile name round trip");
+    errors += check(!(npu_dvfs_profile(p)->valid & NPU_DVFS_VOLT), "profiles leave voltage to the driver");
+  }
+  errors += check(npu_dvfs_profile_from_name("turbo") == -1, "unknown profile name");
+
+  // Applying a profile only issues SET actions, get reads them back
+  errors += check(npu_dvfs_apply(fd, npu_dvfs_latency) == 0, "apply latency");
+  npu_standin_get_stats(&stats);
+  errors += check(stats.action_count == 4, "latency action count");
+  errors += check(find_action(&stats, RKNPU_SET_VOLT) == -1, "voltage untouched");
+  errors += check(find_action(&stats, RKNPU_SET_FREQ) >= 0, "frequency set");
+  errors += check(npu_dvfs_get(fd, &state) == 0, "get state");
+  errors += check(state.freq == NPU_FREQ_MAX && state.bw_priority == 3 && state.bw_expect == 4 && state.bw_tw == 8,
+    "state matches profile");
+
+  // Zero is a setting, power-save has to bring the bus priority back down
+  errors += check(npu_dvfs_apply(fd, npu_dvfs_power_save) == 0, "apply power-save");
+  npu_standin_get_stats(&stats);
+  {
+    int last = -1;
+    for (uint32_t i = 0; i < stats.action_count; i++) {
+      if (stats.actions[i].flags == RKNPU_SET_BW_PRIORITY)
+        last = i;
+    }
+    errors += check((last > find_action(&stats, RKNPU_SET_BW_PRIORITY)) && (stats.actions[last].value == 0),
+      "power-save sets bus priority 0");
+  }
+  errors += check(npu_dvfs_get(fd, &state) == 0 && state.bw_priority == 0, "bus priority lowered");
+
+  // Raising the clock sets the voltage first
+  npu_standin_close(fd);
+  fd = npu_standin_open(0);
+  npu_standin_set_action_value(RKNPU_GET_FREQ, NPU_FREQ_MIN);
+  state = (npu_dvfs_state_t){ .valid = NPU_DVFS_FREQ | NPU_DVFS_VOLT, .freq = NPU_FREQ_MAX, .volt = 850000 };
+  errors += check(npu_dvfs_set(fd, &state) == 0, "raise clock");
+  npu_standin_get_stats(&stats);
+  errors += check(find_action(&stats, RKNPU_SET_VOLT) < find_action(&stats, RKNPU_SET_FREQ), "voltage before frequency");
+  errors += check(stats.actions[find_action(&stats, RKNPU_SET_VOLT)].value == 850000, "voltage value");
+
+  // Lowering the clock sets the frequency first
+  npu_standin_close(fd);
+  fd = npu_standin_open(0);
+  npu_standin_set_action_value(RKNPU_GET_FREQ, NPU_FREQ_MAX);
+  state = (npu_dvfs_state_t){ .valid = NPU_DVFS_FREQ | NPU_DVFS_VOLT, .freq = NPU_FREQ_MIN, .volt = 675000 };
+  errors += check(npu_dvfs_set(fd, &state) == 0, "lower clock");
+  npu_standin_get_stats(&stats);
+  errors += check(find_action(&stats, RKNPU_SET_FREQ) < find_action(&stats, RKNPU_SET_VOLT), "frequency before voltage");
+  errors += check(stats.actions[find_action(&stats, RKNPU_SET_FREQ)].value == NPU_FREQ_MIN, "frequency value");
+
+  npu_standin_close(fd);
+
+  return npu_test_done(errors, "dvfs");
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_matmul.h"
+#include "npu_convert.h"
+#include "npu_program.h"
+#include "npu_emu.h"
+#include "npu_test.h"
+
+// Two chained fp16 layers in one submit on the emulator backend.
+
+#define M  4
+#define K  64
+#define N1 96
+#define N2 32
+
+int main(int argc, char **argv) {
+
+  static float a[M * K], w1[N1 * K], w2[N2 * N1], h[M * N1], ref[M * N2], out[M * N2];
+  static _Float16 a16[M * K], w1_16[N1 * K], w2_16[N2 * N1];
+  npu_bo_t input, hidden, output, weights1, weights2;
+  npu_program_t prog;
+  npu_emu_stats_t stats;
+  matmul_params_t params;
+  int errors = 0;
+
+  npu_set_backend(npu_backend_emu());
+  int fd = npu_open();
+  errors += check(fd >= 0, "open");
+
+  srand(1);
+  for (int i = 0; i < M * K; i++)
+    a[i] = (rand() % 9) - 4;
+  for (int i = 0; i < N1 * K; i++)
+    w1[i] = ((rand() % 9) - 4) / 8.0f;
+  for (int i = 0; i < N2 * N1; i++)
+    w2[i] = ((rand() % 9) - 4) / 8.0f;
+  npu_fp32_to_fp16(a, a16, M * K);
+  npu_fp32_to_fp16(w1, w1_16, N1 * K);
+  npu_fp32_to_fp16(w2, w2_16, N2 * N1);
+
+  // Reference, the hidden layer is rounded to fp16 as the NPU stores it
+  for (int m = 0; m < M; m++) {
+    for (int n = 0; n < N1; n++) {
+      float sum = 0;
+      for (int k = 0; k < K; k++)
+        sum += a[m * K + k] * w1[n * K + k];
+      h[m * N1 + n] = (float)(_Float16)sum;
+    }
+  }
+  for (int m = 0; m < M; m++) {
+    for (int n = 0; n < N2; n++) {
+      float sum = 0;
+      for (int k = 0; k < N1; k++)
+        sum += h[m * N1 + k] * w2[n * N1 + k];
+      ref[m * N2 + n] = sum;
+    }
+  }
+
+  errors += check(npu_bo_alloc(fd, M * K * sizeof(_Float16), 0, &input) == 0, "alloc input");
+  errors += check(npu_bo_alloc(fd, M * N1 * sizeof(_Float16), 0, &hidden) == 0, "alloc hidden");
+  errors += check(npu_bo_alloc(fd, M * N2 * sizeof(float), 0, &output) == 0, "alloc output");
+  errors += check(npu_bo_alloc(fd, weight_size_fp16(N1, K), 0, &weights1) == 0, "alloc weights1");
+  errors += check(npu_bo_alloc(fd, weight_size_fp16(N2, N1), 0, &weights2) == 0, "alloc weights2");
+  if (errors)
+    return -1;
+
+  npu_pack_feature_fp16(a16, K, M, K, M, input.map);
+  pack_weight_fp16(N1, K, w1_16, weights1.map);
+  pack_weight_fp16(N2, N1, w2_16, weights2.map);
+
+  npu_program_init(&prog);
+  memset(&params, 0, sizeof(params));
+  params.m = M;
+  params.k = K;
+  params.n = N1;
+  params.input_dma = input.dma_addr;
+  params.weights_dma = weights1.dma_addr;
+  params.output_dma = hidden.dma_addr;
+  params.fp32tofp16 = 1;
+  errors += check(npu_program_add_matmul_fp16(&prog, &params) == 0, "layer 1");
+  params.k = N1;
+  params.n = N2;
+  params.input_dma = hidden.dma_addr;
+  params.weights_dma = weights2.dma_addr;
+  params.output_dma = output.dma_addr;
+  params.fp32tofp16 = 0;
+  errors += check(npu_program_add_matmul_fp16(&prog, &params) == 1, "layer 2");
+
+  errors += check(npu_program_finalize(fd, &prog) == 0, "finalize");
+  errors += check(npu_program_verify(prog.regcmd_bo.map, prog.regcmd_bo.dma_addr, prog.regcmd_bo.size,
+    prog.tasks_bo.map, prog.task_count) == 0, "verify");
+  errors += check(npu_program_submit(fd, &prog, 0) == 0, "submit");
+
+  npu_unpack_output_fp32(output.map, M, M, N2, out, N2);
+  for (int i = 0; i < M * N2; i++) {
+    if (fabsf(out[i] - ref[i]) > 1e-3f) {
+      printf("MISMATCH %d: %f vs %f\n", i, out[i], ref[i]);
+      errors++;
+      break;
+    }
+  }
+
+  npu_emu_get_stats(&stats);
+  errors += check(stats.submits == 1 && stats.tasks == 2, "one submit, two tasks");
+  errors += check(stats.macs == (uint64_t)M * K * N1 + (uint64_t)M * N1 * N2, "mac count");
+
+  // A task pointing outside any BO is rejected
+  ((struct rknpu_task *)prog.tasks_bo.map)[1].regcmd_addr = 0x1000;
+  errors += check(npu_program_submit(fd, &prog, 0) < 0, "bad regcmd address rejected");
+
+  npu_program_free(fd, &prog);
+  npu_bo_free(fd, &input);
+  npu_bo_free(fd, &hidden);
+  npu_bo_free(fd, &output);
+  npu_bo_free(fd, &weights1);
+  npu_bo_free(fd, &weights2);
+  npu_emu_get_stats(&stats);
+  errors += check(stats.live_bos == 0, "all BOs freed");
+  npu_close(fd);
+
+  return npu_test_done(errors, "emulator");
+}
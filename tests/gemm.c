@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_hw.h"
+#include "npu_interface.h"
+#include "npu_context.h"
+#include "npu_gemm.h"
+#include "npu_weights.h"
+#include "npu_emu.h"
+#include "npu_test.h"
+
+// Row-major npu_matmul() against a cpu reference on the emulator backend,
+// shapes off the NPU granules, tiled shapes, the plan cache and resident weights.
+
+static uint32_t submits = 0;
+static uint32_t core_masks = 0;
+static uint32_t syncs_to_device = 0;
+static uint32_t syncs_from_device = 0;
+
+// Records which cores the submits went to and the cache maintenance around them
+static int recording_ioctl(int fd, unsigned long request, void *arg) {
+  if (request == DRM_IOCTL_RKNPU_SUBMIT) {
+    submits++;
+    core_masks |= ((struct rknpu_submit *)arg)->core_mask;
+  }
+  if (request == DRM_IOCTL_RKNPU_MEM_SYNC) {
+    if (((struct rknpu_mem_sync *)arg)->flags & RKNPU_MEM_SYNC_TO_DEVICE)
+      syncs_to_device++;
+    if (((struct rknpu_mem_sync *)arg)->flags & RKNPU_MEM_SYNC_FROM_DEVICE)
+      syncs_from_device++;
+  }
+  return npu_backend_emu()->ioctl(fd, request, arg);
+}
+
+// Small values keep the fp16 products and fp32 sums exact
+static void fill(int dtype, void *p, int count, float scale) {
+  for (int i = 0; i < count; i++) {
+    if (dtype == npu_dtype_int8)
+      ((int8_t *)p)[i] = rand() % 256 - 128;
+    else
+      ((_Float16 *)p)[i] = (_Float16)(((rand() % 9) - 4) * scale);
+  }
+}
+
+static int verify(int dtype, const void *a, const void *b, const void *c, int M, int K, int N) {
+
+  int errors = 0;
+
+  for (int m = 0; m < M; m++) {
+    for (int n = 0; n < N; n++) {
+      double ref = 0, out;
+      for (int k = 0; k < K; k++) {
+        if (dtype == npu_dtype_int8)
+          ref += ((const int8_t *)a)[m * K + k] * ((const int8_t *)b)[n * K + k];
+        else
+          ref += (float)((const _Float16 *)a)[m * K + k] * (float)((const _Float16 *)b)[n * K + k];
+      }
+      if (dtype == npu_dtype_int8)
+        out = ((const int32_t *)c)[m * N + n];
+      else if (dtype == npu_dtype_fp16_fp16)
+        out = (float)((const _Float16 *)c)[m * N + n];
+      else
+        out = ((const float *)c)[m * N + n];
+      if (fabs(out - ref) > ((dtype == npu_dtype_fp16_fp16) ? fabs(ref) / 512 : 0)) {
+        if (errors < 10)
+          printf("%d x %d x %d dtype %d: c[%d][%d] = %f, expected %f\n", M, K, N, dtype, m, n, out, ref);
+        errors++;
+      }
+    }
+  }
+  return errors;
+}
+
+static int run(npu_context_t *ctx, int dtype, int M, int K, int N, int seed) {
+
+  void *a = malloc((size_t)M * K * 2), *b = malloc((size_t)N * K * 2), *c = malloc((size_t)M * N * 4);
+  int errors = 0, ret;
+
+  srand(seed);
+  fill(dtype, a, M * K, 1.0f);
+  fill(dtype, b, N * K, 1.0f / 8);
+  memset(c, 0xff, (size_t)M * N * 4);
+
+  ret = npu_matmul(ctx, a, b, c, M, K, N, dtype);
+  if (ret < 0) {
+    printf("FAILED: %d x %d x %d dtype %d returned %d\n", M, K, N, dtype, ret);
+    errors++;
+  } else {
+    errors += verify(dtype, a, b, c, M, K, N);
+  }
+  free(a);
+  free(b);
+  free(c);
+  return errors;
+}
+
+// B is uploaded once then scribbled over, later calls must not read it
+static int run_tensor(npu_context_t *ctx, int dtype, int M, int K, int N, int seed) {
+
+  void *a = malloc((size_t)M * K * 2), *b = malloc((size_t)N * K * 2), *c = malloc((size_t)M * N * 4);
+  void *scratch = malloc((size_t)N * K * 2);
+  npu_tensor_t tensor;
+  int errors = 0;
+
+  srand(seed);
+  fill(dtype, b, N * K, 1.0f / 8);
+  memcpy(scratch, b, (size_t)N * K * 2);
+  errors += check(npu_tensor_upload(ctx, scratch, N, K, (dtype == npu_dtype_int8) ? precision_int8 : precision_float16,
+    &tensor) == 0, "upload");
+  memset(scratch, 0x55, (size_t)N * K * 2);
+
+  uint32_t plans = ctx->plan_count;
+  for (int i = 0; i < 3; i++) {
+    fill(dtype, a, M * K, 1.0f);
+    memset(c, 0xff, (size_t)M * N * 4);
+    errors += check(npu_matmul_tensor(ctx, a, &tensor, c, M, dtype) == 0, "tensor matmul");
+    errors += verify(dtype, a, b, c, M, K, N);
+  }
+  errors += check(npu_matmul_tensor(ctx, a, &tensor, c, M, (dtype == npu_dtype_int8) ? npu_dtype_fp16 : npu_dtype_int8) < 0,
+    "dtype must match the tensor");
+  errors += check(ctx->plan_count == plans + 1, "one plan per tensor");
+  npu_tensor_free(&tensor);
+  errors += check(ctx->plan_count == plans, "plan dropped with the tensor");
+  free(a);
+  free(b);
+  free(c);
+  free(scratch);
+  return errors;
+}
+
+int main(int argc, char **argv) {
+
+  npu_matmul_tiling_t t;
+  npu_context_t ctx;
+  int errors = 0;
+
+  // Tiling is pure, checked without a device
+  errors += check(npu_matmul_tiling(npu_dtype_fp16, 4, 64, 32, 1, &t) == 0, "small tiling");
+  errors += check(t.m_tiles == 1 && t.n_tiles == 1 && t.m_tile == 4 && t.n_tile == 32 && t.cores == 1, "small is one task");
+  errors += check(npu_matmul_tiling(npu_dtype_fp16, 1, 4096, 4096, 3, &t) == 0, "gemv tiling");
+  errors += check(t.m_tile == 1 && t.m_tiles == 1 && t.n_tiles == 3 && t.cores == 3, "gemv splits N over the cores");
+  errors += check((t.n_tile % 16) == 0 && t.n_tile * t.n_tiles >= 4096, "gemv N covered");
+  errors += check(npu_matmul_tiling(npu_dtype_fp16, 1000, 4096, 64, 3, &t) == 0, "tall tiling");
+  errors += check((size_t)t.m_tile * 4096 * 2 <= 11 * 32768 && (t.m_tile % 4) == 0, "tall tile fits the CBUF");
+  errors += check(t.m_tile * t.m_tiles >= 1000 && t.m_tile * (t.m_tiles - 1) < 1000, "tall tiles even");
+  errors += check(t.n_tiles == 1 && t.cores == 3, "tall splits M over the cores");
+  errors += check(npu_matmul_tiling(npu_dtype_int8, 1, 96, 200, 3, &t) == 0, "int8 tiling");
+  errors += check(t.n_tiles == 3 && (t.n_tile % 32) == 0, "int8 kernel groups");
+  errors += check(npu_matmul_tiling(npu_dtype_fp16, 4, 64, 100, 3, &t) == 0 && t.n_tiles == 1, "thin N not split");
+  errors += check(npu_matmul_tiling(npu_dtype_fp16, 4, 20000, 16, 1, &t) < 0, "K too big for one task");
+
+  // Spreading a narrow B over the cores by N re-reads the bigger A, by M the smaller B
+  {
+    npu_matmul_tiling_t h;
+    errors += check(npu_matmul_tiling_heuristic(npu_dtype_fp16, 384, 256, 192, 3, &h) == 0, "heuristic tiling");
+    errors += check(npu_matmul_tiling(npu_dtype_fp16, 384, 256, 192, 3, &t) == 0, "planned tiling");
+    errors += check(h.m_tiles == 1 && h.n_tiles == 3, "heuristic splits N");
+    errors += check(t.m_tiles == 3 && t.n_tiles == 1 && t.cores == 3, "planner splits M");
+    errors += check(t.dram_bytes < h.dram_bytes, "planner moves less");
+    errors += check(t.data_banks == 2 && t.weight_banks == 10, "banks follow the tile");
+    for (int i = 0; i < 50; i++) {
+      int dtype = i % 3, M = 1 + rand() % 2000, K = 1 + rand() % 4000, N = 1 + rand() % 6000, cores = 1 + i % 3;
+      if ((npu_matmul_tiling_heuristic(dtype, M, K, N, cores, &h) < 0) || (npu_matmul_tiling(dtype, M, K, N, cores, &t) < 0))
+        continue;
+      errors += check(t.dram_bytes <= h.dram_bytes && t.cores >= h.cores, "never worse than the heuristic");
+      errors += check(t.m_tile * t.m_tiles >= M && t.n_tile * t.n_tiles >= N, "tiles cover C");
+      errors += check((size_t)t.m_tile * ((K + 31) / 32) * 32 * (dtype == npu_dtype_int8 ? 1 : 2) <=
+        (size_t)t.data_banks * 32768 && t.data_banks + t.weight_banks == 12, "A tile fits its banks");
+    }
+  }
+  errors += check(npu_matmul_tiling(npu_dtype_int8 + 1, 4, 64, 16, 1, &t) < 0, "bad dtype");
+  errors += check(npu_matmul_tiling(npu_dtype_fp16, 0, 64, 16, 1, &t) < 0, "empty");
+
+  npu_set_backend(npu_backend_emu());
+  npu_set_ioctl_hook(recording_ioctl);
+  npu_context_init(&ctx);
+
+  // Off granule shapes, one task
+  errors += run(&ctx, npu_dtype_fp16, 5, 44, 20, 1);
+  errors += run(&ctx, npu_dtype_fp16_fp16, 1, 100, 50, 2);
+  errors += run(&ctx, npu_dtype_int8, 7, 70, 40, 3);
+  errors += check(submits == 3 && core_masks == 1, "single tasks on core 0");
+
+  // Same shape again reuses the plan with new data, A and B are flushed and C invalidated
+  uint32_t plans = ctx.plan_count;
+  syncs_to_device = syncs_from_device = 0;
+  errors += run(&ctx, npu_dtype_fp16, 5, 44, 20, 4);
+  errors += check(ctx.plan_count == plans, "plan reused");
+  errors += check((npu_context_pool(&ctx)->flags & RKNPU_MEM_CACHEABLE) != 0, "context pool is cacheable");
+  errors += check(syncs_to_device == 2 && syncs_from_device == 1, "plan buffers synced");
+
+  // Tiled over M and over N, spread over all three cores
+  core_masks = 0;
+  errors += run(&ctx, npu_dtype_fp16, 101, 4096, 24, 5);
+  errors += check(core_masks == 0x7, "M tiles on all cores");
+  core_masks = 0;
+  errors += run(&ctx, npu_dtype_int8, 1, 96, 200, 6);
+  errors += check(core_masks == 0x7, "N tiles on all cores");
+  errors += run(&ctx, npu_dtype_fp16_fp16, 9, 64, 5000, 7);
+
+  errors += check(npu_matmul(&ctx, NULL, NULL, NULL, 4, 20000, 16, npu_dtype_fp16) < 0, "K too big rejected");
+
+  // Resident weights, one plan per tensor and M whatever the call count
+  errors += run_tensor(&ctx, npu_dtype_fp16, 1, 200, 300, 8);
+  errors += run_tensor(&ctx, npu_dtype_fp16_fp16, 12, 96, 40, 9);
+  errors += run_tensor(&ctx, npu_dtype_int8, 101, 4096, 72, 10);
+
+  // Fused QKV with a part off the kernel group, one job and one view per part
+  {
+    static const int n[3] = { 40, 24, 32 };
+    _Float16 a[4 * 96], q[40 * 96], k[24 * 96], v[32 * 96];
+    const void *parts[3] = { q, k, v };
+    float c[4 * 112], ref[4 * 40];
+    npu_view_t views[3];
+    npu_tensor_t tensor;
+
+    fill(npu_dtype_fp16, a, 4 * 96, 1.0f);
+    for (int i = 0; i < 3; i++)
+      fill(npu_dtype_fp16, (void *)parts[i], n[i] * 96, 1.0f / 8);
+    errors += check(npu_tensor_upload_fused(&ctx, parts, n, 3, 96, precision_float16, &tensor) == 0, "fused upload");
+    errors += check(tensor.n == 48 + 32 + 32 && tensor.part_offset[1] == 48 && tensor.part_offset[2] == 80, "fused layout");
+    uint32_t before = submits;
+    errors += check(npu_matmul_tensor(&ctx, a, &tensor, c, 4, npu_dtype_fp16) == 0, "fused matmul");
+    errors += check(submits == before + 1, "one submit for three projections");
+    npu_tensor_views(&tensor, c, npu_dtype_fp16, views);
+    for (int i = 0; i < 3; i++) {
+      errors += check(views[i].n == n[i] && views[i].ld == tensor.n, "view shape");
+      for (int m = 0; m < 4; m++)
+        memcpy(ref + m * n[i], (float *)views[i].data + m * views[i].ld, n[i] * sizeof(float));
+      errors += verify(npu_dtype_fp16, a, parts[i], ref, 4, 96, n[i]);
+    }
+    npu_tensor_free(&tensor);
+    errors += check(npu_tensor_upload_fused(&ctx, parts, n, NPU_TENSOR_MAX_PARTS + 1, 96, precision_float16, &tensor) < 0,
+      "too many parts");
+  }
+
+  // Pre-packed weights from a file are loaded as is
+  {
+    char path[] = "/tmp/gemm_XXXXXX";
+    npu_weights_writer_t w;
+    npu_weights_file_t f;
+    npu_tensor_t tensor;
+    _Float16 a[3 * 64], b[48 * 64];
+    float c[3 * 48];
+    int tmp = mkstemp(path);
+
+    close(tmp);
+    fill(npu_dtype_fp16, a, 3 * 64, 1.0f);
+    fill(npu_dtype_fp16, b, 48 * 64, 1.0f / 8);
+    errors += check((npu_weights_writer_open(&w, path) == 0) &&
+      (npu_weights_writer_add(&w, "wq", precision_float16, 48, 64, b) == 0) &&
+      (npu_weights_writer_close(&w) == 0), "write weights file");
+    errors += check(npu_weights_open(&f, path) == 0, "open weights file");
+    errors += check(npu_tensor_load(&ctx, &f, npu_weights_find(&f, "wq"), &tensor) == 0, "load tensor");
+    npu_weights_close(&f);
+    unlink(path);
+    errors += check(npu_matmul_tensor(&ctx, a, &tensor, c, 3, npu_dtype_fp16) == 0, "file tensor matmul");
+    errors += verify(npu_dtype_fp16, a, b, c, 3, 64, 48);
+    npu_tensor_free(&tensor);
+  }
+
+  npu_context_destroy(&ctx);
+  npu_set_ioctl_hook(NULL);
+
+  return npu_test_done(errors, "npu_matmul");
+}
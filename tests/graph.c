@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_context.h"
+#include "npu_graph.h"
+#include "npu_emu.h"
+#include "npu_test.h"
+
+// A small MLP compiled into one program and run on the emulator backend
+// against a cpu reference, relu fusion, buffer sharing and the error paths.
+
+static uint32_t submits = 0;
+
+static int counting_ioctl(int fd, unsigned long request, void *arg) {
+  if (request == DRM_IOCTL_RKNPU_SUBMIT)
+    submits++;
+  return npu_backend_emu()->ioctl(fd, request, arg);
+}
+
+static _Float16 *weight(int n, int k) {
+  _Float16 *w = malloc((size_t)n * k * sizeof(_Float16));
+  for (int i = 0; i < n * k; i++)
+    w[i] = (_Float16)(((rand() % 9) - 4) * 0.0625f);
+  return w;
+}
+
+// out = x w^T, rounded to fp16 like the NPU output, optionally relu'd
+static void layer(const float *x, const _Float16 *w, float *out, int M, int K, int N, int relu) {
+  for (int m = 0; m < M; m++) {
+    for (int n = 0; n < N; n++) {
+      float sum = 0;
+      for (int k = 0; k < K; k++)
+        sum += x[m * K + k] * (float)w[n * K + k];
+      if (relu && (sum < 0))
+        sum = 0;
+      out[m * N + n] = (float)(_Float16)sum;
+    }
+  }
+}
+
+static int compare(const float *out, const float *ref, int count, const char *what) {
+
+  int errors = 0;
+
+  for (int i = 0; i < count; i++) {
+    if (fabsf(out[i] - ref[i]) > 0.01f * (1 + fabsf(ref[i]))) {
+      if (errors < 10)
+        printf("%s [%d] %f expected %f\n", what, i, out[i], ref[i]);
+      errors++;
+    }
+  }
+  return errors;
+}
+
+// x -> relu(x w1^T) -> relu(. w2^T) -> . w3^T, the hidden layers are outputs too when keep is set
+static int run_mlp(npu_context_t *ctx, int M, int K, int H, int N, int keep) {
+
+  npu_graph_t g;
+  _Float16 *w1 = weight(H, K), *w2 = weight(H, H), *w3 = weight(N, H);
+  float *x = malloc((size_t)M * K * sizeof(float));
+  float *h1 = malloc((size_t)M * H * sizeof(float)), *h2 = malloc((size_t)M * H * sizeof(float));
+  float *ref = malloc((size_t)M * N * sizeof(float)), *out = malloc((size_t)M * N * sizeof(float));
+  int in, t, errors = 0, ret;
+
+  for (int i = 0; i < M * K; i++)
+    x[i] = (float)(_Float16)(((rand() % 17) - 8) * 0.125f);
+
+  npu_graph_init(&g, ctx);
+  in = npu_graph_input(&g, M, K);
+  t = npu_graph_relu(&g, npu_graph_matmul(&g, in, npu_graph_weight(&g, w1, H, K)));
+  t = npu_graph_relu(&g, npu_graph_matmul(&g, t, npu_graph_weight(&g, w2, H, H)));
+  t = npu_graph_output(&g, npu_graph_matmul(&g, t, npu_graph_weight(&g, w3, N, H)));
+  errors += check(t >= 0, "build");
+
+  ret = npu_graph_compile(&g);
+  errors += check(ret == 0, "compile");
+  if (ret == 0) {
+    const float *inputs[] = { x };
+    float *outputs[] = { out };
+    uint32_t before = submits;
+
+    errors += check(g.prog.task_count == 3, "one task per layer");
+    errors += check(g.arena_stats.peak < g.arena_stats.naive, "activations share the arena");
+    errors += check(npu_graph_run(&g, inputs, outputs) == 0, "run");
+    errors += check(submits - before == 1, "one submit");
+
+    layer(x, w1, h1, M, K, H, 1);
+    layer(h1, w2, h2, M, H, H, 1);
+    layer(h2, w3, ref, M, H, N, 0);
+    errors += compare(out, ref, M * N, "mlp");
+    if (errors)
+      npu_graph_report(&g, stdout);
+  }
+  npu_graph_destroy(&g);
+
+  free(w1);
+  free(w2);
+  free(w3);
+  free(x);
+  free(h1);
+  free(h2);
+  free(ref);
+  free(out);
+  return errors;
+}
+
+int main(int argc, char **argv) {
+
+  npu_context_t ctx;
+  npu_graph_t g;
+  _Float16 *w = weight(32, 32);
+  int errors = 0, a, b;
+
+  npu_set_backend(npu_backend_emu());
+  npu_set_ioctl_hook(counting_ioctl);
+  npu_context_init(&ctx);
+
+  srand(1);
+  errors += run_mlp(&ctx, 4, 64, 64, 32, 0);
+  errors += run_mlp(&ctx, 7, 40, 100, 20, 0);
+  errors += run_mlp(&ctx, 1, 96, 48, 16, 0);
+
+  // A relu with nothing to fuse into isn't supported
+  npu_graph_init(&g, &ctx);
+  a = npu_graph_input(&g, 4, 32);
+  npu_graph_output(&g, npu_graph_relu(&g, a));
+  errors += check(npu_graph_compile(&g) == -ENOTSUP, "relu on an input");
+  npu_graph_destroy(&g);
+
+  // Nor is one on a result that is read elsewhere
+  npu_graph_init(&g, &ctx);
+  a = npu_graph_matmul(&g, npu_graph_input(&g, 4, 32), npu_graph_weight(&g, w, 32, 32));
+  npu_graph_output(&g, a);
+  npu_graph_output(&g, npu_graph_relu(&g, a));
+  errors += check(npu_graph_compile(&g) == -ENOTSUP, "relu on a shared result");
+  npu_graph_destroy(&g);
+
+  // Shape mismatches are caught by the builder and passed along the chain
+  npu_graph_init(&g, &ctx);
+  a = npu_graph_input(&g, 4, 48);
+  b = npu_graph_relu(&g, npu_graph_matmul(&g, a, npu_graph_weight(&g, w, 32, 32)));
+  errors += check(b == -EINVAL, "K mismatch");
+  errors += check(npu_graph_output(&g, b) == -EINVAL, "error passed on");
+  npu_graph_destroy(&g);
+
+  npu_context_destroy(&ctx);
+  free(w);
+
+  return npu_test_done(errors, "graph");
+}
@@ -150,8 +150,8 @@ int main(int argc, char **argv) {
 
   memcpy((void *)regcmd,(void *)&npu_regs,sizeof(npu_regs));
 
-  memset((void *)input,0,M*64*sizeof(__fp16));
-  memset((void *)weights,0,64*N*sizeof(__fp16));
+  memset((void *)input,0,M*64*sizeof(_Float16));
+  memset((void *)weights,0,64*N*sizeof(_Float16));
   memset((void *)output,0,M*N*sizeof(float));
 
   tasks[0].flags  = 0;
@@ -164,7 +164,7 @@ int main(int argc, char **argv) {
   tasks[0].regcfg_offset = 0;
   tasks[0].regcmd_addr = regcmd_dma;
 
-  __fp16 *weights_fp16 = weights;
+  _Float16 *weights_fp16 = weights;
 
   for(int n=1;n<=N;n++) {
     for(int k=1;k<=K;k++) {
@@ -172,7 +172,7 @@ int main(int argc, char **argv) {
     }
   }
 
-  __fp16 *feature_data_fp16 = (__fp16*) input;
+  _Float16 *feature_data_fp16 = (_Float16*) input;
 
   for (int m=1;m<=M;m++) {
     for (int k=1;k<=K;k++) {
@@ -208,7 +208,7 @@ int main(int argc, char **argv) {
       subcore_tasks[4]
     },
   };
-  ret = ioctl(fd, DRM_IOCTL_RKNPU_SUBMIT, &submit);
+  ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_SUBMIT, &submit);
   printf("RKNPU_SUBMIT returned %d\n", ret);
   if (ret <0) {
     return ret;
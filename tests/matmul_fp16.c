@@ -130,11 +130,11 @@ int main(int argc, char **argv) {
 
   uint64_t input_dma, input_obj;
   uint32_t input_handle;
-  void *input = mem_allocate(fd, M*K*sizeof(__fp16), &input_dma, &input_obj, 0, &input_handle);
+  void *input = mem_allocate(fd, M*K*sizeof(_Float16), &input_dma, &input_obj, 0, &input_handle);
 
   uint64_t weights_dma, weights_obj;
   uint32_t weights_handle;
-  void *weights = mem_allocate(fd, N*K*sizeof(__fp16), &weights_dma, &weights_obj, 0, &weights_handle);
+  void *weights = mem_allocate(fd, N*K*sizeof(_Float16), &weights_dma, &weights_obj, 0, &weights_handle);
 
   uint64_t output_dma, output_obj;
   uint32_t output_handle;
@@ -238,7 +238,7 @@ int main(int argc, char **argv) {
       subcore_tasks[4]
     },
   };
-  ret = ioctl(fd, DRM_IOCTL_RKNPU_SUBMIT, &submit);
+  ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_SUBMIT, &submit);
   printf("RKNPU_SUBMIT returned %d\n", ret);
   if (ret <0) {
     return ret;
@@ -251,7 +251,7 @@ int main(int argc, char **argv) {
   uint64_t elapse_us;
 
   start_us = getCurrentTimeUs();
-  ret = ioctl(fd, DRM_IOCTL_RKNPU_SUBMIT, &submit);
+  ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_SUBMIT, &submit);
   elapse_us = getCurrentTimeUs() - start_us;
   printf("Elapse Time = %2fms tps = %.2f\n",elapse_us / 1000.f, 1000.f * 1000.f /elapse_us);
  
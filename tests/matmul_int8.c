@@ -234,7 +234,7 @@ int main(int argc, char **argv) {
       subcore_tasks[4]
     },
   };
-  ret = ioctl(fd, DRM_IOCTL_RKNPU_SUBMIT, &submit);
+  ret = npu_ioctl(fd, DRM_IOCTL_RKNPU_SUBMIT, &submit);
   printf("RKNPU_SUBMIT returned %d\n", ret);
   if (ret <0)  {
     return ret;
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_emu.h"
+#include "npu_context.h"
+#include "npu_test.h"
+
+// Contiguous vs IOMMU placement and per flag usage, runs on the emulator backend.
+
+#define LARGE (4 << 20)
+#define SMALL (64 << 10)
+
+static uint32_t last_create_flags;
+static int iommu = 1;
+static int iommu_queries = 0;
+static int fail_noncontiguous = 0;
+static int fail_map = 0;
+static int destroys = 0;
+
+static int hook(int fd, unsigned long request, void *arg) {
+
+  if (request == DRM_IOCTL_RKNPU_MEM_CREATE) {
+    struct rknpu_mem_create *create = arg;
+    last_create_flags = create->flags;
+    if (fail_noncontiguous && (create->flags & RKNPU_MEM_NON_CONTIGUOUS))
+      return -1;
+  }
+  if ((request == DRM_IOCTL_RKNPU_MEM_MAP) && fail_map)
+    return -1;
+  if (request == DRM_IOCTL_RKNPU_MEM_DESTROY)
+    destroys++;
+  if ((request == DRM_IOCTL_RKNPU_ACTION) && (((struct rknpu_action *)arg)->flags == RKNPU_GET_IOMMU_EN)) {
+    ((struct rknpu_action *)arg)->value = iommu;
+    iommu_queries++;
+    return 0;
+  }
+  return npu_backend_emu()->ioctl(fd, request, arg);
+}
+
+int main(int argc, char **argv) {
+
+  npu_bo_t small, large, hot, plain;
+  npu_mem_usage_t usage;
+  uint32_t large_flags = RKNPU_MEM_NON_CONTIGUOUS | RKNPU_MEM_IOMMU;
+  int errors = 0;
+
+  npu_set_backend(npu_backend_emu());
+  npu_set_ioctl_hook(hook);
+  int fd = npu_open();
+  errors += check(fd >= 0, "open");
+
+  errors += check(npu_bo_alloc(fd, SMALL, RKNPU_MEM_CACHEABLE, &small) == 0, "small alloc");
+  errors += check((small.flags & large_flags) == 0, "small stays contiguous");
+
+  errors += check(npu_bo_alloc(fd, LARGE, RKNPU_MEM_CACHEABLE | NPU_BO_IOMMU, &large) == 0, "large alloc");
+  errors += check((large.flags & large_flags) == large_flags, "large goes through the iommu");
+  errors += check(last_create_flags == (RKNPU_MEM_CACHEABLE | large_flags), "flags passed to the driver");
+
+  errors += check(npu_bo_alloc_hot(fd, LARGE, 0, &hot) == 0, "hot alloc");
+  errors += check((hot.flags & RKNPU_MEM_NON_CONTIGUOUS) == 0, "hot path untouched");
+
+  npu_get_mem_usage(&usage);
+  errors += check(usage.bos == 3, "bo count");
+  errors += check(usage.bytes == SMALL + 2 * LARGE, "total bytes");
+  errors += check(usage.contiguous_bytes == SMALL + LARGE, "contiguous bytes");
+  errors += check(usage.flag_bytes[0] == LARGE && usage.flag_bos[0] == 1, "non-contiguous bytes");
+  errors += check(usage.flag_bytes[4] == LARGE, "iommu bytes");
+  errors += check(usage.flag_bytes[1] == SMALL + LARGE && usage.flag_bos[1] == 2, "cacheable bytes");
+  errors += check(strcmp(npu_mem_flag_name(4), "iommu") == 0, "flag names");
+
+  npu_bo_free(fd, &large);
+  npu_get_mem_usage(&usage);
+  errors += check(usage.flag_bytes[0] == 0 && usage.bytes == SMALL + LARGE, "freed bytes");
+  errors += check(usage.peak_bytes == SMALL + 2 * LARGE, "peak kept");
+
+  // Without the caller's word that the IOMMU is on, everything comes from CMA
+  errors += check(npu_bo_alloc(fd, LARGE, 0, &plain) == 0, "large alloc without iommu");
+  errors += check((plain.flags & large_flags) == 0, "contiguous without iommu");
+  errors += check(iommu_queries == 0, "allocations never ask the driver");
+  npu_bo_free(fd, &plain);
+
+  // The context decides from its cached caps, asked once
+  npu_context_t ctx;
+  npu_buf_t buf;
+  npu_context_init(&ctx);
+  errors += check(npu_pool_alloc(npu_context_pool(&ctx), LARGE, 64, &buf) == 0, "context pool alloc");
+  errors += check((last_create_flags & large_flags) == large_flags, "context pool uses the iommu");
+  npu_pool_free(npu_context_pool(&ctx), &buf);
+  npu_context_destroy(&ctx);
+  iommu = 0;
+  npu_context_init(&ctx);
+  errors += check(npu_pool_alloc(npu_context_pool(&ctx), LARGE, 64, &buf) == 0, "context pool alloc without iommu");
+  errors += check((last_create_flags & large_flags) == 0, "context pool contiguous without iommu");
+  npu_pool_free(npu_context_pool(&ctx), &buf);
+  npu_context_destroy(&ctx);
+  iommu = 1;
+  errors += check(iommu_queries == 2, "iommu asked once per context");
+
+  // A failed non-contiguous allocation falls back to CMA
+  fail_noncontiguous = 1;
+  errors += check(npu_bo_alloc(fd, LARGE, NPU_BO_IOMMU, &plain) == 0, "fallback alloc");
+  errors += check((plain.flags & large_flags) == 0, "fallback is contiguous");
+  npu_bo_free(fd, &plain);
+  fail_noncontiguous = 0;
+
+  // A BO that can't be mapped is destroyed, not leaked
+  fail_map = 1;
+  destroys = 0;
+  errors += check(npu_bo_alloc(fd, SMALL, 0, &plain) < 0, "unmappable alloc fails");
+  errors += check(destroys == 1 && plain.map == NULL, "unmappable bo destroyed");
+  fail_map = 0;
+
+  // Threshold 0 turns the placement off
+  npu_set_large_bo_min(0);
+  errors += check(npu_bo_alloc(fd, LARGE, NPU_BO_IOMMU, &plain) == 0, "alloc with placement off");
+  errors += check((plain.flags & large_flags) == 0, "placement off");
+  npu_bo_free(fd, &plain);
+  npu_set_large_bo_min(NPU_LARGE_BO_MIN);
+
+  npu_bo_free(fd, &small);
+  npu_bo_free(fd, &hot);
+  npu_get_mem_usage(&usage);
+  errors += check(usage.bytes == 0 && usage.bos == 0 && usage.contiguous_bytes == 0, "all freed");
+
+  npu_close(fd);
+  npu_set_ioctl_hook(NULL);
+
+  return npu_test_done(errors, "mem usage");
+}
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_standin.h"
+
+typedef struct {
+  int       in_fence;   // our own dup, -1 if none
+  int       out_fence;  // our own dup of the eventfd handed out
+  uint64_t  task_obj_addr;
+  uint32_t  delay_ms;
+} standin_job_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+static npu_standin_stats_t stats;
+static uint32_t delay = 0;
+static uint32_t in_flight = 0;
+static uint32_t action_values[32];
+static int fault_kind = NPU_STANDIN_FAULT_NONE;
+static uint32_t fault_count = 0;
+static int hung = 0;
+static struct rknpu_task *tasks = NULL;
+
+static void sleep_ms(uint32_t ms) {
+  if (ms > 0)
+    usleep(ms * 1000);
+}
+
+static void job_complete(uint64_t task_obj_addr) {
+
+  pthread_mutex_lock(&lock);
+  if (stats.completed < NPU_STANDIN_MAX_JOBS)
+    stats.order[stats.completed] = task_obj_addr;
+  stats.completed++;
+  in_flight--;
+  pthread_cond_broadcast(&idle);
+  pthread_mutex_unlock(&lock);
+}
+
+static void *job_thread(void *arg) {
+
+  standin_job_t *job = arg;
+  uint64_t one = 1;
+
+  if (job->in_fence >= 0) {
+    struct pollfd pfd = { .fd = job->in_fence, .events = POLLIN };
+    while ((poll(&pfd, 1, -1) < 0) && (errno == EINTR))
+      ;
+    close(job->in_fence);
+  }
+  sleep_ms(job->delay_ms);
+
+  // Record before signalling so a waiter always sees the completion
+  job_complete(job->task_obj_addr);
+  if (write(job->out_fence, &one, sizeof(one)) != sizeof(one))
+    abort();
+  close(job->out_fence);
+  free(job);
+  return NULL;
+}
+
+static void set_int_status(const struct rknpu_submit *submit, int fault) {
+
+  for (int i = 0; (tasks != NULL) && (i < 5); i++) {
+    const struct rknpu_subcore_task *sub = &submit->subcore_task[i];
+    struct rknpu_task *last;
+
+    if (sub->task_number == 0)
+      continue;
+    last = &tasks[sub->task_start + sub->task_number - 1];
+    last->int_status = fault ? 0 : last->int_mask;
+  }
+}
+
+static int blocking_submit(struct rknpu_submit *submit) {
+
+  int fault = NPU_STANDIN_FAULT_NONE;
+
+  pthread_mutex_lock(&lock);
+  if (fault_count > 0) {
+    fault = fault_kind;
+    fault_count--;
+    hung |= (fault == NPU_STANDIN_FAULT_HANG);
+  }
+  if (hung)
+    fault = NPU_STANDIN_FAULT_HANG;
+  if (fault != NPU_STANDIN_FAULT_NONE)
+    stats.faults++;
+  pthread_mutex_unlock(&lock);
+
+  if (fault == NPU_STANDIN_FAULT_HANG) {
+    sleep_ms(submit->timeout);
+    job_complete(submit->task_obj_addr);
+    errno = ETIMEDOUT;
+    return -1;
+  }
+
+  sleep_ms(delay);
+  set_int_status(submit, fault == NPU_STANDIN_FAULT_IRQ);
+  job_complete(submit->task_obj_addr);
+  return 0;
+}
+
+static int standin_submit(struct rknpu_submit *submit) {
+
+  standin_job_t *job;
+  pthread_t thread;
+  int efd;
+
+  pthread_mutex_lock(&lock);
+  stats.submits++;
+  stats.last_submit = *submit;
+  for (int c = 0; c < 3; c++) {
+    if ((submit->core_mask & (1 << c)) && (submit->subcore_task[c].task_number > 0))
+      stats.core_submits[c]++;
+  }
+  in_flight++;
+  if (in_flight > stats.max_in_flight)
+    stats.max_in_flight = in_flight;
+  pthread_mutex_unlock(&lock);
+
+  if ((submit->flags & RKNPU_JOB_NONBLOCK) == 0)
+    return blocking_submit(submit);
+
+  if ((submit->flags & RKNPU_JOB_FENCE_OUT) == 0) {
+    job_complete(submit->task_obj_addr);
+    errno = EINVAL;
+    return -1;
+  }
+
+  job = calloc(1, sizeof(*job));
+  efd = eventfd(0, EFD_CLOEXEC);
+  if ((job == NULL) || (efd < 0)) {
+    free(job);
+    job_complete(submit->task_obj_addr);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  // Like the driver, hold our own references so the caller may close its fds
+  job->in_fence = (submit->flags & RKNPU_JOB_FENCE_IN) ? dup(submit->fence_fd) : -1;
+  job->out_fence = dup(efd);
+  job->task_obj_addr = submit->task_obj_addr;
+  job->delay_ms = delay;
+
+  if (pthread_create(&thread, NULL, job_thread, job) != 0) {
+    if (job->in_fence >= 0)
+      close(job->in_fence);
+    close(job->out_fence);
+    close(efd);
+    free(job);
+    job_complete(submit->task_obj_addr);
+    errno = EAGAIN;
+    return -1;
+  }
+  pthread_detach(thread);
+
+  submit->fence_fd = efd;
+  return 0;
+}
+
+static int standin_action(struct rknpu_action *act) {
+
+  pthread_mutex_lock(&lock);
+  if (stats.action_count < NPU_STANDIN_MAX_ACTIONS)
+    stats.actions[stats.action_count] = *act;
+  stats.action_count++;
+
+  switch (act->flags) {
+    case RKNPU_SET_FREQ:
+    case RKNPU_SET_VOLT:
+    case RKNPU_SET_BW_PRIORITY:
+    case RKNPU_SET_BW_EXPECT:
+    case RKNPU_SET_BW_TW:
+      // Each SET directly follows its GET in enum e_rknpu_action
+      action_values[act->flags - 1] = act->value;
+      break;
+    case RKNPU_ACT_RESET:
+      stats.resets++;
+      hung = 0;
+      break;
+    default:
+      if (act->flags < 32)
+        act->value = action_values[act->flags];
+      break;
+  }
+  pthread_mutex_unlock(&lock);
+  return 0;
+}
+
+static int standin_ioctl(int fd, unsigned long request, void *arg) {
+
+  if (request == DRM_IOCTL_RKNPU_SUBMIT)
+    return standin_submit(arg);
+  if (request == DRM_IOCTL_RKNPU_ACTION)
+    return standin_action(arg);
+  errno = ENOTTY;
+  return -1;
+}
+
+int npu_standin_open(uint32_t delay_ms) {
+
+  pthread_mutex_lock(&lock);
+  memset(&stats, 0, sizeof(stats));
+  memset(action_values, 0, sizeof(action_values));
+  fault_kind = NPU_STANDIN_FAULT_NONE;
+  fault_count = 0;
+  hung = 0;
+  tasks = NULL;
+  delay = delay_ms;
+  pthread_mutex_unlock(&lock);
+
+  npu_set_ioctl_hook(standin_ioctl);
+  return open("/dev/null", O_RDWR | O_CLOEXEC);
+}
+
+// Waits for outstanding jobs so nothing completes after the hook is gone
+void npu_standin_close(int fd) {
+
+  pthread_mutex_lock(&lock);
+  while (in_flight > 0)
+    pthread_cond_wait(&idle, &lock);
+  pthread_mutex_unlock(&lock);
+
+  npu_set_ioctl_hook(NULL);
+  if (fd >= 0)
+    close(fd);
+}
+
+void npu_standin_set_delay(uint32_t delay_ms) {
+  pthread_mutex_lock(&lock);
+  delay = delay_ms;
+  pthread_mutex_unlock(&lock);
+}
+
+void npu_standin_get_stats(npu_standin_stats_t *out) {
+  pthread_mutex_lock(&lock);
+  *out = stats;
+  pthread_mutex_unlock(&lock);
+}
+
+void npu_standin_set_action_value(uint32_t get_flags, uint32_t value) {
+  pthread_mutex_lock(&lock);
+  if (get_flags < 32)
+    action_values[get_flags] = value;
+  pthread_mutex_unlock(&lock);
+}
+
+void npu_standin_inject_fault(int kind, uint32_t count) {
+  pthread_mutex_lock(&lock);
+  fault_kind = kind;
+  fault_count = count;
+  pthread_mutex_unlock(&lock);
+}
+
+void npu_standin_set_tasks(struct rknpu_task *task_array) {
+  pthread_mutex_lock(&lock);
+  tasks = task_array;
+  pthread_mutex_unlock(&lock);
+}
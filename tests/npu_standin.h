@@ -0,0 +1,74 @@
+#ifndef NPU_STANDIN_H
+#define NPU_STANDIN_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+
+#include "rknpu-ioctl.h"
+
+/*
+ * Stand-in for the rknpu driver used by host tests. Installed through
+ * npu_set_ioctl_hook(), it accepts RKNPU_SUBMIT and completes each job after
+ * a configurable delay. Out-fences are eventfds, which poll like a sync_file.
+ * RKNPU_ACTION calls are recorded, RKNPU_SET_x stores the value RKNPU_GET_x
+ * returns.
+ *
+ * Faults can be injected into blocking submits. A hang wedges the device,
+ * every submit then times out until RKNPU_ACT_RESET.
+ */
+
+#define NPU_STANDIN_MAX_JOBS    256
+#define NPU_STANDIN_MAX_ACTIONS 64
+
+enum {
+  NPU_STANDIN_FAULT_NONE = 0,
+  NPU_STANDIN_FAULT_HANG,   // waits out submit->timeout, fails with ETIMEDOUT
+  NPU_STANDIN_FAULT_IRQ,    // completes with int_status 0 in the last task
+};
+
+typedef struct {
+  uint32_t  submits;
+  uint32_t  completed;
+  uint32_t  max_in_flight;
+  struct rknpu_submit last_submit;
+  // Per core submits that had a task range in that core's subcore_task slot
+  uint32_t  core_submits[3];
+  // task_obj_addr of each job in completion order
+  uint64_t  order[NPU_STANDIN_MAX_JOBS];
+  uint32_t  resets;
+  uint32_t  faults;
+  uint32_t  action_count;
+  struct rknpu_action actions[NPU_STANDIN_MAX_ACTIONS];
+} npu_standin_stats_t;
+
+int npu_standin_open(uint32_t delay_ms);
+void npu_standin_close(int fd);
+void npu_standin_set_delay(uint32_t delay_ms);
+void npu_standin_get_stats(npu_standin_stats_t *stats);
+// Value returned by a RKNPU_GET_x action until something sets it
+void npu_standin_set_action_value(uint32_t get_flags, uint32_t value);
+// The next count blocking submits fault
+void npu_standin_inject_fault(int kind, uint32_t count);
+// Task array the stand-in writes int_status to, like the driver does
+void npu_standin_set_tasks(struct rknpu_task *tasks);
+
+#endif // NPU_STANDIN_H
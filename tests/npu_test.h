@@ -0,0 +1,43 @@
+#ifndef NPU_TEST_H
+#define NPU_TEST_H
+
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+
+/*
+ * Shared by the host tests: check() reports a failed condition and counts
+ * it, npu_test_done() prints "<name> PASSED" and gives the exit status.
+ */
+
+static inline int check(int cond, const char *what) {
+  if (!cond)
+    printf("FAILED: %s\n", what);
+  return cond ? 0 : 1;
+}
+
+static inline int npu_test_done(int errors, const char *name) {
+  if (errors == 0)
+    printf("%s PASSED\n", name);
+  return errors ? -1 : 0;
+}
+
+#endif // NPU_TEST_H
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "npu_hw.h"
+#include "npu_perf.h"
+#include "npu_test.h"
+
+// Cost model regression checks, runs on the host.
+
+int main(int argc, char **argv) {
+
+  npu_perf_hw_t hw;
+  npu_perf_t gemv, gemm, fp16_out, int8, partial;
+  int errors = 0;
+
+  npu_perf_default_hw(&hw);
+  hw.dram_gbps = 10.0;
+  hw.freq_mhz = 1000.0;
+
+  // Decode style GEMV is bound by streaming the weights
+  errors += check(npu_perf_matmul(&hw, precision_float16, 1, 4096, 4096, 0, &gemv) == 0, "gemv");
+  errors += check(gemv.macs == 4096ull * 4096, "gemv macs");
+  errors += check(gemv.mac_cycles == 1ull * 256 * 128, "gemv cycles");
+  errors += check(gemv.weight_bytes == 4096ull * 4096 * 2, "gemv weight bytes");
+  errors += check(gemv.feature_bytes == 4096ull * 2, "gemv feature bytes");
+  errors += check(gemv.output_bytes == 4096ull * 4, "gemv output bytes");
+  errors += check(gemv.bound == npu_perf_memory_bound, "gemv memory bound");
+  errors += check(gemv.time_us == gemv.memory_us, "gemv time");
+
+  // Prefill style GEMM with the same weights reuses them across rows
+  errors += check(npu_perf_matmul(&hw, precision_float16, 384, 384, 4096, 0, &gemm) == 0, "gemm");
+  errors += check(gemm.mac_cycles == 384ull * 256 * 12, "gemm cycles");
+  errors += check(gemm.intensity > 50 * gemv.intensity, "gemm intensity");
+  errors += check(gemm.mac_utilisation == 1.0, "full atoms");
+
+  // fp16 output halves the write traffic
+  errors += check(npu_perf_matmul(&hw, precision_float16, 384, 384, 4096, 1, &fp16_out) == 0, "fp16 out");
+  errors += check(fp16_out.output_bytes * 2 == gemm.output_bytes, "fp16 output bytes");
+
+  // int8 atoms are twice as wide
+  errors += check(npu_perf_matmul(&hw, precision_int8, 384, 384, 4096, 0, &int8) == 0, "int8");
+  errors += check(int8.mac_cycles * 2 == gemm.mac_cycles, "int8 cycles");
+  errors += check(int8.weight_bytes * 2 == gemm.weight_bytes, "int8 weight bytes");
+
+  // Partial kernel groups still cost a full atom
+  errors += check(npu_perf_matmul(&hw, precision_float16, 4, 64, 24, 0, &partial) == 0, "partial");
+  errors += check(partial.mac_cycles == 4ull * 2 * 2, "partial cycles");
+  errors += check(partial.mac_utilisation == 0.75, "partial utilisation");
+
+  // Higher bandwidth moves the balance point
+  hw.dram_gbps = 2000.0;
+  errors += check(npu_perf_matmul(&hw, precision_float16, 1, 4096, 4096, 0, &gemv) == 0, "gemv fast dram");
+  errors += check(gemv.bound == npu_perf_compute_bound, "gemv compute bound with fast dram");
+
+  // Shapes the generator rejects are rejected here too
+  errors += check(npu_perf_matmul(&hw, precision_float16, 4096, 4096, 16, 0, &gemv) != 0, "too big");
+
+  return npu_test_done(errors, "perf model");
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "npu_interface.h"
+#include "npu_pool.h"
+#include "npu_test.h"
+
+// Drives the pool against a malloc backed fake allocator, no /dev/dri needed.
+
+#define LIVE 512
+
+static int backend_allocs = 0;
+static int backend_frees = 0;
+static uint64_t next_dma = 0x10000000;
+
+static int fake_alloc(void *ctx, size_t size, uint32_t flags, npu_bo_t *bo) {
+
+  size_t pages = (size + 4095) / 4096;
+
+  memset(bo, 0, sizeof(*bo));
+  if (posix_memalign(&bo->map, 4096, pages * 4096) != 0)
+    return -1;
+  bo->size = size;
+  bo->flags = flags;
+  bo->dma_addr = next_dma;
+  bo->obj_addr = 0xff000000 + backend_allocs;
+  bo->handle = ++backend_allocs;
+  next_dma += pages * 4096 + 4096;
+  return 0;
+}
+
+static void fake_free(void *ctx, npu_bo_t *bo) {
+  backend_frees++;
+  free(bo->map);
+}
+
+int main(int argc, char **argv) {
+
+  npu_pool_backend_t backend = { .alloc = fake_alloc, .free = fake_free, .ctx = NULL };
+  npu_pool_t pool;
+  npu_pool_stats_t stats;
+  npu_buf_t bufs[LIVE], a, b, big;
+  int errors = 0;
+
+  if (npu_pool_init(&pool, &backend, 0, 0) < 0) {
+    printf("npu_pool_init failed\n");
+    return -1;
+  }
+
+  // Lots of regcmd sized buffers share one BO
+  for (int i = 0; i < 64; i++) {
+    errors += check(npu_pool_alloc(&pool, 1024, 0, &bufs[i]) == 0, "alloc 1KB");
+    errors += check((bufs[i].dma_addr % NPU_POOL_MIN_ALIGN) == 0, "min alignment");
+    errors += check(((uint8_t *)bufs[i].map - (uint8_t *)bufs[0].map) ==
+                    (int64_t)(bufs[i].dma_addr - bufs[0].dma_addr), "map and dma agree");
+  }
+  errors += check(backend_allocs == 1, "one backend allocation for 64 buffers");
+
+  // Freed ranges are reused
+  uint64_t dma = bufs[10].dma_addr;
+  npu_pool_free(&pool, &bufs[10]);
+  errors += check(npu_pool_alloc(&pool, 1000, 0, &bufs[10]) == 0, "realloc");
+  errors += check(bufs[10].dma_addr == dma, "free list reuse");
+  for (int i = 0; i < 64; i++)
+    npu_pool_free(&pool, &bufs[i]);
+
+  // Explicit alignment
+  errors += check(npu_pool_alloc(&pool, 100, 0, &a) == 0, "alloc 100");
+  errors += check(npu_pool_alloc(&pool, 300, 4096, &b) == 0, "alloc aligned");
+  errors += check((b.dma_addr % 4096) == 0, "4KB alignment");
+  npu_pool_free(&pool, &a);
+  npu_pool_free(&pool, &b);
+  errors += check(npu_pool_alloc(&pool, 300, 96, &a) < 0, "alignment must be a power of two");
+
+  // Oversized requests get their own BO which is released on free
+  int before = backend_allocs;
+  errors += check(npu_pool_alloc(&pool, 16 << 20, 0, &big) == 0, "alloc 16MB");
+  errors += check((backend_allocs == before + 1) && (big.size_class == -1), "dedicated BO");
+  npu_pool_get_stats(&pool, &stats);
+  errors += check(stats.dedicated == 1, "dedicated count");
+  npu_pool_free(&pool, &big);
+  errors += check(backend_frees == 1, "dedicated BO released");
+
+  // Oversized requests honour alignments above the page size too
+  errors += check(npu_pool_alloc(&pool, 16 << 20, 64 << 10, &big) == 0, "alloc 16MB 64KB aligned");
+  errors += check((big.dma_addr % (64 << 10)) == 0 && big.size >= (16 << 20), "dedicated alignment");
+  npu_pool_free(&pool, &big);
+
+  // With chunks no bigger than the largest class, an alignment a chunk can't
+  // meet goes to its own BO instead of retiring chunk after chunk
+  {
+    npu_pool_t small;
+    int allocs = backend_allocs;
+    errors += check(npu_pool_init(&small, &backend, 0, 2 << 20) == 0, "2MB chunks");
+    errors += check(npu_pool_alloc(&small, 2 << 20, 8192, &a) == 0, "2MB class 8KB aligned");
+    errors += check((a.dma_addr % 8192) == 0 && a.size >= (2 << 20), "2MB class alignment");
+    errors += check(backend_allocs == allocs + 1, "one backend allocation");
+    npu_pool_free(&small, &a);
+    npu_pool_destroy(&small);
+  }
+
+  // Random churn, live buffers must never overlap
+  memset(bufs, 0, sizeof(bufs));
+  srand(1);
+  for (int it = 0; it < 20000; it++) {
+    int i = rand() % LIVE;
+    if (bufs[i].chunk != NULL) {
+      npu_pool_free(&pool, &bufs[i]);
+    } else {
+      size_t size = 1 + (rand() % (64 << 10));
+      if (npu_pool_alloc(&pool, size, 0, &bufs[i]) < 0) {
+        errors += check(0, "churn alloc");
+        break;
+      }
+      errors += check(bufs[i].size >= size, "usable size");
+      memset(bufs[i].map, i & 0xff, size);
+    }
+  }
+  for (int i = 0; i < LIVE; i++) {
+    for (int j = i + 1; j < LIVE; j++) {
+      if ((bufs[i].chunk == NULL) || (bufs[j].chunk == NULL))
+        continue;
+      if ((bufs[i].dma_addr < bufs[j].dma_addr + bufs[j].size) &&
+          (bufs[j].dma_addr < bufs[i].dma_addr + bufs[i].size)) {
+        errors += check(0, "live buffers overlap");
+        i = LIVE;
+        break;
+      }
+    }
+  }
+
+  npu_pool_get_stats(&pool, &stats);
+  printf("reserved %llu KB in %u chunks, in use %llu KB (requested %llu KB, peak %llu KB)\n",
+         (unsigned long long)stats.bytes_reserved >> 10, stats.chunks,
+         (unsigned long long)stats.bytes_in_use >> 10, (unsigned long long)stats.bytes_requested >> 10,
+         (unsigned long long)stats.peak_in_use >> 10);
+  printf("allocs %llu, frees %llu, free list hits %llu, backend allocs %llu\n",
+         (unsigned long long)stats.allocs, (unsigned long long)stats.frees,
+         (unsigned long long)stats.free_list_hits, (unsigned long long)stats.backend_allocs);
+  errors += check(stats.bytes_in_use <= stats.bytes_reserved, "in use <= reserved");
+
+  for (int i = 0; i < LIVE; i++)
+    npu_pool_free(&pool, &bufs[i]);
+  npu_pool_get_stats(&pool, &stats);
+  errors += check((stats.bytes_in_use == 0) && (stats.bytes_requested == 0), "all buffers returned");
+
+  npu_pool_destroy(&pool);
+  errors += check(backend_allocs == backend_frees, "every BO released");
+
+  if (errors == 0) {
+    printf("Buffer pool test successful\n");
+    return 0;
+  }
+  printf("Buffer pool test FAILED with %d errors\n", errors);
+  return -1;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_hw.h"
+#include "npu_interface.h"
+#include "npu_matmul.h"
+#include "npu_program.h"
+#include "npu_profile.h"
+#include "npu_perf.h"
+#include "npu_emu.h"
+#include "npu_test.h"
+
+// Traffic counters on the emulator backend, checked against the cost model.
+
+#define M 64
+#define K 256
+#define N 512
+
+int main(int argc, char **argv) {
+
+  npu_bo_t input, weights, output;
+  npu_program_t prog;
+  npu_profile_t prof, after;
+  npu_perf_hw_t hw;
+  npu_perf_t perf;
+  npu_job_t job;
+  matmul_params_t params;
+  int errors = 0;
+
+  npu_set_backend(npu_backend_emu());
+  int fd = npu_open();
+
+  errors += check(npu_bo_alloc(fd, M * K * sizeof(_Float16), 0, &input) == 0, "alloc input");
+  errors += check(npu_bo_alloc(fd, weight_size_fp16(N, K), 0, &weights) == 0, "alloc weights");
+  errors += check(npu_bo_alloc(fd, M * N * sizeof(float), 0, &output) == 0, "alloc output");
+  if (errors)
+    return -1;
+
+  memset(&params, 0, sizeof(params));
+  params.m = M;
+  params.k = K;
+  params.n = N;
+  params.input_dma = input.dma_addr;
+  params.weights_dma = weights.dma_addr;
+  params.output_dma = output.dma_addr;
+  npu_program_init(&prog);
+  errors += check(npu_program_add_matmul_fp16(&prog, &params) == 0, "add matmul");
+  errors += check(npu_program_finalize(fd, &prog) == 0, "finalize");
+  npu_program_job(&prog, 0, &job);
+
+  // Traffic from an earlier job must not leak into the profile
+  errors += check(npu_submit(fd, &job) == 0, "warm up");
+  errors += check(npu_submit_profiled(fd, &job, &prof) == 0, "profiled submit");
+
+  npu_perf_default_hw(&hw);
+  errors += check(npu_perf_matmul(&hw, precision_float16, M, K, N, 0, &perf) == 0, "model");
+  errors += check(prof.data_read == perf.feature_bytes, "data read matches the model");
+  errors += check(prof.weight_read == perf.weight_bytes, "weight read matches the model");
+  errors += check(prof.data_write == perf.output_bytes, "data write matches the model");
+  errors += check(prof.total_rw == prof.data_read + prof.weight_read + prof.data_write, "total");
+  errors += check(prof.wall_us > 0 && prof.read_gbps > 0 && prof.write_gbps > 0, "bandwidth");
+  printf("read %llu B, weights %llu B, write %llu B in %.1f us, %.2f GB/s read %.2f GB/s write\n",
+    (unsigned long long)prof.data_read, (unsigned long long)prof.weight_read,
+    (unsigned long long)prof.data_write, prof.wall_us, prof.read_gbps, prof.write_gbps);
+
+  errors += check(npu_profile_clear(fd) == 0, "clear");
+  errors += check(npu_profile_read(fd, &after) == 0 && after.total_rw == 0, "cleared");
+
+  npu_program_free(fd, &prog);
+  npu_bo_free(fd, &input);
+  npu_bo_free(fd, &weights);
+  npu_bo_free(fd, &output);
+  npu_close(fd);
+
+  return npu_test_done(errors, "profiling counters");
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_hw.h"
+#include "npu_interface.h"
+#include "npu_matmul.h"
+#include "npu_program.h"
+#include "npu_standin.h"
+#include "npu_test.h"
+
+// Builds a multi-task program, lays it out at a fake address and decodes it.
+
+#define LAYERS      5
+#define REGCMD_DMA  0x40001000
+
+int main(int argc, char **argv) {
+
+  npu_program_t prog;
+  npu_standin_stats_t stats;
+  matmul_params_t params;
+  uint64_t expected[112], *regcmd;
+  struct rknpu_task *tasks;
+  uint64_t odd[3];
+  int errors = 0;
+
+  npu_program_init(&prog);
+
+  // A stack of 1x768x768 layers, each reads the previous output
+  for (int i = 0; i < LAYERS; i++) {
+    memset(&params, 0, sizeof(params));
+    params.m = 1;
+    params.k = 768;
+    params.n = 768;
+    params.input_dma = 0x10000000 + i * 0x100000;
+    params.weights_dma = 0x20000000 + i * 0x200000;
+    params.output_dma = 0x10000000 + (i + 1) * 0x100000;
+    params.fp32tofp16 = 1;
+    errors += check(npu_program_add_matmul_fp16(&prog, &params) == i, "add matmul");
+  }
+  // A short task checks padding to the alignment
+  for (int i = 0; i < 3; i++)
+    odd[i] = NPUOP(OP_REG_DPU, i, DPU_S_POINTER);
+  errors += check(npu_program_add_task(&prog, odd, 3, 0x9, 0x300) == LAYERS, "add short task");
+  errors += check(npu_program_add_task(&prog, odd, 0, 0x9, 0x300) < 0, "empty task rejected");
+  errors += check(prog.task_count == LAYERS + 1, "task count");
+
+  regcmd = malloc(npu_program_regcmd_size(&prog));
+  tasks = malloc(npu_program_tasks_size(&prog));
+  errors += check(npu_program_layout(&prog, REGCMD_DMA + 8, regcmd, tasks) < 0, "unaligned base rejected");
+  errors += check(npu_program_layout(&prog, REGCMD_DMA, regcmd, tasks) == 0, "layout");
+
+  for (int i = 0; i < LAYERS + 1; i++) {
+    errors += check((tasks[i].regcmd_addr % NPU_PROGRAM_ALIGN) == 0, "task aligned");
+    errors += check(tasks[i].regcmd_addr == REGCMD_DMA + tasks[i].regcfg_offset, "regcmd_addr");
+  }
+  errors += check(tasks[0].regcfg_amount == 104 && tasks[0].enable_mask == 0xd && tasks[0].int_mask == 0x300,
+    "matmul task fields match the single task tests");
+  errors += check(tasks[1].regcfg_offset == 112 * sizeof(uint64_t), "matmul block size");
+  errors += check(tasks[LAYERS].regcfg_amount == 3 && tasks[LAYERS].enable_mask == 0x9, "short task fields");
+  errors += check(npu_program_regcmd_size(&prog) == (LAYERS * 112 + 8) * sizeof(uint64_t), "regcmd size");
+
+  // Payload is exactly what the generator produced
+  memset(&params, 0, sizeof(params));
+  params.m = 1;
+  params.k = 768;
+  params.n = 768;
+  params.input_dma = 0x10000000 + 2 * 0x100000;
+  params.weights_dma = 0x20000000 + 2 * 0x200000;
+  params.output_dma = 0x10000000 + 3 * 0x100000;
+  params.fp32tofp16 = 1;
+  params.tasks = expected;
+  gen_matmul_fp16(&params);
+  errors += check(memcmp(regcmd + tasks[2].regcfg_offset / 8, expected, 104 * sizeof(uint64_t)) == 0, "payload");
+
+  errors += check(npu_program_verify(regcmd, REGCMD_DMA, npu_program_regcmd_size(&prog), tasks, prog.task_count) == 0,
+    "decoder follows the chain");
+  if (argc > 1)
+    npu_program_dump(stdout, regcmd, REGCMD_DMA, tasks, prog.task_count);
+
+  // Break the link from task 2 to 3
+  uint64_t saved = regcmd[tasks[2].regcfg_offset / 8 + 104];
+  regcmd[tasks[2].regcfg_offset / 8 + 104] = NPUOP(OP_REG_PC, tasks[4].regcmd_addr, PC_BASE_ADDRESS);
+  errors += check(npu_program_verify(regcmd, REGCMD_DMA, npu_program_regcmd_size(&prog), tasks, prog.task_count) == -4,
+    "broken chain found at task 3");
+  regcmd[tasks[2].regcfg_offset / 8 + 104] = saved;
+  tasks[1].regcfg_amount++;
+  errors += check(npu_program_verify(regcmd, REGCMD_DMA, npu_program_regcmd_size(&prog), tasks, prog.task_count) == -1,
+    "amount mismatch found at task 0");
+  tasks[1].regcfg_amount--;
+
+  // All tasks go in one submit
+  int fd = npu_standin_open(0);
+  prog.tasks_bo.obj_addr = 0xabc000;
+  errors += check(npu_program_submit(fd, &prog, 1) == 0, "submit");
+  npu_standin_get_stats(&stats);
+  errors += check(stats.submits == 1, "one ioctl");
+  errors += check(stats.last_submit.task_number == LAYERS + 1, "task_number");
+  errors += check(stats.last_submit.task_obj_addr == 0xabc000, "task_obj_addr");
+  errors += check(stats.core_submits[1] == 1 && stats.last_submit.subcore_task[1].task_number == LAYERS + 1,
+    "subcore task");
+  npu_standin_close(fd);
+  prog.tasks_bo.obj_addr = 0;
+
+  // Reset keeps the buffers
+  npu_program_reset(&prog);
+  errors += check(prog.task_count == 0 && prog.regcmd != NULL, "reset");
+
+  free(regcmd);
+  free(tasks);
+  npu_program_free(-1, &prog);
+
+  return npu_test_done(errors, "task program");
+}
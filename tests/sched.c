@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "npu_interface.h"
+#include "npu_sched.h"
+#include "npu_standin.h"
+#include "npu_test.h"
+
+// Scheduler policy in simulated mode, then the drm path against the stand-in.
+
+#define TASKS   30
+#define TASK_US 2000
+
+static int done_count = 0;
+
+static void task_done(npu_sched_task_t *task) {
+  __atomic_add_fetch(&done_count, 1, __ATOMIC_RELAXED);
+}
+
+static void setup(npu_sched_task_t *tasks, int count, int core, int pinned) {
+
+  memset(tasks, 0, count * sizeof(*tasks));
+  for (int i = 0; i < count; i++) {
+    tasks[i].job.task_obj_addr = 0x1000 * (i + 1);
+    tasks[i].job.task_number = 1;
+    tasks[i].core = core;
+    tasks[i].pinned = pinned;
+    tasks[i].sim_us = TASK_US;
+    tasks[i].done = task_done;
+  }
+}
+
+static int run(npu_sched_t *s, npu_sched_task_t *tasks, int count, npu_sched_stats_t *stats) {
+
+  int errors = 0;
+
+  done_count = 0;
+  for (int i = 0; i < count; i++)
+    errors += check(npu_sched_submit(s, &tasks[i]) == 0, "submit");
+  npu_sched_wait_idle(s);
+  npu_sched_get_stats(s, stats);
+  errors += check(done_count == count, "every done callback ran");
+  return errors;
+}
+
+int main(int argc, char **argv) {
+
+  npu_sched_t sched;
+  npu_sched_stats_t stats;
+  npu_standin_stats_t standin;
+  npu_sched_task_t tasks[TASKS];
+  int errors = 0;
+
+  // Without stealing a backlog on core 0 stays there
+  errors += check(npu_sched_init_sim(&sched, 3, NPU_SCHED_NO_STEAL) == 0, "init no steal");
+  setup(tasks, TASKS, 0, 0);
+  errors += run(&sched, tasks, TASKS, &stats);
+  errors += check(stats.jobs[0] == TASKS, "all on core 0");
+  errors += check(stats.stolen[1] + stats.stolen[2] == 0, "nothing stolen");
+  errors += check(stats.peak_depth[0] > 1, "core 0 queue built up");
+  errors += check(stats.utilisation[0] > 0.0, "core 0 utilisation");
+  npu_sched_destroy(&sched);
+
+  // Idle cores take work from the busy one
+  errors += check(npu_sched_init_sim(&sched, 3, 0) == 0, "init");
+  setup(tasks, TASKS, 0, 0);
+  errors += run(&sched, tasks, TASKS, &stats);
+  errors += check((stats.jobs[1] > 0) && (stats.jobs[2] > 0), "other cores stole work");
+  errors += check(stats.stolen[1] + stats.stolen[2] == stats.jobs[1] + stats.jobs[2], "stolen counted");
+  for (int i = 0; i < TASKS; i++)
+    errors += check(tasks[i].stolen == (tasks[i].ran_on != 0), "task stolen flag");
+  errors += check(stats.submitted == TASKS && stats.completed == TASKS, "submitted and completed");
+
+  // Pinned work never moves
+  setup(tasks, TASKS, 0, 1);
+  errors += run(&sched, tasks, TASKS, &stats);
+  for (int i = 0; i < TASKS; i++)
+    errors += check(tasks[i].ran_on == 0, "pinned task stays on core 0");
+
+  // No preference spreads over the cores
+  setup(tasks, TASKS, -1, 0);
+  errors += run(&sched, tasks, TASKS, &stats);
+  errors += check(stats.jobs[2] > 0, "core 2 used");
+  errors += check(npu_sched_submit(&sched, &(npu_sched_task_t){ .core = 3 }) < 0, "bad core rejected");
+  errors += check(npu_sched_submit(&sched, &(npu_sched_task_t){ .core = -1, .pinned = 1 }) < 0, "pinned needs a core");
+  npu_sched_destroy(&sched);
+
+  // Real submit path, each job goes to exactly one core with its task range
+  int fd = npu_standin_open(1);
+  errors += check(fd >= 0, "stand-in open");
+  errors += check(npu_sched_init_drm(&sched, fd, 3, 0) == 0, "init drm");
+  setup(tasks, TASKS, -1, 0);
+  errors += run(&sched, tasks, TASKS, &stats);
+  npu_standin_get_stats(&standin);
+  errors += check(standin.submits == TASKS, "one ioctl per job");
+  for (int c = 0; c < 3; c++)
+    errors += check(standin.core_submits[c] == stats.jobs[c], "core_mask and subcore_task match the core");
+  for (int i = 0; i < TASKS; i++)
+    errors += check(tasks[i].status == 0, "submit status");
+  npu_sched_destroy(&sched);
+  npu_standin_close(fd);
+
+  return npu_test_done(errors, "scheduler");
+}
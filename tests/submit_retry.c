@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_submit.h"
+#include "npu_standin.h"
+#include "npu_test.h"
+
+// Timeout, fault detection and reset-and-retry against the fault injecting stand-in.
+
+#define TIMEOUT_MS 20
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+int main(int argc, char **argv) {
+
+  struct rknpu_task tasks[2];
+  npu_standin_stats_t stats;
+  npu_submit_stats_t sub;
+  npu_job_t job;
+  int errors = 0;
+  double start;
+
+  int fd = npu_standin_open(0);
+  if (fd < 0) {
+    printf("npu_standin_open failed\n");
+    return -1;
+  }
+
+  errors += check(npu_int_status_ok(0x100, 0x300), "dpu status bit accepted");
+  errors += check(npu_int_status_ok(0x300, 0x300), "both dpu status bits accepted");
+  errors += check(!npu_int_status_ok(0x0, 0x300), "missing status rejected");
+  errors += check(!npu_int_status_ok(0x301, 0x300), "extra status rejected");
+
+  memset(tasks, 0, sizeof(tasks));
+  tasks[0].int_mask = 0x300;
+  tasks[1].int_mask = 0x300;
+  npu_standin_set_tasks(tasks);
+
+  memset(&job, 0, sizeof(job));
+  job.task_obj_addr = 0x1000;
+  job.task_number = 2;
+  job.timeout = TIMEOUT_MS;
+  job.tasks = tasks;
+
+  // Clean run, no resets
+  npu_clear_submit_stats();
+  errors += check(npu_submit(fd, &job) == 0, "clean submit");
+  errors += check(tasks[1].int_status == 0x300, "int_status written");
+  npu_get_submit_stats(&sub);
+  errors += check((sub.submits == 1) && (sub.resets == 0), "clean submit stats");
+
+  // A hang is reset and the retry succeeds
+  npu_clear_submit_stats();
+  npu_standin_inject_fault(NPU_STANDIN_FAULT_HANG, 1);
+  job.retries = 2;
+  start = now_ms();
+  errors += check(npu_submit(fd, &job) == 0, "hang recovered");
+  errors += check(now_ms() - start < TIMEOUT_MS * 3, "per job deadline used");
+  npu_get_submit_stats(&sub);
+  errors += check((sub.submits == 2) && (sub.timeouts == 1) && (sub.resets == 1) && (sub.retries == 1), "hang stats");
+  npu_standin_get_stats(&stats);
+  errors += check(stats.resets == 1, "device reset");
+
+  // A bad int_status counts as a fault
+  npu_clear_submit_stats();
+  npu_standin_inject_fault(NPU_STANDIN_FAULT_IRQ, 2);
+  errors += check(npu_submit(fd, &job) == 0, "irq fault recovered");
+  npu_get_submit_stats(&sub);
+  errors += check((sub.faults == 2) && (sub.resets == 2) && (sub.retries == 2) && (sub.failures == 0), "fault stats");
+
+  // Retries are bounded
+  npu_clear_submit_stats();
+  npu_standin_inject_fault(NPU_STANDIN_FAULT_IRQ, 10);
+  job.retries = 1;
+  errors += check(npu_submit(fd, &job) == -EIO, "fault after retries");
+  npu_get_submit_stats(&sub);
+  errors += check((sub.submits == 2) && (sub.failures == 1) && (sub.resets == 2), "bounded retries");
+  npu_standin_inject_fault(NPU_STANDIN_FAULT_NONE, 0);
+
+  // Without retries a hang still resets the device
+  npu_clear_submit_stats();
+  npu_standin_inject_fault(NPU_STANDIN_FAULT_HANG, 1);
+  job.retries = 0;
+  errors += check(npu_submit(fd, &job) == -ETIMEDOUT, "hang without retries");
+  errors += check(npu_submit(fd, &job) == 0, "device usable after reset");
+  npu_get_submit_stats(&sub);
+  errors += check((sub.resets == 1) && (sub.failures == 1), "reset without retries");
+
+  // The process wide default applies when the job has none
+  npu_set_submit_timeout(TIMEOUT_MS);
+  job.timeout = 0;
+  errors += check(npu_submit(fd, &job) == 0, "default timeout submit");
+  npu_standin_get_stats(&stats);
+  errors += check(stats.last_submit.timeout == TIMEOUT_MS, "default timeout used");
+  npu_set_submit_timeout(0);
+
+  npu_standin_close(fd);
+
+  return npu_test_done(errors, "submit retry");
+}
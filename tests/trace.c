@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rknpu-ioctl.h"
+#include "npu_interface.h"
+#include "npu_convert.h"
+#include "npu_emu.h"
+#include "npu_log.h"
+#include "npu_trace.h"
+#include "npu_test.h"
+
+// Trace rings and Chrome trace output, runs on the emulator backend.
+
+#define THREADS 4
+#define THREAD_EVENTS 100
+
+static void *thread_fn(void *arg) {
+  for (int i = 0; i < THREAD_EVENTS; i++) {
+    uint64_t trace = NPU_TRACE_BEGIN();
+    NPU_TRACE_END(npu_trace_wait, trace, i);
+  }
+  return NULL;
+}
+
+static int count_matches(const char *s, const char *needle) {
+  int count = 0;
+  while ((s = strstr(s, needle)) != NULL) {
+    count++;
+    s += strlen(needle);
+  }
+  return count;
+}
+
+int main(int argc, char **argv) {
+
+  pthread_t threads[THREADS];
+  _Float16 src[4 * 32], dst[4 * 32];
+  npu_bo_t bo;
+  char *json;
+  size_t json_size;
+  FILE *fp;
+  int errors = 0;
+
+  npu_set_backend(npu_backend_emu());
+  int fd = npu_open();
+  if (fd < 0) {
+    printf("npu_open failed\n");
+    return -1;
+  }
+
+  errors += check(npu_log_level == NPU_LOG_NONE || getenv("RKNPU_LOG") != NULL, "logging silent by default");
+  npu_set_log_level(99);
+  errors += check(npu_log_level == NPU_LOG_DEBUG, "log level clamped");
+  npu_set_log_level(NPU_LOG_NONE);
+
+  // Nothing is recorded while tracing is off
+  npu_trace_enable(0);
+  npu_trace_clear();
+  memset(src, 0, sizeof(src));
+  npu_pack_feature_fp16(src, 32, 4, 32, 4, dst);
+  errors += check(npu_trace_count() == 0, "disabled records nothing");
+
+  // Library trace points
+  npu_trace_enable(1);
+  errors += check(npu_bo_alloc(fd, 4096, 0, &bo) == 0, "bo alloc");
+  npu_pack_feature_fp16(src, 32, 4, 32, 4, dst);
+  npu_unpack_output_fp16(dst, 4, 4, 32, src, 32);
+  npu_bo_free(fd, &bo);
+  errors += check(npu_trace_count() == 3, "alloc, pack and unpack recorded");
+
+  // Every thread gets its own ring
+  for (int i = 0; i < THREADS; i++)
+    pthread_create(&threads[i], NULL, thread_fn, NULL);
+  for (int i = 0; i < THREADS; i++)
+    pthread_join(threads[i], NULL);
+  errors += check(npu_trace_count() == 3 + THREADS * THREAD_EVENTS, "events from all threads");
+
+  fp = open_memstream(&json, &json_size);
+  errors += check(npu_trace_write(fp) == 3 + THREADS * THREAD_EVENTS, "write returns event count");
+  fclose(fp);
+  errors += check(strncmp(json, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 39) == 0, "json header");
+  errors += check(count_matches(json, "\"ph\":\"X\"") == 3 + THREADS * THREAD_EVENTS, "complete events");
+  errors += check(count_matches(json, "\"name\":\"alloc\"") == 1, "alloc event");
+  errors += check(count_matches(json, "\"name\":\"pack\"") == 1, "pack event");
+  errors += check(count_matches(json, "\"name\":\"wait\"") == THREADS * THREAD_EVENTS, "wait events");
+  errors += check(strcmp(json + json_size - 4, "\n]}\n") == 0, "json trailer");
+  free(json);
+
+  // A full ring keeps the newest events
+  npu_trace_clear();
+  errors += check(npu_trace_count() == 0, "clear");
+  for (int i = 0; i < NPU_TRACE_RING_SIZE + 10; i++) {
+    uint64_t trace = NPU_TRACE_BEGIN();
+    NPU_TRACE_END(npu_trace_submit, trace, i);
+  }
+  errors += check(npu_trace_count() == NPU_TRACE_RING_SIZE, "ring wraps");
+  fp = open_memstream(&json, &json_size);
+  npu_trace_write(fp);
+  fclose(fp);
+  errors += check(strstr(json, "\"arg\":9}") == NULL, "oldest events overwritten");
+  errors += check(strstr(json, "\"arg\":10}") != NULL, "newest events kept");
+  free(json);
+
+  npu_trace_enable(0);
+  npu_close(fd);
+
+  return npu_test_done(errors, "trace");
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "npu_hw.h"
+#include "npu_matmul.h"
+#include "npu_weights.h"
+
+// Round trips a couple of tensors through a .rknw file, no NPU required.
+
+#define N_FP16 48
+#define K_FP16 96
+#define N_INT8 32
+#define K_INT8 40
+
+_Float16 matrix_fp16[N_FP16*K_FP16];
+int8_t matrix_int8[N_INT8*K_INT8];
+
+// Patches len bytes at offset, returns non zero if the loader still accepts the file
+static int accepts_patched(const char *path, off_t offset, const void *value, size_t len) {
+
+  npu_weights_file_t f;
+  uint8_t saved[16];
+  int fd = open(path, O_RDWR), accepted;
+
+  if ((fd < 0) || (pread(fd, saved, len, offset) != (ssize_t)len) || (pwrite(fd, value, len, offset) != (ssize_t)len)) {
+    if (fd >= 0)
+      close(fd);
+    return 1;
+  }
+  accepted = (npu_weights_open(&f, path) == 0);
+  if (accepted)
+    npu_weights_close(&f);
+  if (pwrite(fd, saved, len, offset) != (ssize_t)len)
+    accepted = 1;
+  close(fd);
+  return accepted;
+}
+
+int main(int argc, char **argv) {
+
+  char path[] = "/tmp/weights_file_XXXXXX";
+  npu_weights_writer_t w;
+  npu_weights_file_t f;
+  const npu_weights_entry_t *e;
+  int ret = 0;
+
+  int tmp = mkstemp(path);
+  if (tmp < 0) {
+    printf("mkstemp failed\n");
+    return -1;
+  }
+  close(tmp);
+
+  for (int i = 0; i < N_FP16*K_FP16; i++)
+    matrix_fp16[i] = (_Float16)(i % 251);
+  for (int i = 0; i < N_INT8*K_INT8; i++)
+    matrix_int8[i] = (int8_t)((i % 255) - 127);
+
+  if ((npu_weights_writer_open(&w, path) < 0) ||
+      (npu_weights_writer_add(&w, "layer0.wq", precision_float16, N_FP16, K_FP16, matrix_fp16) < 0) ||
+      (npu_weights_writer_add(&w, "layer0.wo", precision_int8, N_INT8, K_INT8, matrix_int8) < 0) ||
+      (npu_weights_writer_close(&w) < 0)) {
+    printf("Failed to write %s\n", path);
+    unlink(path);
+    return -1;
+  }
+
+  if (npu_weights_open(&f, path) < 0) {
+    unlink(path);
+    return -1;
+  }
+
+  e = npu_weights_find(&f, "layer0.wq");
+  if ((e == NULL) || (e->n != N_FP16) || (e->k != K_FP16) || (e->offset % NPU_WEIGHTS_ALIGN) ||
+      (e->size != weight_size_fp16(N_FP16, K_FP16))) {
+    printf("fp16 tensor entry mismatch\n");
+    ret = -1;
+  } else {
+    const _Float16 *packed = npu_weights_payload(&f, e);
+    for (int n = 1; n <= N_FP16; n++) {
+      for (int k = 1; k <= K_FP16; k++) {
+        if (packed[weight_fp16(K_FP16, n, k)] != matrix_fp16[((n-1)*K_FP16)+(k-1)]) {
+          printf("fp16 payload mismatch at n:%d k:%d\n", n, k);
+          ret = -1;
+          n = N_FP16;
+          break;
+        }
+      }
+    }
+  }
+
+  e = npu_weights_find(&f, "layer0.wo");
+  if ((e == NULL) || (e->n != N_INT8) || (e->k != K_INT8) || (e->offset % NPU_WEIGHTS_ALIGN) ||
+      (e->size != weight_size_int8(N_INT8, K_INT8))) {
+    printf("int8 tensor entry mismatch\n");
+    ret = -1;
+  } else {
+    // K is padded to 64 channels, padding must be zero
+    const int8_t *packed = npu_weights_payload(&f, e);
+    for (int n = 1; n <= N_INT8; n++) {
+      for (int k = 1; k <= 64; k++) {
+        int8_t expected = (k <= K_INT8) ? matrix_int8[((n-1)*K_INT8)+(k-1)] : 0;
+        if (packed[weight_int8(64, n, k)] != expected) {
+          printf("int8 payload mismatch at n:%d k:%d\n", n, k);
+          ret = -1;
+          n = N_INT8;
+          break;
+        }
+      }
+    }
+  }
+
+  if (npu_weights_find(&f, "missing") != NULL) {
+    printf("lookup of missing tensor succeeded\n");
+    ret = -1;
+  }
+
+  // Corrupt headers and entries are refused before anything reads a payload
+  {
+    off_t table = f.header->table_offset;
+    uint32_t zero = 0, three = 3, bad_layout = npu_layout_weight_int8;
+    uint64_t short_size = weight_size_fp16(N_FP16, K_FP16) - 64;
+
+    npu_weights_close(&f);
+    if (accepts_patched(path, offsetof(npu_weights_header_t, alignment), &zero, sizeof(zero)) ||
+        accepts_patched(path, offsetof(npu_weights_header_t, alignment), &three, sizeof(three)) ||
+        accepts_patched(path, table + offsetof(npu_weights_entry_t, layout), &bad_layout, sizeof(bad_layout)) ||
+        accepts_patched(path, table + offsetof(npu_weights_entry_t, precision), &three, sizeof(three)) ||
+        accepts_patched(path, table + offsetof(npu_weights_entry_t, n), &zero, sizeof(zero)) ||
+        accepts_patched(path, table + offsetof(npu_weights_entry_t, size), &short_size, sizeof(short_size))) {
+      printf("corrupt weights file accepted\n");
+      ret = -1;
+    }
+    if (npu_weights_open(&f, path) < 0) {
+      printf("restored weights file rejected\n");
+      ret = -1;
+    }
+  }
+
+  npu_weights_close(&f);
+  unlink(path);
+
+  if (ret == 0)
+    printf("Weights file round trip successful\n");
+  return ret;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Packs raw row-major weight matrices into a .rknw file :
+ *
+ *   npu_pack_weights out.rknw name:fp16:N:K:file.bin [name:int8:N:K:file.bin ...]
+ *
+ * file.bin holds N rows of K fp16 or int8 values.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "npu_hw.h"
+#include "npu_weights.h"
+
+static int add_tensor(npu_weights_writer_t *w, char *spec) {
+
+  char *name, *type, *n, *k, *path;
+  int precision, N, K;
+  size_t elem, size;
+  void *data;
+  FILE *fp;
+
+  name = strtok(spec, ":");
+  type = strtok(NULL, ":");
+  n = strtok(NULL, ":");
+  k = strtok(NULL, ":");
+  path = strtok(NULL, "");
+  if ((name == NULL) || (type == NULL) || (n == NULL) || (k == NULL) || (path == NULL)) {
+    printf("Invalid tensor spec, expected name:fp16|int8:N:K:file\n");
+    return -1;
+  }
+
+  if (strcmp(type, "fp16") == 0) {
+    precision = precision_float16;
+    elem = sizeof(_Float16);
+  } else if (strcmp(type, "int8") == 0) {
+    precision = precision_int8;
+    elem = sizeof(int8_t);
+  } else {
+    printf("Unsupported type %s\n", type);
+    return -1;
+  }
+
+  N = atoi(n);
+  K = atoi(k);
+  if ((N <= 0) || (K <= 0)) {
+    printf("Invalid shape %s x %s\n", n, k);
+    return -1;
+  }
+
+  size = (size_t)N * K * elem;
+  data = malloc(size);
+  fp = fopen(path, "rb");
+  if ((data == NULL) || (fp == NULL) || (fread(data, 1, size, fp) != size)) {
+    printf("Failed to read %zu bytes from %s\n", size, path);
+    if (fp != NULL)
+      fclose(fp);
+    free(data);
+    return -1;
+  }
+  fclose(fp);
+
+  if (npu_weights_writer_add(w, name, precision, N, K, data) < 0) {
+    printf("Failed to add %s\n", name);
+    free(data);
+    return -1;
+  }
+  printf("%-32s %-4s %6d x %-6d\n", name, type, N, K);
+  free(data);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+
+  npu_weights_writer_t w;
+
+  if (argc < 3) {
+    printf("Usage: %s <out.rknw> <name:fp16|int8:N:K:file> ...\n", argv[0]);
+    return -1;
+  }
+
+  if (npu_weights_writer_open(&w, argv[1]) < 0)
+    return -1;
+
+  for (int i = 2; i < argc; i++) {
+    if (add_tensor(&w, argv[i]) < 0) {
+      npu_weights_writer_close(&w);
+      return -1;
+    }
+  }
+
+  if (npu_weights_writer_close(&w) < 0) {
+    printf("Failed to write %s\n", argv[1]);
+    return -1;
+  }
+  return 0;
+}
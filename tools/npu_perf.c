@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2024  Jasbir Matharu, <jasjnuk@gmail.com>
+ *
+ * This file is part of rk3588-npu.
+ *
+ * rk3588-npu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * rk3588-npu is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with rk3588-npu.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Estimates matmul tasks with the cost model in npu_perf.h :
+ *
+ *   npu_perf [-b GB/s] [-f MHz] [-o overhead_us] fp16|fp16_fp16|int8:M:K:N ...
+ *
+ * A total is printed for the shapes given, so alternative tilings of the
+ * same layer can be compared by running them as separate commands.
+ *
+ *   npu_perf -t [-c cores] [fp16|fp16_fp16|int8:M:K:N ...]
+ *
+ * Compares the DRAM traffic npu_matmul() would predict for its heuristic
+ * M/N tiling against the planned one, for the shapes given or a sweep of
+ * common layer shapes.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "npu_hw.h"
+#include "npu_perf.h"
+#include "npu_gemm.h"
+
+static const char *sweep[] = {
+  "fp16:1:4096:4096", "fp16:1:4096:11008", "fp16:1:11008:4096", "fp16:16:4096:4096",
+  "fp16:64:768:768", "fp16:128:768:3072", "fp16:384:256:192", "fp16:512:1024:64",
+  "fp16:1024:64:1024", "fp16:2048:128:256", "fp16_fp16:256:512:512", "fp16_fp16:1000:2048:128",
+  "int8:1:4096:4096", "int8:64:2048:2048", "int8:512:512:96", "int8:1500:384:384",
+};
+
+static int parse_shape(char *spec, int *precision, int *fp16_out, int *M, int *K, int *N) {
+
+  char *type = strtok(spec, ":");
+  char *m = strtok(NULL, ":");
+  char *k = strtok(NULL, ":");
+  char *n = strtok(NULL, "");
+
+  if ((type == NULL) || (m == NULL) || (k == NULL) || (n == NULL))
+    return -1;
+
+  *fp16_out = 0;
+  if (strcmp(type, "fp16") == 0) {
+    *precision = precision_float16;
+  } else if (strcmp(type, "fp16_fp16") == 0) {
+    *precision = precision_float16;
+    *fp16_out = 1;
+  } else if (strcmp(type, "int8") == 0) {
+    *precision = precision_int8;
+  } else {
+    return -1;
+  }
+
+  *M = atoi(m);
+  *K = atoi(k);
+  *N = atoi(n);
+  return ((*M > 0) && (*K > 0) && (*N > 0)) ? 0 : -1;
+}
+
+static void print_tiling(const npu_matmul_tiling_t *t) {
+  printf(" %4dx%-4d %3d %2d/%-2d %10.1f", t->m_tile, t->n_tile, t->m_tiles * t->n_tiles, t->data_banks,
+    t->weight_banks, t->dram_bytes / 1024.0);
+}
+
+static int compare_tilings(char **shapes, int count, int cores) {
+
+  uint64_t total_heuristic = 0, total_planned = 0;
+
+  printf("%d cores, traffic in KB, tile MxN, tasks, data/weight banks\n", cores);
+  printf("%-24s %9s %3s %5s %10s %9s %3s %5s %10s %7s\n", "shape", "tile", "n", "banks", "heuristic",
+    "tile", "n", "banks", "planned", "saved");
+
+  for (int i = 0; i < count; i++) {
+    char spec[64], label[64];
+    npu_matmul_tiling_t heuristic, planned;
+    int precision, fp16_out, M, K, N, dtype;
+
+    snprintf(spec, sizeof(spec), "%s", shapes[i]);
+    snprintf(label, sizeof(label), "%s", shapes[i]);
+    if (parse_shape(spec, &precision, &fp16_out, &M, &K, &N) < 0) {
+      printf("Invalid shape %s, expected fp16|fp16_fp16|int8:M:K:N\n", label);
+      return -1;
+    }
+    dtype = (precision == precision_int8) ? npu_dtype_int8 : (fp16_out ? npu_dtype_fp16_fp16 : npu_dtype_fp16);
+    if ((npu_matmul_tiling_heuristic(dtype, M, K, N, cores, &heuristic) < 0) ||
+        (npu_matmul_tiling(dtype, M, K, N, cores, &planned) < 0)) {
+      printf("%-24s does not fit one task\n", label);
+      continue;
+    }
+    printf("%-24s", label);
+    print_tiling(&heuristic);
+    print_tiling(&planned);
+    printf(" %6.1f%%\n", 100.0 * (heuristic.dram_bytes - planned.dram_bytes) / heuristic.dram_bytes);
+    total_heuristic += heuristic.dram_bytes;
+    total_planned += planned.dram_bytes;
+  }
+
+  if (total_heuristic > 0)
+    printf("total %.1f KB heuristic, %.1f KB planned, %.1f%% saved\n", total_heuristic / 1024.0,
+      total_planned / 1024.0, 100.0 * (total_heuristic - total_planned) / total_heuristic);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+
+  npu_perf_hw_t hw;
+  npu_perf_t perf;
+  double total_us = 0;
+  uint64_t total_bytes = 0, total_macs = 0;
+  int opt, tilings = 0, cores = 3;
+
+  npu_perf_default_hw(&hw);
+  while ((opt = getopt(argc, argv, "b:c:f:o:t")) != -1) {
+    switch (opt) {
+      case 't': tilings = 1; break;
+      case 'c': cores = atoi(optarg); break;
+      case 'b': hw.dram_gbps = atof(optarg); break;
+      case 'f': hw.freq_mhz = atof(optarg); break;
+      case 'o': hw.task_overhead_us = atof(optarg); break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+
+  if (tilings && (optind <= argc) && (cores > 0)) {
+    if (optind == argc)
+      return compare_tilings((char **)sweep, sizeof(sweep) / sizeof(sweep[0]), cores);
+    return compare_tilings(argv + optind, argc - optind, cores);
+  }
+
+  if (optind >= argc) {
+    printf("Usage: %s [-b GB/s] [-f MHz] [-o overhead_us] <fp16|fp16_fp16|int8:M:K:N> ...\n", argv[0]);
+    printf("       %s -t [-c cores] [fp16|fp16_fp16|int8:M:K:N] ...\n", argv[0]);
+    return -1;
+  }
+
+  printf("%.0f MHz, %.1f GB/s, %.1f us per task\n", hw.freq_mhz, hw.dram_gbps, hw.task_overhead_us);
+  printf("%-24s %10s %10s %10s %10s %10s %6s %6s %6s %8s\n", "shape", "macs", "cycles", "dram KB",
+    "compute us", "memory us", "mac %", "cbuf %", "mac/B", "bound");
+
+  for (int i = optind; i < argc; i++) {
+    char label[64];
+    int precision, fp16_out, M, K, N, ret;
+
+    snprintf(label, sizeof(label), "%s", argv[i]);
+    if (parse_shape(argv[i], &precision, &fp16_out, &M, &K, &N) < 0) {
+      printf("Invalid shape %s, expected fp16|fp16_fp16|int8:M:K:N\n", label);
+      return -1;
+    }
+    ret = npu_perf_matmul(&hw, precision, M, K, N, fp16_out, &perf);
+    if (ret != 0) {
+      printf("%-24s does not fit one task (%d)\n", label, ret);
+      continue;
+    }
+    printf("%-24s %10llu %10llu %10.1f %10.1f %10.1f %6.1f %6.1f %6.1f %8s\n", label,
+      (unsigned long long)perf.macs, (unsigned long long)perf.mac_cycles, perf.dram_bytes / 1024.0,
+      perf.compute_us, perf.memory_us, 100.0 * perf.mac_utilisation, 100.0 * perf.cbuf_utilisation,
+      perf.intensity, (perf.bound == npu_perf_memory_bound) ? "memory" : "compute");
+    total_us += perf.time_us;
+    total_bytes += perf.dram_bytes;
+    total_macs += perf.macs;
+  }
+
+  printf("total %.1f us, %.1f KB, %.2f GMAC/s\n", total_us, total_bytes / 1024.0,
+    (total_us > 0) ? total_macs / (total_us * 1000.0) : 0.0);
+  return 0;
+}